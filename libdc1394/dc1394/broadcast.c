@@ -0,0 +1,305 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Fan-out of captured frames to several consumers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+
+#include "broadcast.h"
+#include "internal.h"
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+
+struct __dc1394consumer_t {
+    dc1394broadcast_t * broadcast;
+    dc1394broadcast_policy_t policy;
+
+    /* Frames waiting for the consumer, oldest at head */
+    dc1394video_frame_t ** queue;
+    uint32_t depth;
+    uint32_t head;
+    uint32_t count;
+    uint64_t skipped;
+    /* Last frame published to the consumer, see dc1394_broadcast_publish() */
+    uint64_t sequence;
+
+    dc1394consumer_t * next;
+};
+
+struct __dc1394broadcast_t {
+    pthread_mutex_t mutex;
+    /* Signalled when a frame is queued, and when a frame leaves a queue */
+    pthread_cond_t frame_queued;
+    pthread_cond_t frame_taken;
+    int closed;
+    uint64_t sequence;
+
+    dc1394consumer_t * consumers;
+};
+
+dc1394broadcast_t *
+dc1394_broadcast_new (void)
+{
+    dc1394broadcast_t * broadcast = calloc (1, sizeof (dc1394broadcast_t));
+
+    if (!broadcast)
+        return NULL;
+    pthread_mutex_init (&broadcast->mutex, NULL);
+    pthread_cond_init (&broadcast->frame_queued, NULL);
+    pthread_cond_init (&broadcast->frame_taken, NULL);
+    return broadcast;
+}
+
+static void
+free_consumer (dc1394consumer_t * consumer)
+{
+    while (consumer->count) {
+        dc1394_frame_unref (consumer->queue[consumer->head]);
+        consumer->head = (consumer->head + 1) % consumer->depth;
+        consumer->count--;
+    }
+    free (consumer->queue);
+    free (consumer);
+}
+
+void
+dc1394_broadcast_free (dc1394broadcast_t * broadcast)
+{
+    if (!broadcast)
+        return;
+
+    while (broadcast->consumers) {
+        dc1394consumer_t * consumer = broadcast->consumers;
+        broadcast->consumers = consumer->next;
+        free_consumer (consumer);
+    }
+    pthread_cond_destroy (&broadcast->frame_queued);
+    pthread_cond_destroy (&broadcast->frame_taken);
+    pthread_mutex_destroy (&broadcast->mutex);
+    free (broadcast);
+}
+
+void
+dc1394_broadcast_close (dc1394broadcast_t * broadcast)
+{
+    pthread_mutex_lock (&broadcast->mutex);
+    broadcast->closed = 1;
+    pthread_cond_broadcast (&broadcast->frame_queued);
+    pthread_cond_broadcast (&broadcast->frame_taken);
+    pthread_mutex_unlock (&broadcast->mutex);
+}
+
+dc1394consumer_t *
+dc1394_broadcast_add_consumer (dc1394broadcast_t * broadcast, uint32_t depth,
+        dc1394broadcast_policy_t policy)
+{
+    dc1394consumer_t * consumer;
+
+    if (depth == 0 || policy < DC1394_BROADCAST_POLICY_MIN ||
+            policy > DC1394_BROADCAST_POLICY_MAX)
+        return NULL;
+
+    consumer = calloc (1, sizeof (dc1394consumer_t));
+    if (!consumer)
+        return NULL;
+    consumer->queue = calloc (depth, sizeof (dc1394video_frame_t *));
+    if (!consumer->queue) {
+        free (consumer);
+        return NULL;
+    }
+    consumer->broadcast = broadcast;
+    consumer->policy = policy;
+    consumer->depth = depth;
+
+    pthread_mutex_lock (&broadcast->mutex);
+    consumer->next = broadcast->consumers;
+    broadcast->consumers = consumer;
+    pthread_mutex_unlock (&broadcast->mutex);
+
+    return consumer;
+}
+
+void
+dc1394_broadcast_remove_consumer (dc1394consumer_t * consumer)
+{
+    dc1394broadcast_t * broadcast;
+    dc1394consumer_t ** c;
+
+    if (!consumer)
+        return;
+    broadcast = consumer->broadcast;
+
+    pthread_mutex_lock (&broadcast->mutex);
+    for (c = &broadcast->consumers; *c; c = &(*c)->next) {
+        if (*c == consumer) {
+            *c = consumer->next;
+            break;
+        }
+    }
+    /* A publisher may be waiting for this consumer to catch up */
+    pthread_cond_broadcast (&broadcast->frame_taken);
+    pthread_mutex_unlock (&broadcast->mutex);
+
+    free_consumer (consumer);
+}
+
+dc1394error_t
+dc1394_broadcast_publish (dc1394broadcast_t * broadcast,
+        dc1394video_frame_t * frame)
+{
+    dc1394consumer_t * consumer;
+    dc1394error_t err = DC1394_SUCCESS;
+    uint64_t sequence;
+
+    if (!broadcast || !frame)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    pthread_mutex_lock (&broadcast->mutex);
+    sequence = ++broadcast->sequence;
+ restart:
+    for (consumer = broadcast->consumers; consumer; consumer = consumer->next) {
+        if (consumer->sequence == sequence)
+            continue;
+        if (broadcast->closed) {
+            err = DC1394_CAPTURE_IS_NOT_SET;
+            break;
+        }
+        if (consumer->count == consumer->depth &&
+                consumer->policy == DC1394_BROADCAST_BLOCK) {
+            pthread_cond_wait (&broadcast->frame_taken, &broadcast->mutex);
+            /* Consumers may have come and gone meanwhile */
+            goto restart;
+        }
+
+        consumer->sequence = sequence;
+        if (consumer->count == consumer->depth) {
+            consumer->skipped++;
+            continue;
+        }
+
+        err = dc1394_frame_ref (frame);
+        if (err != DC1394_SUCCESS)
+            break;
+        consumer->queue[(consumer->head + consumer->count) % consumer->depth] =
+            frame;
+        consumer->count++;
+    }
+    pthread_cond_broadcast (&broadcast->frame_queued);
+    pthread_mutex_unlock (&broadcast->mutex);
+
+    return err;
+}
+
+dc1394error_t
+dc1394_broadcast_pop (dc1394consumer_t * consumer,
+        dc1394capture_policy_t policy, dc1394video_frame_t ** frame)
+{
+    dc1394broadcast_t * broadcast;
+
+    if ((policy < DC1394_CAPTURE_POLICY_MIN)
+            || (policy > DC1394_CAPTURE_POLICY_MAX))
+        return DC1394_INVALID_CAPTURE_POLICY;
+
+    *frame = NULL;
+    if (!consumer)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    broadcast = consumer->broadcast;
+
+    pthread_mutex_lock (&broadcast->mutex);
+    while (consumer->count == 0 && policy == DC1394_CAPTURE_POLICY_WAIT &&
+            !broadcast->closed)
+        pthread_cond_wait (&broadcast->frame_queued, &broadcast->mutex);
+
+    if (consumer->count == 0) {
+        pthread_mutex_unlock (&broadcast->mutex);
+        return broadcast->closed ? DC1394_CAPTURE_IS_NOT_SET : DC1394_SUCCESS;
+    }
+
+    *frame = consumer->queue[consumer->head];
+    consumer->head = (consumer->head + 1) % consumer->depth;
+    consumer->count--;
+    pthread_cond_broadcast (&broadcast->frame_taken);
+    pthread_mutex_unlock (&broadcast->mutex);
+
+    return DC1394_SUCCESS;
+}
+
+uint64_t
+dc1394_broadcast_get_skipped (dc1394consumer_t * consumer)
+{
+    uint64_t skipped;
+
+    pthread_mutex_lock (&consumer->broadcast->mutex);
+    skipped = consumer->skipped;
+    pthread_mutex_unlock (&consumer->broadcast->mutex);
+    return skipped;
+}
+
+#else
+
+dc1394broadcast_t *
+dc1394_broadcast_new (void)
+{
+    return NULL;
+}
+
+void
+dc1394_broadcast_free (dc1394broadcast_t * broadcast)
+{
+}
+
+void
+dc1394_broadcast_close (dc1394broadcast_t * broadcast)
+{
+}
+
+dc1394consumer_t *
+dc1394_broadcast_add_consumer (dc1394broadcast_t * broadcast, uint32_t depth,
+        dc1394broadcast_policy_t policy)
+{
+    return NULL;
+}
+
+void
+dc1394_broadcast_remove_consumer (dc1394consumer_t * consumer)
+{
+}
+
+dc1394error_t
+dc1394_broadcast_publish (dc1394broadcast_t * broadcast,
+        dc1394video_frame_t * frame)
+{
+    return DC1394_FUNCTION_NOT_SUPPORTED;
+}
+
+dc1394error_t
+dc1394_broadcast_pop (dc1394consumer_t * consumer,
+        dc1394capture_policy_t policy, dc1394video_frame_t ** frame)
+{
+    *frame = NULL;
+    return DC1394_FUNCTION_NOT_SUPPORTED;
+}
+
+uint64_t
+dc1394_broadcast_get_skipped (dc1394consumer_t * consumer)
+{
+    return 0;
+}
+
+#endif
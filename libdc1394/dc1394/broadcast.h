@@ -0,0 +1,112 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Fan-out of captured frames to several consumers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __DC1394_BROADCAST_H__
+#define __DC1394_BROADCAST_H__
+
+/*! \file dc1394/broadcast.h
+    \brief Hands the same captured frames to several consumers without copying them
+
+    A broadcast queue gives each of its consumers a reference on every frame
+    published to it (see dc1394_frame_ref()). The frame goes back to the ring
+    buffer once all consumers are done with it, so that display, recording and
+    analysis threads can share frames and run at their own pace.
+*/
+
+#include <dc1394/log.h>
+#include <dc1394/video.h>
+#include <dc1394/capture.h>
+
+/**
+ * What to do when a consumer queue is full
+ */
+typedef enum {
+    DC1394_BROADCAST_SKIP_IF_BEHIND=832,
+    DC1394_BROADCAST_BLOCK
+} dc1394broadcast_policy_t;
+#define DC1394_BROADCAST_POLICY_MIN    DC1394_BROADCAST_SKIP_IF_BEHIND
+#define DC1394_BROADCAST_POLICY_MAX    DC1394_BROADCAST_BLOCK
+#define DC1394_BROADCAST_POLICY_NUM   (DC1394_BROADCAST_POLICY_MAX - DC1394_BROADCAST_POLICY_MIN + 1)
+
+typedef struct __dc1394broadcast_t dc1394broadcast_t;
+typedef struct __dc1394consumer_t dc1394consumer_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Creates an empty broadcast queue. Not available on Windows.
+ */
+dc1394broadcast_t * dc1394_broadcast_new (void);
+
+/**
+ * Frees a broadcast queue and its remaining consumers, dropping the references they still hold in their queues.
+ * No thread may be using the queue anymore, see dc1394_broadcast_close().
+ */
+void dc1394_broadcast_free (dc1394broadcast_t * broadcast);
+
+/**
+ * Closes a broadcast queue: publishing fails from now on, and consumers waiting for a frame are woken up. They get the
+ * frames that are still queued, then DC1394_CAPTURE_IS_NOT_SET.
+ */
+void dc1394_broadcast_close (dc1394broadcast_t * broadcast);
+
+/**
+ * Adds a consumer, which will see the frames published from now on.
+ * @param depth Number of frames the consumer may have queued.
+ * @param policy What happens to a frame published while the queue of the consumer is full:
+ *   \a DC1394_BROADCAST_SKIP_IF_BEHIND: the consumer misses the frame, so that a slow consumer cannot stall capture.
+ *   \a DC1394_BROADCAST_BLOCK: publishing waits until the consumer catches up.
+ * @return The consumer, or NULL on failure.
+ */
+dc1394consumer_t * dc1394_broadcast_add_consumer (dc1394broadcast_t * broadcast, uint32_t depth,
+                                                   dc1394broadcast_policy_t policy);
+
+/**
+ * Removes a consumer, dropping the references held in its queue. The consumer must not be in use anymore.
+ */
+void dc1394_broadcast_remove_consumer (dc1394consumer_t * consumer);
+
+/**
+ * Publishes a dequeued frame to all consumers, each of them getting its own reference on it. The caller keeps its own
+ * reference, which it must drop as usual (dc1394_frame_unref() or dc1394_capture_enqueue(), which only drop that
+ * reference: the frame goes back to the ring buffer once the consumers are done with it too). A frame delivered by
+ * dc1394_capture_start_callback() can be published from the callback directly.
+ */
+dc1394error_t dc1394_broadcast_publish (dc1394broadcast_t * broadcast, dc1394video_frame_t * frame);
+
+/**
+ * Gets the next frame of a consumer, waiting for it or not depending on policy. frame is set to NULL if there is none.
+ * The consumer owns a reference on the frame, which it must drop with dc1394_frame_unref() when done with it.
+ */
+dc1394error_t dc1394_broadcast_pop (dc1394consumer_t * consumer, dc1394capture_policy_t policy,
+                                     dc1394video_frame_t ** frame);
+
+/**
+ * Number of frames a consumer missed because its queue was full.
+ */
+uint64_t dc1394_broadcast_get_skipped (dc1394consumer_t * consumer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DC1394_BROADCAST_H__ */
@@ -0,0 +1,398 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Persistent cache of what is read from the cameras when they are opened
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * There is one file per camera unit, named after its GUID and unit number.
+ * It holds what dc1394_camera_new_unit() reads from the unit dependent
+ * directory and the leaves, and the contents of the register cache: the
+ * inquiry registers, including those of the Format_7 modes. All quadlets
+ * are big-endian:
+ *
+ *   "DC1394PC", version
+ *   configuration ROM from 0x400 to 0x413, five quadlets: header, bus name,
+ *     bus options and GUID; the header holds the CRC of the ROM, which any change of
+ *     firmware that matters here changes too
+ *   unit dependent directory, command registers base, unit sub sw version
+ *   vendor and model: length in bytes, then the bytes padded to a quadlet;
+ *     cameras with longer names than MAX_CHARS are not cached
+ *   number of guards, number of registers
+ *   guards, then registers: offset (two quadlets) and value
+ *   CRC-32 of all the above
+ *
+ * The file is used when the ROM of the camera still starts with the same
+ * five quadlets, which one block read tells. Some cameras have unit sizes
+ * that depend on the color coding, so the Format_7 values are kept with the
+ * color coding of their mode (the guards), and dropped if it changed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "control.h"
+#include "register.h"
+#include "offsets.h"
+#include "internal.h"
+
+#define CACHE_MAGIC             "DC1394PC"
+#define CACHE_VERSION           1
+
+static int
+make_directory (const char * path)
+{
+#ifdef _WIN32
+    if (mkdir (path) == 0 || errno == EEXIST)
+#else
+    if (mkdir (path, 0755) == 0 || errno == EEXIST)
+#endif
+        return 0;
+    return -1;
+}
+
+dc1394error_t
+dc1394_set_persistent_cache (dc1394_t * dc1394, dc1394switch_t pwr,
+        const char * directory)
+{
+    const char * base;
+    char * dir;
+
+    free (dc1394->cache_dir);
+    dc1394->cache_dir = NULL;
+    if (pwr == DC1394_OFF)
+        return DC1394_SUCCESS;
+
+    if (directory) {
+        dir = strdup (directory);
+        if (!dir)
+            return DC1394_MEMORY_ALLOCATION_FAILURE;
+    }
+    else {
+        base = getenv ("XDG_CACHE_HOME");
+        if (base && base[0]) {
+            dir = malloc (strlen (base) + 11);
+            if (!dir)
+                return DC1394_MEMORY_ALLOCATION_FAILURE;
+            make_directory (base);
+            sprintf (dir, "%s/libdc1394", base);
+        }
+        else {
+            base = getenv ("HOME");
+            if (!base || !base[0]) {
+                dc1394_log_error ("Neither XDG_CACHE_HOME nor HOME is set");
+                return DC1394_FAILURE;
+            }
+            dir = malloc (strlen (base) + 17);
+            if (!dir)
+                return DC1394_MEMORY_ALLOCATION_FAILURE;
+            sprintf (dir, "%s/.cache", base);
+            make_directory (dir);
+            strcat (dir, "/libdc1394");
+        }
+    }
+
+    if (make_directory (dir) < 0) {
+        dc1394_log_error ("Could not create cache directory %s", dir);
+        free (dir);
+        return DC1394_FAILURE;
+    }
+    dc1394->cache_dir = dir;
+    return DC1394_SUCCESS;
+}
+
+char *
+persistent_cache_path (dc1394_t * d, const camera_info_t * info)
+{
+    char * path;
+
+    if (!d->cache_dir)
+        return NULL;
+    path = malloc (strlen (d->cache_dir) + 32);
+    if (path)
+        sprintf (path, "%s/%016"PRIx64"-%d", d->cache_dir, info->guid,
+                info->unit);
+    return path;
+}
+
+/* Reads big-endian quadlets from a file in memory */
+typedef struct {
+    const unsigned char * p, * end;
+} cursor_t;
+
+static int
+read_quad (cursor_t * c, uint32_t * v)
+{
+    if (c->end - c->p < 4)
+        return -1;
+    *v = get_be32 (c->p);
+    c->p += 4;
+    return 0;
+}
+
+static char *
+read_string (cursor_t * c)
+{
+    uint32_t len;
+    char * str;
+
+    if (read_quad (c, &len) < 0 || len > MAX_CHARS ||
+            c->end - c->p < (len + 3) / 4 * 4)
+        return NULL;
+    str = malloc (len + 1);
+    if (!str)
+        return NULL;
+    memcpy (str, c->p, len);
+    str[len] = '\0';
+    c->p += (len + 3) / 4 * 4;
+    return str;
+}
+
+static void
+cache_clear (persistent_cache_t * pc)
+{
+    free (pc->vendor);
+    free (pc->model);
+    free (pc->offsets);
+    free (pc->values);
+    memset (pc, 0, sizeof *pc);
+}
+
+int
+persistent_cache_load (const char * path, const camera_info_t * info,
+        const uint32_t rom[5], persistent_cache_t * pc)
+{
+    unsigned char * data = NULL;
+    cursor_t c;
+    uint32_t v, i, num;
+    long size;
+    FILE * f;
+
+    memset (pc, 0, sizeof *pc);
+    f = fopen (path, "rb");
+    if (!f)
+        return -1;
+    if (fseek (f, 0, SEEK_END) < 0 || (size = ftell (f)) < 12 ||
+            fseek (f, 0, SEEK_SET) < 0 || !(data = malloc (size)) ||
+            fread (data, 1, size, f) != (size_t) size) {
+        free (data);
+        fclose (f);
+        return -1;
+    }
+    fclose (f);
+
+    if (memcmp (data, CACHE_MAGIC, 8) ||
+            get_be32 (data + size - 4) != container_crc32 (0, data, size - 4))
+        goto stale;
+    c.p = data + 8;
+    c.end = data + size - 4;
+
+    if (read_quad (&c, &v) < 0 || v != CACHE_VERSION)
+        goto stale;
+    for (i = 0; i < 5; i++)
+        if (read_quad (&c, &v) < 0 || v != rom[i])
+            goto stale;
+    if (read_quad (&c, &v) < 0 || v != info->unit_dependent_directory ||
+            read_quad (&c, &pc->command_regs_base) < 0 ||
+            read_quad (&c, &pc->unit_sub_sw_version) < 0)
+        goto stale;
+
+    pc->vendor = read_string (&c);
+    pc->model = read_string (&c);
+    if (!pc->vendor || !pc->model ||
+            read_quad (&c, &pc->num_guards) < 0 ||
+            read_quad (&c, &pc->num_regs) < 0)
+        goto stale;
+
+    num = pc->num_guards + pc->num_regs;
+    if (num > 2 * REGISTER_CACHE_SIZE || (c.end - c.p) != 12 * num)
+        goto stale;
+    pc->offsets = malloc (num * sizeof (uint64_t));
+    pc->values = malloc (num * sizeof (uint32_t));
+    if (!pc->offsets || !pc->values)
+        goto stale;
+    for (i = 0; i < num; i++, c.p += 12) {
+        pc->offsets[i] = (uint64_t) get_be32 (c.p) << 32 | get_be32 (c.p + 4);
+        pc->values[i] = get_be32 (c.p + 8);
+    }
+
+    free (data);
+    dc1394_log_debug ("Using cached data of camera 0x%"PRIx64" from %s",
+            info->guid, path);
+    return 0;
+
+ stale:
+    dc1394_log_debug ("Ignoring stale cache file %s", path);
+    free (data);
+    cache_clear (pc);
+    return -1;
+}
+
+void
+persistent_cache_attach (dc1394camera_t * camera, persistent_cache_t * pc)
+{
+    uint64_t base;
+    uint32_t i, j, value;
+
+    if (dc1394_camera_set_register_cache (camera, DC1394_ON) != DC1394_SUCCESS)
+        return;
+    if (!pc)
+        return;
+
+    /* Drop the values of the Format_7 modes whose color coding changed */
+    for (i = 0; i < pc->num_guards; i++) {
+        if (dc1394_get_registers (camera, pc->offsets[i], &value, 1) ==
+                DC1394_SUCCESS && value == pc->values[i])
+            continue;
+        base = pc->offsets[i] - REG_CAMERA_FORMAT7_COLOR_CODING_ID;
+        for (j = pc->num_guards; j < pc->num_guards + pc->num_regs; j++)
+            if (pc->offsets[j] >= base && pc->offsets[j] < base + 0x100)
+                pc->offsets[j] = 0;
+    }
+
+    register_cache_fill (camera, pc->offsets + pc->num_guards,
+            pc->values + pc->num_guards, pc->num_regs);
+    free (pc->offsets);
+    free (pc->values);
+    pc->offsets = NULL;
+    pc->values = NULL;
+}
+
+static void
+write_string (unsigned char ** p, const char * str)
+{
+    uint32_t len = str ? strlen (str) : 0;
+
+    put_be32 (*p, len);
+    memset (*p + 4, 0, (len + 3) / 4 * 4);
+    if (len)
+        memcpy (*p + 4, str, len);
+    *p += 4 + (len + 3) / 4 * 4;
+}
+
+void
+persistent_cache_save (dc1394camera_t * camera)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (camera);
+    uint64_t offsets[REGISTER_CACHE_SIZE], guards[DC1394_VIDEO_MODE_FORMAT7_NUM];
+    uint32_t values[REGISTER_CACHE_SIZE], guard_values[DC1394_VIDEO_MODE_FORMAT7_NUM];
+    uint32_t i, j, num, num_guards = 0, num_regs = 0, used;
+    unsigned char * data, * p;
+    char * tmp;
+    size_t size;
+    int dirty, ok;
+    FILE * f;
+
+    num = register_cache_export (camera, offsets, values, &dirty);
+    if (!dirty)
+        return;
+
+    /* A name cut short would not match what the camera reads back */
+    if ((camera->vendor && strlen (camera->vendor) > MAX_CHARS) ||
+            (camera->model && strlen (camera->model) > MAX_CHARS)) {
+        dc1394_log_debug ("Not caching camera 0x%"PRIx64": its name is too long",
+                camera->guid);
+        return;
+    }
+
+    /* Keep the Format_7 values with the color coding they were read with */
+    for (i = 0; i < DC1394_VIDEO_MODE_FORMAT7_NUM; i++) {
+        uint64_t base = camera->format7_csr[i];
+        if (!base)
+            continue;
+        for (j = 0, used = 0; j < num; j++)
+            used |= offsets[j] >= base && offsets[j] < base + 0x100;
+        if (!used)
+            continue;
+        guards[num_guards] = base + REG_CAMERA_FORMAT7_COLOR_CODING_ID;
+        if (dc1394_get_registers (camera, guards[num_guards],
+                    &guard_values[num_guards], 1) == DC1394_SUCCESS) {
+            num_guards++;
+            continue;
+        }
+        for (j = 0; j < num; j++)
+            if (offsets[j] >= base && offsets[j] < base + 0x100)
+                offsets[j] = 0;
+    }
+
+    size = 8 + 4 * 9 + 2 * (4 + MAX_CHARS + 4) + 4 * 2 +
+        12 * (num_guards + num) + 4;
+    data = malloc (size);
+    tmp = malloc (strlen (cp->cache_path) + 5);
+    if (!data || !tmp) {
+        free (data);
+        free (tmp);
+        return;
+    }
+
+    p = data;
+    memcpy (p, CACHE_MAGIC, 8);
+    p += 8;
+    put_be32 (p, CACHE_VERSION);
+    p += 4;
+    for (i = 0; i < 5; i++, p += 4)
+        put_be32 (p, cp->cache_rom[i]);
+    put_be32 (p, camera->unit_dependent_directory);
+    put_be32 (p + 4, camera->command_registers_base / 4);
+    put_be32 (p + 8, camera->unit_sub_sw_version);
+    p += 12;
+    write_string (&p, camera->vendor);
+    write_string (&p, camera->model);
+
+    for (j = 0; j < num; j++)
+        num_regs += offsets[j] != 0;
+    put_be32 (p, num_guards);
+    put_be32 (p + 4, num_regs);
+    p += 8;
+    for (i = 0; i < num_guards; i++, p += 12) {
+        put_be32 (p, guards[i] >> 32);
+        put_be32 (p + 4, guards[i]);
+        put_be32 (p + 8, guard_values[i]);
+    }
+    for (j = 0; j < num; j++) {
+        if (!offsets[j])
+            continue;
+        put_be32 (p, offsets[j] >> 32);
+        put_be32 (p + 4, offsets[j]);
+        put_be32 (p + 8, values[j]);
+        p += 12;
+    }
+    put_be32 (p, container_crc32 (0, data, p - data));
+    p += 4;
+
+    // write a copy, then move it over the file
+    sprintf (tmp, "%s.tmp", cp->cache_path);
+    f = fopen (tmp, "wb");
+    ok = f && fwrite (data, p - data, 1, f) == 1;
+    ok = f && fclose (f) == 0 && ok;
+#ifdef _WIN32
+    if (ok)
+        remove (cp->cache_path);
+#endif
+    if (!ok || rename (tmp, cp->cache_path) != 0) {
+        dc1394_log_warning ("Could not write cache file %s", cp->cache_path);
+        remove (tmp);
+    }
+    free (data);
+    free (tmp);
+}
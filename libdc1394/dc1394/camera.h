@@ -131,6 +131,38 @@ typedef struct __dc1394_camera
 
 } dc1394camera_t;
 
+/**
+ * How register transactions are retried when the camera or the bus is busy
+ *
+ * The delay before the first retry is initial_delay, and each following one is multiplied by multiplier up to
+ * max_delay, or one second if max_delay is zero; delays are in microseconds. With jitter, each delay is drawn between half and all of that value, so
+ * that cameras contending for the bus do not retry in step. A transaction is given up after max_retries retries,
+ * or when a retry would end later than deadline microseconds after the first attempt. Zero means no limit for
+ * either, but not for both. See dc1394_camera_set_retry_policy().
+ */
+typedef struct
+{
+    uint32_t             max_retries;
+    uint32_t             initial_delay;
+    uint32_t             max_delay;
+    float                multiplier;
+    dc1394bool_t         jitter;
+    uint32_t             deadline;
+} dc1394retry_policy_t;
+
+/**
+ * Register transaction statistics of a camera, see dc1394_camera_get_transaction_stats()
+ */
+typedef struct
+{
+    uint64_t             transactions;  /* sent to the platform */
+    uint64_t             failures;      /* completed with an error */
+    uint64_t             retries;
+    uint64_t             busy;          /* busy or conflict answers from the camera or the bus */
+    uint64_t             generation;    /* attempts made with a stale bus generation */
+    uint64_t             timeouts;      /* given up after the retries or the deadline of the policy */
+} dc1394transaction_stats_t;
+
 /**
  * A unique identifier for a functional camera unit
  *
@@ -174,6 +206,17 @@ dc1394_t* dc1394_new (void);
  */
 void dc1394_free (dc1394_t *dc1394);
 
+/**
+ * Keeps what is read from the cameras when they are opened on disk, so that opening them again is almost free: the
+ * unit directory and its leaves, and the inquiry registers, Format_7 ones included. There is one file per camera,
+ * which is used as long as the start of the camera's configuration ROM, its GUID and the CRC of the ROM, is the same.
+ * Cameras opened while the cache is on also have their register cache on (see dc1394_camera_set_register_cache), and
+ * their file is updated when they are freed.
+ *
+ * @param directory Where to keep the files; NULL is $XDG_CACHE_HOME/libdc1394, or ~/.cache/libdc1394.
+ */
+dc1394error_t dc1394_set_persistent_cache (dc1394_t *dc1394, dc1394switch_t pwr, const char *directory);
+
 /**
  * Sets and gets the broadcast flag of a camera. If the broadcast flag is set,
  * all devices on the bus will execute the command. Useful to sync ISO start
@@ -218,6 +261,36 @@ dc1394error_t dc1394_camera_enumerate(dc1394_t *dc1394, dc1394camera_list_t **li
  */
 void dc1394_camera_free_list(dc1394camera_list_t *list);
 
+/**
+ * Called by dc1394_hotplug_process() for a camera that appeared or disappeared
+ */
+typedef void (*dc1394hotplug_callback_t)(dc1394_t *dc1394, const dc1394camera_id_t *id, void *user_data);
+
+/**
+ * Starts following cameras as they are plugged and unplugged, instead of looking for them again at each
+ * dc1394_camera_enumerate(). Cameras present at the start are listed once; after that, only the devices that appear
+ * are read. While this is on, dc1394_camera_enumerate() returns the cameras as of the last dc1394_hotplug_process().
+ *
+ * Only the juju platform can do this for now, by watching /dev/fw* with inotify; cameras on other platforms stay
+ * as they were at the start.
+ *
+ * @param fd Becomes readable when dc1394_hotplug_process() has something to do. May be NULL.
+ * @return DC1394_FUNCTION_NOT_SUPPORTED if no platform can watch for its devices.
+ */
+dc1394error_t dc1394_hotplug_start(dc1394_t *dc1394, dc1394hotplug_callback_t added,
+                                   dc1394hotplug_callback_t removed, void *user_data, int *fd);
+
+/**
+ * Updates the list of cameras with the devices that appeared and disappeared since the last call, calling back for
+ * each camera. Returns at once if there is nothing to do. Removed cameras are called back before they leave the list.
+ */
+dc1394error_t dc1394_hotplug_process(dc1394_t *dc1394);
+
+/**
+ * Stops following cameras; dc1394_camera_enumerate() looks for them again at each call.
+ */
+void dc1394_hotplug_stop(dc1394_t *dc1394);
+
 /**
  * Create a new camera based on a GUID (Global Unique IDentifier)
  */
@@ -238,6 +311,26 @@ void dc1394_camera_free(dc1394camera_t *camera);
  */
 dc1394error_t dc1394_camera_print_info(dc1394camera_t *camera, FILE *fd);
 
+/**
+ * Sets how the register transactions of a camera are retried, or restores
+ * the default of the platform if policy is NULL. Only the juju and the
+ * raw1394 platforms retry transactions.
+ */
+dc1394error_t dc1394_camera_set_retry_policy(dc1394camera_t *camera,
+        const dc1394retry_policy_t *policy);
+
+/**
+ * Gets the register transaction statistics of a camera since it was
+ * created or since the last call to dc1394_camera_reset_transaction_stats()
+ */
+dc1394error_t dc1394_camera_get_transaction_stats(dc1394camera_t *camera,
+        dc1394transaction_stats_t *stats);
+
+/**
+ * Resets the register transaction statistics of a camera
+ */
+dc1394error_t dc1394_camera_reset_transaction_stats(dc1394camera_t *camera);
+
 #ifdef __cplusplus
 }
 #endif
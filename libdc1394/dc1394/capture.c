@@ -18,21 +18,463 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 
 #include "control.h"
 #include "platform.h"
 #include "internal.h"
 
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_POLL_H)
+#define HAVE_CAPTURE_THREADS
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_LINUX
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/* From <numaif.h>, which we do not want to depend on */
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+static int
+set_node_policy (int mode, void * buffer, size_t size, uint32_t node)
+{
+    unsigned long mask[CAPTURE_MAX_NUMA_NODES / (8 * sizeof (unsigned long))];
+
+    if (node >= CAPTURE_MAX_NUMA_NODES) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset (mask, 0, sizeof mask);
+    mask[node / (8 * sizeof (unsigned long))] |=
+        1UL << (node % (8 * sizeof (unsigned long)));
+
+    if (buffer)
+        return syscall (SYS_mbind, buffer, size, mode, mask,
+                CAPTURE_MAX_NUMA_NODES, 0);
+    return syscall (SYS_set_mempolicy, mode, mask, CAPTURE_MAX_NUMA_NODES);
+}
+
+/* Parses a sysfs cpulist such as "0-7,16-23" */
+static int
+read_node_cpus (uint32_t node, cpu_set_t * set)
+{
+    char path[64], list[1024], *p;
+    FILE * fd;
+
+    snprintf (path, sizeof path, "/sys/devices/system/node/node%u/cpulist",
+            node);
+    fd = fopen (path, "r");
+    if (fd == NULL)
+        return -1;
+    p = fgets (list, sizeof list, fd);
+    fclose (fd);
+    if (p == NULL)
+        return -1;
+
+    CPU_ZERO (set);
+    while (*p >= '0' && *p <= '9') {
+        unsigned long first = strtoul (p, &p, 10), last = first;
+        if (*p == '-')
+            last = strtoul (p + 1, &p, 10);
+        for (; first <= last && first < CPU_SETSIZE; first++)
+            CPU_SET (first, set);
+        if (*p == ',')
+            p++;
+    }
+    return CPU_COUNT (set) ? 0 : -1;
+}
+#endif
+
+/* Allocates a capture ring for the backends that fill user memory.  Linux
+ * rings are mapped separately so that they can be bound and backed by huge
+ * pages before being touched; alloc_size returns the mapped length. */
+void *
+capture_alloc_buffer (dc1394camera_t * camera, size_t size,
+        size_t * alloc_size)
+{
+#ifdef HAVE_LINUX
+    const dc1394capture_options_t * opt =
+        &DC1394_CAMERA_PRIV (camera)->capture_options;
+    void * buffer = MAP_FAILED;
+    size_t len = size;
+
+    if (opt->placement & DC1394_CAPTURE_PLACEMENT_HUGEPAGES) {
+        len = (size + HUGE_PAGE_SIZE - 1) & ~((size_t) HUGE_PAGE_SIZE - 1);
+        buffer = mmap (NULL, len, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (buffer == MAP_FAILED)
+            dc1394_log_debug ("No hugetlbfs pages for the capture buffer, "
+                    "trying transparent huge pages");
+    }
+    if (buffer == MAP_FAILED) {
+        buffer = mmap (NULL, len, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffer == MAP_FAILED)
+            return NULL;
+        if ((opt->placement & DC1394_CAPTURE_PLACEMENT_HUGEPAGES) &&
+                madvise (buffer, len, MADV_HUGEPAGE) < 0)
+            dc1394_log_warning ("Could not get huge pages for the capture "
+                    "buffer: %s", strerror (errno));
+    }
+
+    if ((opt->placement & DC1394_CAPTURE_PLACEMENT_NUMA_MEMORY) &&
+            set_node_policy (MPOL_BIND, buffer, len, opt->numa_node) < 0)
+        dc1394_log_warning ("Could not bind the capture buffer to NUMA "
+                "node %u: %s", opt->numa_node, strerror (errno));
+
+    *alloc_size = len;
+    return buffer;
+#else
+    *alloc_size = size;
+    return malloc (size);
+#endif
+}
+
+void
+capture_free_buffer (void * buffer, size_t alloc_size)
+{
+    if (buffer == NULL)
+        return;
+#ifdef HAVE_LINUX
+    munmap (buffer, alloc_size);
+#else
+    free (buffer);
+#endif
+}
+
+/* Locks a capture ring, whoever allocated it, if requested.  This also
+ * faults all of it in, so that the first frames do not pay for it. */
+void
+capture_lock_buffer (dc1394camera_t * camera, void * buffer, size_t size)
+{
+#ifdef HAVE_LINUX
+    const dc1394capture_options_t * opt =
+        &DC1394_CAMERA_PRIV (camera)->capture_options;
+
+    if ((opt->placement & DC1394_CAPTURE_PLACEMENT_LOCKED) &&
+            mlock (buffer, size) < 0)
+        dc1394_log_warning ("Could not lock the capture buffer: %s",
+                strerror (errno));
+#endif
+}
+
+/* Kernel-allocated DMA rings follow the memory policy of the thread that
+ * triggers the allocation, so the backends bracket that call with these. */
+void
+capture_enter_numa_node (dc1394camera_t * camera, capture_mempolicy_t * saved)
+{
+    saved->changed = 0;
+#ifdef HAVE_LINUX
+    const dc1394capture_options_t * opt =
+        &DC1394_CAMERA_PRIV (camera)->capture_options;
+
+    if (!(opt->placement & DC1394_CAPTURE_PLACEMENT_NUMA_MEMORY))
+        return;
+    if (syscall (SYS_get_mempolicy, &saved->mode, saved->mask,
+                CAPTURE_MAX_NUMA_NODES, NULL, 0) < 0)
+        return;
+    /* Only preferred: the DMA zone of the controller may not exist there */
+    if (set_node_policy (MPOL_PREFERRED, NULL, 0, opt->numa_node) < 0) {
+        dc1394_log_warning ("Could not select NUMA node %u for the capture "
+                "buffer: %s", opt->numa_node, strerror (errno));
+        return;
+    }
+    saved->changed = 1;
+#endif
+}
+
+void
+capture_leave_numa_node (capture_mempolicy_t * saved)
+{
+#ifdef HAVE_LINUX
+    if (saved->changed)
+        syscall (SYS_set_mempolicy, saved->mode, saved->mask,
+                CAPTURE_MAX_NUMA_NODES);
+#endif
+    saved->changed = 0;
+}
+
+dc1394error_t
+dc1394_capture_bind_thread (dc1394camera_t * camera)
+{
+#ifdef HAVE_LINUX
+    const dc1394capture_options_t * opt =
+        &DC1394_CAMERA_PRIV (camera)->capture_options;
+    cpu_set_t set;
+
+    if (!(opt->placement & DC1394_CAPTURE_PLACEMENT_NUMA_CPUS))
+        return DC1394_SUCCESS;
+
+    if (read_node_cpus (opt->numa_node, &set) < 0) {
+        dc1394_log_error ("No CPUs found for NUMA node %u", opt->numa_node);
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    }
+    if (sched_setaffinity (0, sizeof set, &set) < 0) {
+        dc1394_log_error ("Could not bind thread to NUMA node %u: %s",
+                opt->numa_node, strerror (errno));
+        return DC1394_FAILURE;
+    }
+    return DC1394_SUCCESS;
+#else
+    return DC1394_FUNCTION_NOT_SUPPORTED;
+#endif
+}
+
 dc1394error_t
 dc1394_capture_setup (dc1394camera_t *camera, uint32_t num_dma_buffers,
         uint32_t flags)
+{
+    return dc1394_capture_setup_with_options (camera, num_dma_buffers, flags,
+            NULL);
+}
+
+/* The backends pick the options up from the camera during setup */
+static void
+set_capture_options (dc1394camera_priv_t * cpriv,
+        const dc1394capture_options_t * options)
+{
+    if (options)
+        memcpy (&cpriv->capture_options, options,
+                sizeof (dc1394capture_options_t));
+    else
+        memset (&cpriv->capture_options, 0, sizeof (dc1394capture_options_t));
+}
+
+/* Frames must go back to the backends in ring order, since the DMA
+ * programs fill the buffers in the order they were queued.  Dequeued frames
+ * are reference counted, and the ones released out of order wait for the
+ * older ones. */
+struct _capture_frames_t {
+#ifdef HAVE_CAPTURE_THREADS
+    pthread_mutex_t mutex;
+#endif
+    uint32_t num_frames;
+    uint32_t requeue_next;
+    int * refs;
+    uint8_t * state;
+    dc1394video_frame_t ** frames;
+};
+
+enum {
+    FRAME_QUEUED = 0,
+    FRAME_DEQUEUED,
+    FRAME_RELEASED
+};
+
+static dc1394error_t
+capture_frames_new (dc1394camera_priv_t * cpriv, uint32_t num_frames)
+{
+    struct _capture_frames_t * cf;
+
+    cf = calloc (1, sizeof (struct _capture_frames_t));
+    if (!cf)
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    cf->num_frames = num_frames;
+    cf->refs = calloc (num_frames, sizeof (int));
+    cf->state = calloc (num_frames, sizeof (uint8_t));
+    cf->frames = calloc (num_frames, sizeof (dc1394video_frame_t *));
+    if (!cf->refs || !cf->state || !cf->frames) {
+        free (cf->refs);
+        free (cf->state);
+        free (cf->frames);
+        free (cf);
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    }
+#ifdef HAVE_CAPTURE_THREADS
+    pthread_mutex_init (&cf->mutex, NULL);
+#endif
+
+    cpriv->frames = cf;
+    return DC1394_SUCCESS;
+}
+
+void
+capture_frames_free (dc1394camera_t * camera)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+    struct _capture_frames_t * cf = cpriv->frames;
+
+    if (!cf)
+        return;
+#ifdef HAVE_CAPTURE_THREADS
+    pthread_mutex_destroy (&cf->mutex);
+#endif
+    free (cf->refs);
+    free (cf->state);
+    free (cf->frames);
+    free (cf);
+    cpriv->frames = NULL;
+}
+
+/* The mutex of the frames also serializes the calls to the backend, as
+ * frames may be released from any thread while another one dequeues */
+static void
+lock_frames (struct _capture_frames_t * cf)
+{
+#ifdef HAVE_CAPTURE_THREADS
+    pthread_mutex_lock (&cf->mutex);
+#endif
+}
+
+static void
+unlock_frames (struct _capture_frames_t * cf)
+{
+#ifdef HAVE_CAPTURE_THREADS
+    pthread_mutex_unlock (&cf->mutex);
+#endif
+}
+
+static dc1394error_t
+requeue_frame (dc1394camera_priv_t * cpriv, dc1394video_frame_t * frame)
+{
+    struct _capture_frames_t * cf = cpriv->frames;
+    const platform_dispatch_t * d = cpriv->platform->dispatch;
+    dc1394error_t err = DC1394_SUCCESS;
+
+    lock_frames (cf);
+    if (cf->state[frame->id] != FRAME_DEQUEUED) {
+        dc1394_log_error ("Frame %d was not dequeued", frame->id);
+        err = DC1394_INVALID_ARGUMENT_VALUE;
+    }
+    else
+        cf->state[frame->id] = FRAME_RELEASED;
+    while (cf->state[cf->requeue_next] == FRAME_RELEASED) {
+        dc1394video_frame_t * f = cf->frames[cf->requeue_next];
+        dc1394error_t e;
+
+        cf->state[cf->requeue_next] = FRAME_QUEUED;
+        cf->requeue_next = (cf->requeue_next + 1) % cf->num_frames;
+        e = d->capture_enqueue (cpriv->pcam, f);
+        if (e != DC1394_SUCCESS)
+            err = e;
+    }
+    unlock_frames (cf);
+    return err;
+}
+
+/* Drops one reference on a tracked frame, requeuing it with the last one.
+ * The count never goes below zero, so that a frame already given back
+ * cannot be requeued twice. */
+static dc1394error_t
+drop_reference (dc1394camera_priv_t * cpriv, dc1394video_frame_t * frame)
+{
+    int * refs = &cpriv->frames->refs[frame->id];
+    int n = __atomic_load_n (refs, __ATOMIC_RELAXED);
+
+    do {
+        if (n <= 0) {
+            dc1394_log_error ("Frame %d holds no reference", frame->id);
+            return DC1394_INVALID_ARGUMENT_VALUE;
+        }
+    } while (!__atomic_compare_exchange_n (refs, &n, n - 1, 0,
+                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    if (n == 1)
+        return requeue_frame (cpriv, frame);
+    return DC1394_SUCCESS;
+}
+
+/* Dequeues from the backend and tracks the frame. Called with the frames
+ * locked. */
+static dc1394error_t
+dequeue_frame (dc1394camera_priv_t * cpriv, dc1394capture_policy_t policy,
+        dc1394video_frame_t ** frame)
+{
+    struct _capture_frames_t * cf = cpriv->frames;
+    dc1394error_t err;
+
+    err = cpriv->platform->dispatch->capture_dequeue (cpriv->pcam, policy,
+            frame);
+
+    /* The dequeuer holds the first reference */
+    if (*frame && (*frame)->id < cf->num_frames) {
+        cf->frames[(*frame)->id] = *frame;
+        __atomic_store_n (&cf->refs[(*frame)->id], 1, __ATOMIC_RELAXED);
+        cf->state[(*frame)->id] = FRAME_DEQUEUED;
+    }
+    return err;
+}
+
+/* Sets up the frame tracking of a capture the backend just set up */
+static dc1394error_t
+capture_setup_done (dc1394camera_t * camera, uint32_t num_frames,
+        dc1394error_t err)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+
+    if (err != DC1394_SUCCESS)
+        return err;
+
+    capture_frames_free (camera);
+    err = capture_frames_new (cpriv, num_frames);
+    if (err != DC1394_SUCCESS)
+        cpriv->platform->dispatch->capture_stop (cpriv->pcam);
+    return err;
+}
+
+dc1394error_t
+dc1394_capture_setup_with_options (dc1394camera_t *camera,
+        uint32_t num_dma_buffers, uint32_t flags,
+        const dc1394capture_options_t *options)
 {
     dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
     const platform_dispatch_t * d = cpriv->platform->dispatch;
     if (!d->capture_setup)
         return DC1394_FUNCTION_NOT_SUPPORTED;
-    return d->capture_setup (cpriv->pcam, num_dma_buffers, flags);
+
+    dc1394capture_options_t previous = cpriv->capture_options;
+    dc1394error_t err;
+
+    set_capture_options (cpriv, options);
+    err = d->capture_setup (cpriv->pcam, num_dma_buffers, flags);
+    /* Leave the options of a running capture alone */
+    if (err == DC1394_CAPTURE_IS_RUNNING)
+        cpriv->capture_options = previous;
+    return capture_setup_done (camera, num_dma_buffers, err);
+}
+
+dc1394error_t
+dc1394_capture_setup_with_buffers (dc1394camera_t *camera,
+        uint32_t num_buffers, unsigned char **buffers, size_t buffer_size,
+        uint32_t flags, const dc1394capture_options_t *options)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+    const platform_dispatch_t * d = cpriv->platform->dispatch;
+    uint32_t i;
+
+    if (!d->capture_setup_with_buffers)
+        return DC1394_FUNCTION_NOT_SUPPORTED;
+    if (!buffers || num_buffers == 0)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    for (i = 0; i < num_buffers; i++)
+        if (!buffers[i])
+            return DC1394_INVALID_ARGUMENT_VALUE;
+
+    dc1394capture_options_t previous = cpriv->capture_options;
+    dc1394error_t err;
+
+    set_capture_options (cpriv, options);
+    err = d->capture_setup_with_buffers (cpriv->pcam, num_buffers, flags,
+            buffers, buffer_size);
+    if (err == DC1394_CAPTURE_IS_RUNNING)
+        cpriv->capture_options = previous;
+    return capture_setup_done (camera, num_buffers, err);
 }
 
 dc1394error_t
@@ -42,7 +484,14 @@ dc1394_capture_stop (dc1394camera_t *camera)
     const platform_dispatch_t * d = cpriv->platform->dispatch;
     if (!d->capture_stop)
         return DC1394_FUNCTION_NOT_SUPPORTED;
-    return d->capture_stop (cpriv->pcam);
+    dc1394error_t err;
+
+    if (cpriv->callback)
+        dc1394_capture_stop_callback (camera);
+    err = d->capture_stop (cpriv->pcam);
+    if (err == DC1394_SUCCESS)
+        capture_frames_free (camera);
+    return err;
 }
 
 int
@@ -55,15 +504,63 @@ dc1394_capture_get_fileno (dc1394camera_t * camera)
     return d->capture_get_fileno (cpriv->pcam);
 }
 
+/* Whether poll() on the descriptor of dc1394_capture_get_fileno() waits for
+ * a frame. Otherwise, waiting is left to the backend's own WAIT policy, or
+ * done by checking every millisecond. */
+int
+capture_fileno_pollable (dc1394camera_t * camera)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+    const platform_dispatch_t * d = cpriv->platform->dispatch;
+
+    return d->capture_get_fileno && !d->capture_fileno_not_pollable;
+}
+
 dc1394error_t
 dc1394_capture_dequeue (dc1394camera_t * camera, dc1394capture_policy_t policy,
         dc1394video_frame_t **frame)
 {
     dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
     const platform_dispatch_t * d = cpriv->platform->dispatch;
+    struct _capture_frames_t * cf = cpriv->frames;
+    dc1394error_t err;
+
     if (!d->capture_dequeue)
         return DC1394_FUNCTION_NOT_SUPPORTED;
-    return d->capture_dequeue (cpriv->pcam, policy, frame);
+    if (!cf)
+        return d->capture_dequeue (cpriv->pcam, policy, frame);
+
+#ifdef HAVE_CAPTURE_THREADS
+    /* Wait for a frame without holding the lock, so that the frames other
+       threads release meanwhile go back to the ring buffer and can be
+       filled. Backends whose descriptor cannot be polled wait in their own
+       WAIT below instead, which only waits for a buffer already queued. */
+    if (policy == DC1394_CAPTURE_POLICY_WAIT &&
+            capture_fileno_pollable (camera)) {
+        struct pollfd pfd = {
+            .fd = d->capture_get_fileno (cpriv->pcam),
+            .events = POLLIN,
+        };
+
+        while (pfd.fd >= 0) {
+            lock_frames (cf);
+            err = dequeue_frame (cpriv, DC1394_CAPTURE_POLICY_POLL, frame);
+            unlock_frames (cf);
+            if (err != DC1394_SUCCESS || *frame)
+                return err;
+            if (poll (&pfd, 1, -1) < 0 && errno != EINTR) {
+                dc1394_log_error ("Failed to wait for a frame: %s",
+                        strerror (errno));
+                return DC1394_FAILURE;
+            }
+        }
+    }
+#endif
+
+    lock_frames (cf);
+    err = dequeue_frame (cpriv, policy, frame);
+    unlock_frames (cf);
+    return err;
 }
 
 dc1394error_t
@@ -71,9 +568,56 @@ dc1394_capture_enqueue (dc1394camera_t * camera, dc1394video_frame_t * frame)
 {
     dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
     const platform_dispatch_t * d = cpriv->platform->dispatch;
+    struct _capture_frames_t * cf = cpriv->frames;
+
     if (!d->capture_enqueue)
         return DC1394_FUNCTION_NOT_SUPPORTED;
-    return d->capture_enqueue (cpriv->pcam, frame);
+    if (!frame)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    /* Without tracking, there is no one else to wait for */
+    if (!cf || frame->id >= cf->num_frames)
+        return d->capture_enqueue (cpriv->pcam, frame);
+
+    /* Enqueuing drops the reference of the caller only */
+    return drop_reference (cpriv, frame);
+}
+
+dc1394error_t
+dc1394_frame_ref (dc1394video_frame_t * frame)
+{
+    struct _capture_frames_t * cf;
+
+    if (!frame || !frame->camera)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    cf = DC1394_CAMERA_PRIV (frame->camera)->frames;
+    if (!cf || frame->id >= cf->num_frames)
+        return DC1394_CAPTURE_IS_NOT_SET;
+
+    /* A frame that went back to the ring buffer cannot be taken again */
+    int n = __atomic_load_n (&cf->refs[frame->id], __ATOMIC_RELAXED);
+    do {
+        if (n <= 0)
+            return DC1394_INVALID_ARGUMENT_VALUE;
+    } while (!__atomic_compare_exchange_n (&cf->refs[frame->id], &n, n + 1,
+                0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_frame_unref (dc1394video_frame_t * frame)
+{
+    dc1394camera_priv_t * cpriv;
+    struct _capture_frames_t * cf;
+
+    if (!frame || !frame->camera)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    cpriv = DC1394_CAMERA_PRIV (frame->camera);
+    cf = cpriv->frames;
+    if (!cf || frame->id >= cf->num_frames)
+        return DC1394_CAPTURE_IS_NOT_SET;
+
+    return drop_reference (cpriv, frame);
 }
 
 dc1394bool_t
@@ -88,3 +632,246 @@ dc1394_capture_is_frame_corrupt (dc1394camera_t * camera,
         return DC1394_FALSE;
     return d->capture_is_frame_corrupt (cpriv->pcam, frame);
 }
+
+#ifdef HAVE_CAPTURE_THREADS
+
+struct _capture_callback_t {
+    dc1394camera_t * camera;
+    dc1394capture_callback_t callback;
+    void * user_data;
+    dc1394capture_callback_options_t options;
+
+    pthread_t thread;
+    int stop_pipe[2];
+
+    dc1394video_frame_t * current;
+};
+
+static void
+setup_delivery_thread (struct _capture_callback_t * cb)
+{
+#ifdef HAVE_LINUX
+    if (cb->options.cpu_mask) {
+        cpu_set_t set;
+        int i;
+
+        CPU_ZERO (&set);
+        for (i = 0; i < 64; i++)
+            if (cb->options.cpu_mask & (1ULL << i))
+                CPU_SET (i, &set);
+        if (sched_setaffinity (0, sizeof set, &set) < 0)
+            dc1394_log_warning ("Could not set the CPUs of the delivery "
+                    "thread: %s", strerror (errno));
+    }
+    else
+        dc1394_capture_bind_thread (cb->camera);
+#endif
+
+    if (cb->options.realtime_priority > 0) {
+        struct sched_param param;
+        int err;
+
+        memset (&param, 0, sizeof param);
+        param.sched_priority = cb->options.realtime_priority;
+        err = pthread_setschedparam (pthread_self (), SCHED_FIFO, &param);
+        if (err)
+            dc1394_log_warning ("Could not make the delivery thread "
+                    "real-time: %s", strerror (err));
+    }
+}
+
+/* Hands all the frames that are ready to the callback, and skips those in
+ * error.  Returns the number of frames delivered, or -1 if the capture
+ * failed. */
+static int
+deliver_frames (struct _capture_callback_t * cb)
+{
+    dc1394video_frame_t * frame;
+    dc1394error_t err;
+    int delivered = 0;
+
+    while (1) {
+        err = dc1394_capture_dequeue (cb->camera, DC1394_CAPTURE_POLICY_POLL,
+                &frame);
+        if (err != DC1394_SUCCESS && frame) {
+            /* A frame in error, e.g. a failed usb transfer: drop it and
+             * keep delivering the next ones */
+            dc1394_log_warning ("Delivery thread dropped frame %u in error",
+                    frame->id);
+            dc1394_capture_enqueue (cb->camera, frame);
+            continue;
+        }
+        if (err != DC1394_SUCCESS) {
+            dc1394_log_error ("Delivery thread failed to dequeue a frame");
+            return -1;
+        }
+        if (!frame)
+            return delivered;
+
+        cb->current = frame;
+        cb->callback (cb->camera, frame, cb->user_data);
+        cb->current = NULL;
+        delivered++;
+
+        /* Drop the reference of the delivery thread: the frame is requeued
+         * unless the callback kept it */
+        if (dc1394_frame_unref (frame) != DC1394_SUCCESS) {
+            dc1394_log_error ("Delivery thread failed to requeue a frame");
+            return -1;
+        }
+    }
+}
+
+static void *
+delivery_thread (void * arg)
+{
+    struct _capture_callback_t * cb = arg;
+    struct pollfd fds[2];
+    int pollable = capture_fileno_pollable (cb->camera);
+
+    setup_delivery_thread (cb);
+
+    fds[0].fd = cb->stop_pipe[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = dc1394_capture_get_fileno (cb->camera);
+    fds[1].events = POLLIN;
+
+    while (1) {
+        /* Without a descriptor to wait on, check every millisecond */
+        int n = poll (fds, pollable ? 2 : 1, pollable ? -1 : 1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            dc1394_log_error ("Delivery thread poll() failed: %s",
+                    strerror (errno));
+            break;
+        }
+        if (fds[0].revents)
+            break;
+
+        if (deliver_frames (cb) < 0)
+            break;
+    }
+
+    return NULL;
+}
+
+dc1394error_t
+dc1394_capture_start_callback (dc1394camera_t * camera,
+        dc1394capture_callback_t callback, void * user_data,
+        const dc1394capture_callback_options_t * options)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+    struct _capture_callback_t * cb;
+
+    if (!callback)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    if (cpriv->callback)
+        return DC1394_CAPTURE_IS_RUNNING;
+    if (dc1394_capture_get_fileno (camera) < 0) {
+        dc1394_log_error ("Capture must be set up before delivering frames");
+        return DC1394_CAPTURE_IS_NOT_SET;
+    }
+
+    cb = calloc (1, sizeof (struct _capture_callback_t));
+    if (!cb)
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    cb->camera = camera;
+    cb->callback = callback;
+    cb->user_data = user_data;
+    if (options)
+        cb->options = *options;
+
+    if (pipe (cb->stop_pipe) < 0) {
+        free (cb);
+        return DC1394_FAILURE;
+    }
+
+    if (pthread_create (&cb->thread, NULL, delivery_thread, cb) != 0) {
+        dc1394_log_error ("Failed to launch the delivery thread");
+        close (cb->stop_pipe[0]);
+        close (cb->stop_pipe[1]);
+        free (cb);
+        return DC1394_FAILURE;
+    }
+
+    cpriv->callback = cb;
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_capture_stop_callback (dc1394camera_t * camera)
+{
+    dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
+    struct _capture_callback_t * cb = cpriv->callback;
+
+    if (!cb)
+        return DC1394_CAPTURE_IS_NOT_SET;
+
+    if (write (cb->stop_pipe[1], "x", 1) != 1)
+        dc1394_log_error ("Failed to signal the delivery thread");
+    pthread_join (cb->thread, NULL);
+
+    close (cb->stop_pipe[0]);
+    close (cb->stop_pipe[1]);
+    free (cb);
+    cpriv->callback = NULL;
+
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_capture_hold_frame (dc1394camera_t * camera,
+        dc1394video_frame_t * frame)
+{
+    struct _capture_callback_t * cb = DC1394_CAMERA_PRIV (camera)->callback;
+
+    /* Only the frame being delivered, from within the callback */
+    if (!cb || !frame || frame != cb->current)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    return dc1394_frame_ref (frame);
+}
+
+dc1394error_t
+dc1394_capture_release_frame (dc1394camera_t * camera,
+        dc1394video_frame_t * frame)
+{
+    if (!frame || frame->camera != camera)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    return dc1394_frame_unref (frame);
+}
+
+#else
+
+dc1394error_t
+dc1394_capture_start_callback (dc1394camera_t * camera,
+        dc1394capture_callback_t callback, void * user_data,
+        const dc1394capture_callback_options_t * options)
+{
+    return DC1394_FUNCTION_NOT_SUPPORTED;
+}
+
+dc1394error_t
+dc1394_capture_stop_callback (dc1394camera_t * camera)
+{
+    return DC1394_FUNCTION_NOT_SUPPORTED;
+}
+
+dc1394error_t
+dc1394_capture_hold_frame (dc1394camera_t * camera,
+        dc1394video_frame_t * frame)
+{
+    return DC1394_FUNCTION_NOT_SUPPORTED;
+}
+
+dc1394error_t
+dc1394_capture_release_frame (dc1394camera_t * camera,
+        dc1394video_frame_t * frame)
+{
+    if (!frame || frame->camera != camera)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    return dc1394_frame_unref (frame);
+}
+
+#endif
@@ -55,6 +55,68 @@ typedef enum {
 #define DC1394_CAPTURE_FLAGS_DEFAULT         0x00000004U /* a reasonable default value: do bandwidth and channel allocation */
 #define DC1394_CAPTURE_FLAGS_AUTO_ISO        0x00000008U /* automatically start iso before capture and stop it after */
 
+/**
+ * Placement flags for the capture ring buffer and the capture threads, see dc1394capture_options_t. These are honoured on
+ * Linux only.
+ */
+#define DC1394_CAPTURE_PLACEMENT_HUGEPAGES   0x00000001U /* back library-allocated buffers with huge pages */
+#define DC1394_CAPTURE_PLACEMENT_LOCKED      0x00000002U /* lock the ring buffer in memory */
+#define DC1394_CAPTURE_PLACEMENT_NUMA_MEMORY 0x00000004U /* allocate the ring buffer on numa_node */
+#define DC1394_CAPTURE_PLACEMENT_NUMA_CPUS   0x00000008U /* run the capture threads on the CPUs of numa_node */
+
+/**
+ * Capture options, passed to dc1394_capture_setup_with_options(). Setting a field to zero (or passing a NULL pointer
+ * for the whole struct) selects the automatic value for it. Options that do not apply to the platform in use are ignored.
+ *
+ * packets_per_descriptor: (Linux juju) number of iso packets described by one receive descriptor. It is clamped to
+ *                         what the kernel interface can express. Automatic: as many as allowed.
+ * frames_per_interrupt:   (Linux juju) number of frames completed per wakeup of the capture process. Frames are
+ *                         still dequeued one by one, but a single event delivers several of them, which trades
+ *                         latency for fewer wakeups at high frame rates. The ring buffer should hold comfortably
+ *                         more frames than this. Automatic: sized from the frame rate to stay around 1000 wakeups/s.
+ *                         The virtual camera behaves the same way, with one frame per wakeup by default.
+ * placement:              (Linux) DC1394_CAPTURE_PLACEMENT_* flags. Huge pages only apply where the library allocates
+ *                         the ring itself (USB); the FireWire DMA rings are allocated by the kernel, which is merely
+ *                         asked to prefer numa_node for them. Failing to lock the ring (see RLIMIT_MEMLOCK) or to
+ *                         get huge pages is logged as a warning and capture goes on without.
+ * numa_node:              (Linux) node used by the NUMA placement flags.
+ * transfers_per_frame:    (USB) number of bulk transfers a frame is split in. They are all queued at once, so that
+ *                         the host controller always has buffers to fill and the device does not stall between
+ *                         frames. Rounded so that each transfer is a multiple of 1024 bytes, at most 64.
+ *                         Automatic: transfers of about 512 KiB.
+ * shared_event_thread:    (USB) nonzero to have the transfers of this camera handled by one thread shared with the
+ *                         other cameras of the same dc1394_t that set it, instead of a thread of its own. The shared
+ *                         thread gets the placement of the first of these cameras to start capturing.
+ */
+typedef struct {
+    uint32_t                 packets_per_descriptor;
+    uint32_t                 frames_per_interrupt;
+    uint32_t                 placement;
+    uint32_t                 numa_node;
+    uint32_t                 transfers_per_frame;
+    uint32_t                 shared_event_thread;
+} dc1394capture_options_t;
+
+/**
+ * Frame callback, see dc1394_capture_start_callback(). It runs on the delivery thread of the camera, once per frame and
+ * in capture order. The frame goes back to the ring buffer when the callback returns, unless the callback keeps it with
+ * dc1394_capture_hold_frame().
+ */
+typedef void (*dc1394capture_callback_t)(dc1394camera_t *camera, dc1394video_frame_t *frame, void *user_data);
+
+/**
+ * Delivery thread options, passed to dc1394_capture_start_callback(). Zero fields (or a NULL pointer) keep the defaults.
+ *
+ * realtime_priority: SCHED_FIFO priority of the delivery thread. Zero keeps the normal scheduling. If the process is not
+ *                    allowed to use it, a warning is logged and the thread runs with the normal scheduling.
+ * cpu_mask:          CPUs (bit n for CPU n) the delivery thread may run on. Zero falls back to the NUMA placement of
+ *                    the capture options, if any.
+ */
+typedef struct {
+    int                      realtime_priority;
+    uint64_t                 cpu_mask;
+} dc1394capture_callback_options_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -68,6 +130,33 @@ extern "C" {
  */
 dc1394error_t dc1394_capture_setup(dc1394camera_t *camera, uint32_t num_dma_buffers, uint32_t flags);
 
+/**
+ * Setup the capture like dc1394_capture_setup(), with additional tuning options. options may be NULL.
+ */
+dc1394error_t dc1394_capture_setup_with_options(dc1394camera_t *camera, uint32_t num_dma_buffers, uint32_t flags,
+                                                const dc1394capture_options_t *options);
+
+/**
+ * Setup the capture into a ring of buffers provided by the caller, e.g. in shared memory or in pinned memory of a
+ * processing pipeline, instead of buffers allocated by the library. buffers holds num_buffers pointers to areas of at
+ * least buffer_size bytes each, which must be able to hold a full frame (see total_bytes in dc1394video_frame_t) and
+ * must stay valid until the capture is stopped. The image of a dequeued frame is in one of these buffers.
+ *
+ * USB cameras transfer frames straight into the buffers. FireWire cameras can only receive into a DMA ring owned by the
+ * kernel, so each frame is copied once from it into its user buffer when it is dequeued. Not supported on Mac OS X and
+ * Windows. options may be NULL.
+ */
+dc1394error_t dc1394_capture_setup_with_buffers(dc1394camera_t *camera, uint32_t num_buffers, unsigned char **buffers,
+                                                size_t buffer_size, uint32_t flags,
+                                                const dc1394capture_options_t *options);
+
+/**
+ * Binds the calling thread to the CPUs of the NUMA node selected in the capture options of the camera, so that an
+ * application can keep frame processing local to the capture buffers. Does nothing unless the capture was set up with
+ * DC1394_CAPTURE_PLACEMENT_NUMA_CPUS.
+ */
+dc1394error_t dc1394_capture_bind_thread(dc1394camera_t *camera);
+
 /**
  * Stop the capture
  */
@@ -85,10 +174,24 @@ int dc1394_capture_get_fileno (dc1394camera_t * camera);
 dc1394error_t dc1394_capture_dequeue(dc1394camera_t * camera, dc1394capture_policy_t policy, dc1394video_frame_t **frame);
 
 /**
- * Returns a frame to the ring buffer once it has been used.
+ * Returns a frame to the ring buffer once it has been used. This drops the reference of the caller, like
+ * dc1394_frame_unref(): a frame that others still hold goes back when they drop theirs. Frames go back to the ring
+ * buffer in the order they were dequeued: a frame returned early waits for the older ones.
  */
 dc1394error_t dc1394_capture_enqueue(dc1394camera_t * camera, dc1394video_frame_t * frame);
 
+/**
+ * Takes a reference on a dequeued frame. Dequeuing gives the caller the first reference. The frame goes back to the
+ * ring buffer when its last reference is dropped with dc1394_frame_unref(), so that several threads can use the same
+ * frame without copying it. Thread safe.
+ */
+dc1394error_t dc1394_frame_ref(dc1394video_frame_t *frame);
+
+/**
+ * Drops a reference on a dequeued frame, returning it to the ring buffer if it was the last one. Thread safe.
+ */
+dc1394error_t dc1394_frame_unref(dc1394video_frame_t *frame);
+
 /**
  * Returns DC1394_TRUE if the given frame (previously dequeued) has been
  * detected to be corrupt (missing data, corrupted data, overrun buffer, etc.).
@@ -100,6 +203,33 @@ dc1394error_t dc1394_capture_enqueue(dc1394camera_t * camera, dc1394video_frame_
 dc1394bool_t dc1394_capture_is_frame_corrupt (dc1394camera_t * camera,
         dc1394video_frame_t * frame);
 
+/**
+ * Starts delivering the frames of a running capture to a callback, from a thread owned by the library. The thread waits
+ * on the capture file descriptor and dequeues every frame that is ready, so the application must not dequeue frames
+ * itself meanwhile. Frames the backend hands out in error are requeued without calling the callback; the thread only
+ * stops early if dequeuing itself fails. Not available on Windows.
+ */
+dc1394error_t dc1394_capture_start_callback(dc1394camera_t *camera, dc1394capture_callback_t callback, void *user_data,
+                                            const dc1394capture_callback_options_t *options);
+
+/**
+ * Stops the delivery thread. Once this returns the callback is not running and will not be called again. Frames that are
+ * still held stay out of the ring buffer until they are released or the capture is stopped.
+ */
+dc1394error_t dc1394_capture_stop_callback(dc1394camera_t *camera);
+
+/**
+ * Called from the callback to keep the frame after the callback returns, e.g. to process it on another thread. The frame
+ * must be given back with dc1394_capture_release_frame() once done. Meanwhile the ring buffer has one buffer less. This
+ * takes a reference on the frame, like dc1394_frame_ref(), which can be used from the callback as well.
+ */
+dc1394error_t dc1394_capture_hold_frame(dc1394camera_t *camera, dc1394video_frame_t *frame);
+
+/**
+ * Gives a frame kept with dc1394_capture_hold_frame() back, like dc1394_frame_unref(). May be called from any thread.
+ */
+dc1394error_t dc1394_capture_release_frame(dc1394camera_t *camera, dc1394video_frame_t *frame);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,428 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * File format for recorded frames, and its reader
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* For 64-bit file offsets on 32-bit systems */
+#define _FILE_OFFSET_BITS 64
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#include "container.h"
+#include "internal.h"
+
+/* CRC-32 (IEEE 802.3), on a table built on first use.  Threads racing to
+ * build it write the same values. */
+uint32_t
+container_crc32 (uint32_t crc, const void * data, size_t len)
+{
+    static uint32_t table[256];
+    static int table_ready;
+    const unsigned char * p = data;
+
+    if (!__atomic_load_n (&table_ready, __ATOMIC_ACQUIRE)) {
+        uint32_t i, j, c;
+        for (i = 0; i < 256; i++) {
+            for (c = i, j = 0; j < 8; j++)
+                c = c & 1 ? 0xedb88320U ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        __atomic_store_n (&table_ready, 1, __ATOMIC_RELEASE);
+    }
+
+    crc = ~crc;
+    while (len--)
+        crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+void
+container_fill_header (dc1394container_header_t * header)
+{
+    memset (header, 0, sizeof *header);
+    memcpy (header->magic, DC1394_CONTAINER_MAGIC, sizeof header->magic);
+    header->version = DC1394_CONTAINER_VERSION;
+    header->byte_order = DC1394_CONTAINER_BYTE_ORDER;
+    header->header_size = sizeof *header;
+    header->record_header_size = sizeof (dc1394container_record_t);
+    header->alignment = DC1394_CONTAINER_ALIGNMENT;
+}
+
+void
+container_fill_record (dc1394container_record_t * record,
+        const dc1394video_frame_t * frame, uint64_t sequence)
+{
+    memset (record, 0, sizeof *record);
+    record->magic = DC1394_CONTAINER_RECORD_MAGIC;
+    record->record_size = (sizeof *record + frame->image_bytes +
+            DC1394_CONTAINER_ALIGNMENT - 1) &
+        ~(uint64_t) (DC1394_CONTAINER_ALIGNMENT - 1);
+    record->sequence = sequence;
+    record->timestamp = frame->timestamp;
+    record->guid = frame->camera ? frame->camera->guid : 0;
+    record->image_bytes = frame->image_bytes;
+    record->size[0] = frame->size[0];
+    record->size[1] = frame->size[1];
+    record->position[0] = frame->position[0];
+    record->position[1] = frame->position[1];
+    record->color_coding = frame->color_coding;
+    record->color_filter = frame->color_filter;
+    record->yuv_byte_order = frame->yuv_byte_order;
+    record->data_depth = frame->data_depth;
+    record->stride = frame->stride;
+    record->video_mode = frame->video_mode;
+    record->little_endian = frame->little_endian;
+    record->data_in_padding = frame->data_in_padding;
+    record->header_crc = container_crc32 (0, record, sizeof *record);
+}
+
+#ifdef HAVE_SYS_MMAN_H
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct __dc1394reader_t {
+    const unsigned char * map;
+    uint64_t map_size;
+
+    const dc1394container_index_t * index;
+    uint64_t count;
+    /* Index rebuilt by walking the records, owned by the reader */
+    dc1394container_index_t * recovered;
+    int is_recovered;
+};
+
+static const dc1394container_record_t *
+get_record (dc1394reader_t * reader, uint64_t offset)
+{
+    const dc1394container_record_t * record;
+    dc1394container_record_t copy;
+
+    if (offset > reader->map_size ||
+            reader->map_size - offset < sizeof (dc1394container_record_t))
+        return NULL;
+
+    record = (const dc1394container_record_t *) (reader->map + offset);
+    /* Written so that no sum can overflow with the sizes of a bad file */
+    if (record->magic != DC1394_CONTAINER_RECORD_MAGIC ||
+            record->record_size < sizeof *record ||
+            record->image_bytes > record->record_size - sizeof *record ||
+            record->record_size > reader->map_size - offset)
+        return NULL;
+
+    copy = *record;
+    copy.header_crc = 0;
+    if (container_crc32 (0, &copy, sizeof copy) != record->header_crc)
+        return NULL;
+    return record;
+}
+
+/* Uses the index the trailer points to, if the file has a valid one */
+static int
+read_index (dc1394reader_t * reader)
+{
+    const dc1394container_trailer_t * trailer;
+    uint64_t size = reader->map_size - sizeof (dc1394container_trailer_t);
+
+    if (reader->map_size < sizeof (dc1394container_header_t) +
+            sizeof (dc1394container_trailer_t))
+        return -1;
+
+    trailer = (const dc1394container_trailer_t *) (reader->map + size);
+    if (trailer->magic != DC1394_CONTAINER_TRAILER_MAGIC ||
+            trailer->index_offset > size ||
+            trailer->count > size / sizeof (dc1394container_index_t) ||
+            trailer->index_offset + trailer->count *
+            sizeof (dc1394container_index_t) != size)
+        return -1;
+
+    reader->index = (const dc1394container_index_t *)
+        (reader->map + trailer->index_offset);
+    reader->count = trailer->count;
+    if (container_crc32 (0, reader->index, reader->count *
+                sizeof (dc1394container_index_t)) != trailer->index_crc)
+        return -1;
+    return 0;
+}
+
+/* Walks the records up to the first one that is not complete */
+static int
+recover_index (dc1394reader_t * reader, uint64_t offset)
+{
+    const dc1394container_record_t * record;
+    uint64_t allocated = 0;
+
+    reader->count = 0;
+    while ((record = get_record (reader, offset))) {
+        if (reader->count == allocated) {
+            dc1394container_index_t * index;
+            allocated = allocated ? 2 * allocated : 1024;
+            index = realloc (reader->recovered, allocated * sizeof *index);
+            if (!index)
+                return -1;
+            reader->recovered = index;
+        }
+        reader->recovered[reader->count].offset = offset;
+        reader->recovered[reader->count].sequence = record->sequence;
+        reader->recovered[reader->count].timestamp = record->timestamp;
+        reader->count++;
+        offset += record->record_size;
+    }
+
+    dc1394_log_warning ("Recording has no valid index: recovered %"PRIu64
+            " frames", reader->count);
+    reader->index = reader->recovered;
+    reader->is_recovered = 1;
+    return 0;
+}
+
+dc1394reader_t *
+dc1394_reader_open (const char * path)
+{
+    dc1394reader_t * reader;
+    const dc1394container_header_t * header;
+    struct stat st;
+    void * map;
+    int fd;
+
+    fd = open (path, O_RDONLY);
+    if (fd < 0) {
+        dc1394_log_error ("Failed to open %s: %s", path, strerror (errno));
+        return NULL;
+    }
+    if (fstat (fd, &st) < 0 || st.st_size < (off_t) sizeof (dc1394container_header_t)) {
+        dc1394_log_error ("%s is not a recording", path);
+        close (fd);
+        return NULL;
+    }
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED) {
+        dc1394_log_error ("Failed to map %s: %s", path, strerror (errno));
+        return NULL;
+    }
+
+    reader = calloc (1, sizeof (dc1394reader_t));
+    if (!reader) {
+        munmap (map, st.st_size);
+        return NULL;
+    }
+    reader->map = map;
+    reader->map_size = st.st_size;
+
+    header = map;
+    if (memcmp (header->magic, DC1394_CONTAINER_MAGIC, sizeof header->magic)
+            || header->version != DC1394_CONTAINER_VERSION
+            || header->byte_order != DC1394_CONTAINER_BYTE_ORDER
+            || header->record_header_size != sizeof (dc1394container_record_t)
+            || header->header_size < sizeof *header) {
+        dc1394_log_error ("%s is not a recording of this version and byte "
+                "order", path);
+        dc1394_reader_close (reader);
+        return NULL;
+    }
+
+    if (read_index (reader) < 0 &&
+            recover_index (reader, header->header_size) < 0) {
+        dc1394_reader_close (reader);
+        return NULL;
+    }
+    return reader;
+}
+
+void
+dc1394_reader_close (dc1394reader_t * reader)
+{
+    if (!reader)
+        return;
+    munmap ((void *) reader->map, reader->map_size);
+    free (reader->recovered);
+    free (reader);
+}
+
+uint64_t
+dc1394_reader_get_count (dc1394reader_t * reader)
+{
+    return reader->count;
+}
+
+dc1394bool_t
+dc1394_reader_is_recovered (dc1394reader_t * reader)
+{
+    return reader->is_recovered ? DC1394_TRUE : DC1394_FALSE;
+}
+
+dc1394error_t
+dc1394_reader_get_frame (dc1394reader_t * reader, uint64_t index,
+        dc1394video_frame_t * frame)
+{
+    const dc1394container_record_t * record;
+
+    if (!reader || !frame || index >= reader->count)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    record = get_record (reader, reader->index[index].offset);
+    if (!record) {
+        dc1394_log_error ("Frame %"PRIu64" of the recording is corrupt", index);
+        return DC1394_FAILURE;
+    }
+
+    memset (frame, 0, sizeof *frame);
+    frame->image = (unsigned char *) (record + 1);
+    frame->size[0] = record->size[0];
+    frame->size[1] = record->size[1];
+    frame->position[0] = record->position[0];
+    frame->position[1] = record->position[1];
+    frame->color_coding = record->color_coding;
+    frame->color_filter = record->color_filter;
+    frame->yuv_byte_order = record->yuv_byte_order;
+    frame->data_depth = record->data_depth;
+    frame->stride = record->stride;
+    frame->video_mode = record->video_mode;
+    frame->total_bytes = record->image_bytes;
+    frame->image_bytes = record->image_bytes;
+    frame->timestamp = record->timestamp;
+    frame->id = index;
+    frame->little_endian = record->little_endian;
+    frame->data_in_padding = record->data_in_padding;
+    return DC1394_SUCCESS;
+}
+
+/* Index of the first entry whose key is not below value, keys being
+ * sorted along the index */
+static uint64_t
+lower_bound (dc1394reader_t * reader, int by_timestamp, uint64_t value)
+{
+    uint64_t lo = 0, hi = reader->count;
+
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        const dc1394container_index_t * e = reader->index + mid;
+        if ((by_timestamp ? e->timestamp : e->sequence) < value)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static dc1394error_t
+find_range (dc1394reader_t * reader, int by_timestamp, uint64_t begin,
+        uint64_t end, uint64_t * first, uint64_t * count)
+{
+    uint64_t last;
+
+    if (!reader || !first || !count || begin > end)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    *first = lower_bound (reader, by_timestamp, begin);
+    last = end == UINT64_MAX ? reader->count :
+        lower_bound (reader, by_timestamp, end + 1);
+    *count = last > *first ? last - *first : 0;
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_reader_find_timestamps (dc1394reader_t * reader, uint64_t begin,
+        uint64_t end, uint64_t * first, uint64_t * count)
+{
+    return find_range (reader, 1, begin, end, first, count);
+}
+
+dc1394error_t
+dc1394_reader_find_sequences (dc1394reader_t * reader, uint64_t begin,
+        uint64_t end, uint64_t * first, uint64_t * count)
+{
+    return find_range (reader, 0, begin, end, first, count);
+}
+
+dc1394error_t
+dc1394_reader_get_frame_by_sequence (dc1394reader_t * reader,
+        uint64_t sequence, dc1394video_frame_t * frame)
+{
+    uint64_t first, count;
+    dc1394error_t err;
+
+    err = dc1394_reader_find_sequences (reader, sequence, sequence, &first,
+            &count);
+    if (err != DC1394_SUCCESS)
+        return err;
+    if (count == 0)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    return dc1394_reader_get_frame (reader, first, frame);
+}
+
+#else
+
+dc1394reader_t *
+dc1394_reader_open (const char * path)
+{
+    return NULL;
+}
+
+void
+dc1394_reader_close (dc1394reader_t * reader)
+{
+}
+
+uint64_t
+dc1394_reader_get_count (dc1394reader_t * reader)
+{
+    return 0;
+}
+
+dc1394bool_t
+dc1394_reader_is_recovered (dc1394reader_t * reader)
+{
+    return DC1394_FALSE;
+}
+
+dc1394error_t
+dc1394_reader_get_frame (dc1394reader_t * reader, uint64_t index,
+        dc1394video_frame_t * frame)
+{
+    return DC1394_FUNCTION_NOT_SUPPORTED;
+}
+
+dc1394error_t
+dc1394_reader_get_frame_by_sequence (dc1394reader_t * reader,
+        uint64_t sequence, dc1394video_frame_t * frame)
+{
+    return DC1394_FUNCTION_NOT_SUPPORTED;
+}
+
+dc1394error_t
+dc1394_reader_find_timestamps (dc1394reader_t * reader, uint64_t begin,
+        uint64_t end, uint64_t * first, uint64_t * count)
+{
+    return DC1394_FUNCTION_NOT_SUPPORTED;
+}
+
+dc1394error_t
+dc1394_reader_find_sequences (dc1394reader_t * reader, uint64_t begin,
+        uint64_t end, uint64_t * first, uint64_t * count)
+{
+    return DC1394_FUNCTION_NOT_SUPPORTED;
+}
+
+#endif
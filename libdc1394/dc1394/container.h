@@ -0,0 +1,171 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * File format for recorded frames, and its reader
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __DC1394_CONTAINER_H__
+#define __DC1394_CONTAINER_H__
+
+/*! \file dc1394/container.h
+    \brief Format of the files written by the recorder, and functions to read them back
+
+    A recording is a file header followed by one record per frame, each made of a record header holding the metadata
+    of the frame and of its image. All integers are in the byte order of the recording host, which the file header
+    tells. Records are appended one after the other and start on multiples of DC1394_CONTAINER_ALIGNMENT bytes, so
+    that images are suitably aligned for the conversion functions when the file is mapped in memory.
+
+    When a recording is closed properly, an index of the records and a trailer pointing to it follow the last record,
+    so that any frame can be found without reading the file. A file cut short (e.g. by a crash) has no trailer: its
+    index is rebuilt by walking the records, up to the last complete one.
+
+    \code
+    dc1394container_header_t
+    dc1394container_record_t, image, padding     (repeated)
+    dc1394container_index_t                      (repeated, one per record)
+    dc1394container_trailer_t
+    \endcode
+*/
+
+#include <dc1394/log.h>
+#include <dc1394/video.h>
+
+#define DC1394_CONTAINER_MAGIC          "DC1394RF"
+#define DC1394_CONTAINER_VERSION        1
+#define DC1394_CONTAINER_BYTE_ORDER     0x01020304U
+#define DC1394_CONTAINER_ALIGNMENT      64
+#define DC1394_CONTAINER_RECORD_MAGIC   0x4d415246U /* "FRAM" */
+#define DC1394_CONTAINER_TRAILER_MAGIC  0x58444e49U /* "INDX" */
+
+/**
+ * File header, 64 bytes at offset 0
+ */
+typedef struct {
+    char                     magic[8];            /* DC1394_CONTAINER_MAGIC, not nul-terminated */
+    uint32_t                 version;             /* DC1394_CONTAINER_VERSION */
+    uint32_t                 byte_order;          /* DC1394_CONTAINER_BYTE_ORDER as written by the host */
+    uint32_t                 header_size;         /* offset of the first record */
+    uint32_t                 record_header_size;  /* size of dc1394container_record_t */
+    uint32_t                 alignment;           /* records start on multiples of this */
+    uint32_t                 reserved[9];
+} dc1394container_header_t;
+
+/**
+ * Record header, 128 bytes, followed by image_bytes of image and padding up to record_size
+ */
+typedef struct {
+    uint32_t                 magic;               /* DC1394_CONTAINER_RECORD_MAGIC */
+    uint32_t                 header_crc;          /* CRC-32 of this header, computed with header_crc set to zero */
+    uint64_t                 record_size;         /* header, image and padding */
+    uint64_t                 sequence;            /* rank of the record in the file */
+    uint64_t                 timestamp;           /* of the frame, in microseconds */
+    uint64_t                 guid;                /* of the camera, 0 if unknown */
+    uint64_t                 image_bytes;
+    uint32_t                 size[2];
+    uint32_t                 position[2];
+    uint32_t                 color_coding;
+    uint32_t                 color_filter;
+    uint32_t                 yuv_byte_order;
+    uint32_t                 data_depth;
+    uint32_t                 stride;
+    uint32_t                 video_mode;
+    uint32_t                 little_endian;
+    uint32_t                 data_in_padding;
+    uint32_t                 reserved[8];
+} dc1394container_record_t;
+
+/**
+ * Index entry, one per record in file order
+ */
+typedef struct {
+    uint64_t                 offset;              /* of the record header */
+    uint64_t                 sequence;
+    uint64_t                 timestamp;
+} dc1394container_index_t;
+
+/**
+ * Trailer, at the very end of a file that was closed properly
+ */
+typedef struct {
+    uint64_t                 index_offset;
+    uint64_t                 count;
+    uint32_t                 index_crc;           /* CRC-32 of the index entries */
+    uint32_t                 magic;               /* DC1394_CONTAINER_TRAILER_MAGIC */
+} dc1394container_trailer_t;
+
+typedef struct __dc1394reader_t dc1394reader_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Opens a recording for reading, by mapping it in memory. The index of a file that was not closed properly is rebuilt.
+ * Not available on Windows.
+ */
+dc1394reader_t * dc1394_reader_open (const char * path);
+
+/**
+ * Closes a recording. The frames obtained from it are no longer valid.
+ */
+void dc1394_reader_close (dc1394reader_t * reader);
+
+/**
+ * Number of frames in a recording.
+ */
+uint64_t dc1394_reader_get_count (dc1394reader_t * reader);
+
+/**
+ * Tells whether the index came from the trailer of the file, or had to be rebuilt.
+ */
+dc1394bool_t dc1394_reader_is_recovered (dc1394reader_t * reader);
+
+/**
+ * Fills frame in with the metadata of the index-th frame of a recording. The image is not copied: frame->image points
+ * into the mapped file, and stays valid until the reader is closed. frame->camera is NULL and frame->id is index.
+ */
+dc1394error_t dc1394_reader_get_frame (dc1394reader_t * reader, uint64_t index, dc1394video_frame_t * frame);
+
+/**
+ * Gets the frame of a recording with the given sequence number.
+ * @return DC1394_INVALID_ARGUMENT_VALUE if there is none.
+ */
+dc1394error_t dc1394_reader_get_frame_by_sequence (dc1394reader_t * reader, uint64_t sequence,
+                                                    dc1394video_frame_t * frame);
+
+/**
+ * Finds the frames of a recording whose timestamps are in [begin, end], assuming timestamps do not decrease along the
+ * file, as is the case for a recording of a single camera.
+ * @param first Index of the first of these frames.
+ * @param count Number of these frames, possibly zero.
+ */
+dc1394error_t dc1394_reader_find_timestamps (dc1394reader_t * reader, uint64_t begin, uint64_t end,
+                                              uint64_t * first, uint64_t * count);
+
+/**
+ * Finds the frames of a recording whose sequence numbers are in [begin, end].
+ * @param first Index of the first of these frames.
+ * @param count Number of these frames, possibly zero.
+ */
+dc1394error_t dc1394_reader_find_sequences (dc1394reader_t * reader, uint64_t begin, uint64_t end,
+                                             uint64_t * first, uint64_t * count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DC1394_CONTAINER_H__ */
@@ -192,108 +192,88 @@ dc1394_camera_print_info(dc1394camera_t *camera, FILE* fd)
 }
 
 /*****************************************************
- dc1394_get_camera_feature_set
+ decode_feature
 
- Collects the available features for the camera
- described by node and stores them in features.
+ Fills a feature from its presence quadlet at 0x40x, its
+ inquiry register at 0x5xx and its status register at
+ 0x8xx. The last two are only looked at if the feature
+ is present in the previous ones.
 *****************************************************/
-dc1394error_t
-dc1394_feature_get_all(dc1394camera_t *camera, dc1394featureset_t *features)
+static void
+decode_feature(dc1394feature_info_t *feature, uint32_t presence,
+               uint32_t inquiry, uint32_t status)
 {
-    uint32_t i, j;
-    dc1394error_t err=DC1394_SUCCESS;
-
-    for (i= DC1394_FEATURE_MIN, j= 0; i <= DC1394_FEATURE_MAX; i++, j++)  {
-        features->feature[j].id= i;
-        err=dc1394_feature_get(camera, &features->feature[j]);
-        DC1394_ERR_RTN(err, "Could not get camera feature");
-    }
+    int i, j;
 
-    return err;
-}
-
-/*****************************************************
- dc1394_get_camera_feature
-
- Stores the bounds and options associated with the
- feature described by feature->id
-*****************************************************/
-dc1394error_t
-dc1394_feature_get(dc1394camera_t *camera, dc1394feature_info_t *feature)
-{
-    uint64_t offset;
-    uint32_t value;
-    dc1394error_t err;
-
-    if ( (feature->id < DC1394_FEATURE_MIN) || (feature->id > DC1394_FEATURE_MAX) ) {
-        return DC1394_INVALID_FEATURE;
-    }
-
-    // check presence
-    err=dc1394_feature_is_present(camera, feature->id, &(feature->available));
-    DC1394_ERR_RTN(err, "Could not check feature presence");
-
-    if (feature->available == DC1394_FALSE) {
-        return DC1394_SUCCESS;
-    }
-
-    // get capabilities
-    FEATURE_TO_INQUIRY_OFFSET(feature->id, offset);
-    err=dc1394_get_control_register(camera, offset, &value);
-    DC1394_ERR_RTN(err, "Could not check feature characteristics");
-
-    dc1394_feature_get_modes(camera, feature->id, &feature->modes);
-    dc1394_feature_get_mode(camera, feature->id, &feature->current_mode);
+    // the policy is to AND the three locations, see dc1394_feature_is_present
+    feature->available= DC1394_FALSE;
+    if (is_feature_bit_set(presence, feature->id)!=DC1394_TRUE ||
+        !(inquiry & 0x80000000UL) || !(status & 0x80000000UL))
+        return;
+    feature->available= DC1394_TRUE;
+
+    // capabilities
+    feature->modes.num=0;
+    if (feature->id != DC1394_FEATURE_TRIGGER) {
+        if (inquiry & 0x01000000UL)
+            feature->modes.modes[feature->modes.num++]=DC1394_FEATURE_MODE_MANUAL;
+        if (inquiry & 0x02000000UL)
+            feature->modes.modes[feature->modes.num++]=DC1394_FEATURE_MODE_AUTO;
+        if (inquiry & 0x10000000UL)
+            feature->modes.modes[feature->modes.num++]=DC1394_FEATURE_MODE_ONE_PUSH_AUTO;
+    }
+
+    if (status & 0x04000000UL)
+        feature->current_mode= DC1394_FEATURE_MODE_ONE_PUSH_AUTO;
+    else if (status & 0x01000000UL)
+        feature->current_mode= DC1394_FEATURE_MODE_AUTO;
+    else
+        feature->current_mode= DC1394_FEATURE_MODE_MANUAL;
 
     switch (feature->id) {
     case DC1394_FEATURE_TRIGGER:
-        feature->polarity_capable= (value & 0x02000000UL) ? DC1394_TRUE : DC1394_FALSE;
-        int i, j;
-        uint32_t value_tmp;
+        feature->polarity_capable= (inquiry & 0x02000000UL) ? DC1394_TRUE : DC1394_FALSE;
 
         feature->trigger_modes.num=0;
-        value_tmp= (value & (0xFFFF));
-
         for (i=DC1394_TRIGGER_MODE_MIN;i<=DC1394_TRIGGER_MODE_MAX;i++) {
             j = i - DC1394_TRIGGER_MODE_MIN;
-            if (value_tmp & (0x1 << (15-j-(j>5)*8))) { // (i>5)*8 to take the mode gap into account
+            if ((inquiry & 0xFFFF) & (0x1 << (15-j-(j>5)*8))) { // (i>5)*8 to take the mode gap into account
                 feature->trigger_modes.modes[feature->trigger_modes.num]=i;
                 feature->trigger_modes.num++;
             }
         }
 
-        err=dc1394_external_trigger_get_supported_sources(camera,&feature->trigger_sources);
-        DC1394_ERR_RTN(err, "Could not get supported trigger sources");
-
+        feature->trigger_sources.num=0;
+        for (i = 0; i < DC1394_TRIGGER_SOURCE_NUM; i++) {
+            if (inquiry & (0x1 << (23-i-(i>3)*3))){
+                feature->trigger_sources.sources[feature->trigger_sources.num]=i+DC1394_TRIGGER_SOURCE_MIN;
+                feature->trigger_sources.num++;
+            }
+        }
         break;
     default:
         feature->polarity_capable = 0;
         feature->trigger_mode     = 0;
 
-        feature->min= (value & 0xFFF000UL) >> 12;
-        feature->max= (value & 0xFFFUL);
+        feature->min= (inquiry & 0xFFF000UL) >> 12;
+        feature->max= (inquiry & 0xFFFUL);
         break;
     }
 
-    feature->absolute_capable = (value & 0x40000000UL) ? DC1394_TRUE : DC1394_FALSE;
-    feature->readout_capable  = (value & 0x08000000UL) ? DC1394_TRUE : DC1394_FALSE;
-    feature->on_off_capable   = (value & 0x04000000UL) ? DC1394_TRUE : DC1394_FALSE;
-
-    // get current values
-    FEATURE_TO_VALUE_OFFSET(feature->id, offset);
-
-    err=dc1394_get_control_register(camera, offset, &value);
-    DC1394_ERR_RTN(err, "Could not get feature register");
+    feature->absolute_capable = (inquiry & 0x40000000UL) ? DC1394_TRUE : DC1394_FALSE;
+    feature->readout_capable  = (inquiry & 0x08000000UL) ? DC1394_TRUE : DC1394_FALSE;
+    feature->on_off_capable   = (inquiry & 0x04000000UL) ? DC1394_TRUE : DC1394_FALSE;
 
+    // current values
     switch (feature->id) {
     case DC1394_FEATURE_TRIGGER:
-        feature->trigger_polarity= (value & 0x01000000UL) ? DC1394_TRUE : DC1394_FALSE;
-        feature->trigger_mode= (uint32_t)((value >> 16) & 0xF);
+        feature->trigger_polarity= (status & 0x01000000UL) ? DC1394_TRUE : DC1394_FALSE;
+        feature->trigger_mode= (uint32_t)((status >> 16) & 0xF);
         if (feature->trigger_mode >= 14)
             feature->trigger_mode += DC1394_TRIGGER_MODE_MIN - 8;
         else
             feature->trigger_mode += DC1394_TRIGGER_MODE_MIN;
-        feature->trigger_source = (uint32_t)((value >> 21) & 0x7UL);
+        feature->trigger_source = (uint32_t)((status >> 21) & 0x7UL);
         if (feature->trigger_source > 3)
             feature->trigger_source -= 3;
         feature->trigger_source += DC1394_TRIGGER_SOURCE_MIN;
@@ -302,34 +282,194 @@ dc1394_feature_get(dc1394camera_t *camera, dc1394feature_info_t *feature)
         break;
     }
 
-    feature->is_on= (value & 0x02000000UL) ? DC1394_TRUE : DC1394_FALSE;
+    feature->is_on= (status & 0x02000000UL) ? DC1394_TRUE : DC1394_FALSE;
+    feature->abs_control= (status & 0x40000000UL) ? DC1394_ON : DC1394_OFF;
 
     switch (feature->id) {
     case DC1394_FEATURE_WHITE_BALANCE:
-        feature->RV_value= value & 0xFFFUL;
-        feature->BU_value= (value & 0xFFF000UL) >> 12;
+        feature->RV_value= status & 0xFFFUL;
+        feature->BU_value= (status & 0xFFF000UL) >> 12;
         break;
     case DC1394_FEATURE_WHITE_SHADING:
-        feature->R_value=value & 0xFFUL;
-        feature->G_value=(value & 0xFF00UL)>>8;
-        feature->B_value=(value & 0xFF0000UL)>>16;
+        feature->R_value=status & 0xFFUL;
+        feature->G_value=(status & 0xFF00UL)>>8;
+        feature->B_value=(status & 0xFF0000UL)>>16;
         break;
     case DC1394_FEATURE_TEMPERATURE:
-        feature->value= value & 0xFFFUL;
-        feature->target_value= value & 0xFFF000UL;
+        feature->value= status & 0xFFFUL;
+        feature->target_value= status & 0xFFF000UL;
         break;
     default:
-        feature->value= value & 0xFFFUL;
+        feature->value= status & 0xFFFUL;
         break;
     }
+}
+
+/* The absolute min, max and value registers follow each other */
+static dc1394error_t
+get_feature_absolute(dc1394camera_t *camera, dc1394feature_info_t *feature)
+{
+    uint32_t quads[3];
+    dc1394error_t err;
+
+    err=get_absolute_registers(camera, feature->id, REG_CAMERA_ABS_MIN, quads, 3);
+    DC1394_ERR_RTN(err, "Could not get feature absolute values");
+
+    memcpy(&feature->abs_min, &quads[0], 4);
+    memcpy(&feature->abs_max, &quads[1], 4);
+    memcpy(&feature->abs_value, &quads[2], 4);
+    return err;
+}
+
+/* Index of the inquiry and status registers of a feature, in quadlets from
+   the start of the 0x5xx and 0x8xx ranges */
+int
+feature_register_index(dc1394feature_t feature)
+{
+    if (feature < DC1394_FEATURE_ZOOM)
+        return feature - DC1394_FEATURE_MIN;
+    else if (feature >= DC1394_FEATURE_CAPTURE_SIZE)
+        return 32 + feature + 12 - DC1394_FEATURE_ZOOM;
+    else
+        return 32 + feature - DC1394_FEATURE_ZOOM;
+}
+
+/*****************************************************
+ get_feature_registers
+
+ Reads the presence quadlets and the inquiry and status
+ registers of all features, in a few blocks. The last
+ two are indexed with feature_register_index and left
+ to zero for the ranges without any feature.
+*****************************************************/
+dc1394error_t
+get_feature_registers(dc1394camera_t *camera, uint32_t presence[2],
+                      uint32_t inquiry[64], uint32_t status[64])
+{
+    /* Features with consecutive registers */
+    static const struct {
+        dc1394feature_t first, last;
+    } ranges[] = {
+        { DC1394_FEATURE_MIN, DC1394_FEATURE_ZOOM - 1 },
+        { DC1394_FEATURE_ZOOM, DC1394_FEATURE_CAPTURE_SIZE - 1 },
+        { DC1394_FEATURE_CAPTURE_SIZE, DC1394_FEATURE_MAX },
+    };
+    uint32_t i, r;
+    dc1394error_t err;
+
+    memset(inquiry, 0, 64 * sizeof(uint32_t));
+    memset(status, 0, 64 * sizeof(uint32_t));
+
+    err=get_registers_block(camera, camera->command_registers_base +
+                            REG_CAMERA_FEATURE_HI_INQ, presence, 2);
+    for (r = 0; err == DC1394_SUCCESS && r < sizeof(ranges)/sizeof(ranges[0]); r++) {
+        uint32_t first = feature_register_index(ranges[r].first);
+        uint32_t num = ranges[r].last - ranges[r].first + 1;
+        int present = 0;
+
+        for (i = ranges[r].first; i <= ranges[r].last; i++)
+            present |= is_feature_bit_set(presence[i >= DC1394_FEATURE_ZOOM], i);
+        if (!present)
+            continue;
+
+        err=get_registers_block(camera, camera->command_registers_base +
+                                REG_CAMERA_FEATURE_HI_BASE_INQ + 4 * first,
+                                inquiry + first, num);
+        if (err == DC1394_SUCCESS)
+            err=get_registers_block(camera, camera->command_registers_base +
+                                    REG_CAMERA_FEATURE_HI_BASE + 4 * first,
+                                    status + first, num);
+    }
+
+    return err;
+}
+
+/*****************************************************
+ dc1394_get_camera_feature_set
+
+ Collects the available features for the camera
+ described by node and stores them in features.
+ The registers are read in a few blocks; if that
+ fails each feature is queried on its own.
+*****************************************************/
+dc1394error_t
+dc1394_feature_get_all(dc1394camera_t *camera, dc1394featureset_t *features)
+{
+    uint32_t presence[2], inquiry[64], status[64];
+    uint32_t i, j;
+    dc1394error_t err;
+
+    err=get_feature_registers(camera, presence, inquiry, status);
+    if (err != DC1394_SUCCESS) {
+        dc1394_log_debug("Could not read the feature registers in blocks");
+        for (i= DC1394_FEATURE_MIN, j= 0; i <= DC1394_FEATURE_MAX; i++, j++)  {
+            features->feature[j].id= i;
+            err=dc1394_feature_get(camera, &features->feature[j]);
+            DC1394_ERR_RTN(err, "Could not get camera feature");
+        }
+        return err;
+    }
 
-    if (feature->absolute_capable>0) {
-        err=dc1394_feature_get_absolute_boundaries(camera, feature->id, &feature->abs_min, &feature->abs_max);
-        DC1394_ERR_RTN(err, "Could not get feature absolute min/max");
-        err=dc1394_feature_get_absolute_value(camera, feature->id, &feature->abs_value);
-        DC1394_ERR_RTN(err, "Could not get feature absolute value");
-        err=dc1394_feature_get_absolute_control(camera, feature->id, &feature->abs_control);
-        DC1394_ERR_RTN(err, "Could not get feature absolute control");
+    for (i= DC1394_FEATURE_MIN, j= 0; i <= DC1394_FEATURE_MAX; i++, j++)  {
+        dc1394feature_info_t *feature = &features->feature[j];
+        int index = feature_register_index(i);
+
+        feature->id= i;
+        decode_feature(feature, presence[i >= DC1394_FEATURE_ZOOM],
+                       inquiry[index], status[index]);
+        if (feature->available && feature->absolute_capable) {
+            err=get_feature_absolute(camera, feature);
+            DC1394_ERR_RTN(err, "Could not get camera feature");
+        }
+    }
+
+    return err;
+}
+
+/*****************************************************
+ dc1394_get_camera_feature
+
+ Stores the bounds and options associated with the
+ feature described by feature->id
+*****************************************************/
+dc1394error_t
+dc1394_feature_get(dc1394camera_t *camera, dc1394feature_info_t *feature)
+{
+    uint64_t offset;
+    uint32_t presence, inquiry=0, status=0;
+    dc1394error_t err;
+
+    if ( (feature->id < DC1394_FEATURE_MIN) || (feature->id > DC1394_FEATURE_MAX) ) {
+        return DC1394_INVALID_FEATURE;
+    }
+
+    // check presence
+    if (feature->id < DC1394_FEATURE_ZOOM)
+        offset= REG_CAMERA_FEATURE_HI_INQ;
+    else
+        offset= REG_CAMERA_FEATURE_LO_INQ;
+    err=dc1394_get_control_register(camera, offset, &presence);
+    DC1394_ERR_RTN(err, "Could not check feature presence");
+
+    if (is_feature_bit_set(presence, feature->id)==DC1394_TRUE) {
+        // get capabilities
+        FEATURE_TO_INQUIRY_OFFSET(feature->id, offset);
+        err=dc1394_get_control_register(camera, offset, &inquiry);
+        DC1394_ERR_RTN(err, "Could not check feature characteristics");
+
+        // get current values
+        if (inquiry & 0x80000000UL) {
+            FEATURE_TO_VALUE_OFFSET(feature->id, offset);
+            err=dc1394_get_control_register(camera, offset, &status);
+            DC1394_ERR_RTN(err, "Could not get feature register");
+        }
+    }
+
+    decode_feature(feature, presence, inquiry, status);
+
+    if (feature->available && feature->absolute_capable) {
+        err=get_feature_absolute(camera, feature);
+        DC1394_ERR_RTN(err, "Could not get feature absolute values");
     }
 
     return err;
@@ -1957,6 +2097,9 @@ dc1394_new (void)
 #ifdef HAVE_LIBUSB
     dc1394_usb_init (d);
 #endif
+#ifdef HAVE_LINUX
+    dc1394_virtual_init (d);
+#endif
 
     int i;
     int initializations = 0;
@@ -1987,6 +2130,7 @@ dc1394_new (void)
 void
 dc1394_free (dc1394_t * d)
 {
+    dc1394_hotplug_stop (d);
     free_enumeration (d);
     int i;
     for (i = 0; i < d->num_platforms; i++) {
@@ -1996,6 +2140,7 @@ dc1394_free (dc1394_t * d)
     }
     free (d->platforms);
     d->platforms = NULL;
+    free (d->cache_dir);
     free (d);
 }
 
@@ -2020,11 +2165,28 @@ void register_platform (dc1394_t * d, const platform_dispatch_t * dispatch,
     d->num_platforms++;
 }
 
+/* Reads consecutive quadlets of the configuration ROM in one transaction,
+ * or one at a time if the camera does not accept that */
+static int
+read_rom_block (platform_camera_t * pcam, const platform_dispatch_t * disp,
+        uint32_t offset, uint32_t * quads, int num_quads)
+{
+    int i;
+
+    if (num_quads > 1 && disp->camera_read (pcam, offset, quads,
+                num_quads) == DC1394_SUCCESS)
+        return 0;
+    for (i = 0; i < num_quads; i++)
+        if (disp->camera_read (pcam, offset + 4 * i, quads + i, 1) < 0)
+            return -1;
+    return 0;
+}
+
 char *
 get_leaf_string (platform_camera_t * pcam, const platform_dispatch_t * disp,
         uint32_t offset)
 {
-    uint32_t quad;
+    uint32_t quad, * quads;
     int len, i;
     char * str;
 
@@ -2032,18 +2194,24 @@ get_leaf_string (platform_camera_t * pcam, const platform_dispatch_t * disp,
         return NULL;
 
     len = quad >> 16;
+    if (len < 2)
+        len = 2;
     str = malloc (4 * (len - 2) + 1);
+    quads = malloc (4 * (len - 2) + 4);
+    if (!str || !quads ||
+            read_rom_block (pcam, disp, offset + 12, quads, len - 2) < 0) {
+        free (quads);
+        free (str);
+        return NULL;
+    }
     for (i = 0; i < len - 2; i++) {
-        if (disp->camera_read (pcam, offset + 12 + 4 * i, &quad, 1) < 0) {
-            free (str);
-            return NULL;
-        }
-        str[4*i+0] = quad >> 24;
-        str[4*i+1] = (quad >> 16) & 0xff;
-        str[4*i+2] = (quad >> 8) & 0xff;
-        str[4*i+3] = quad & 0xff;
+        str[4*i+0] = quads[i] >> 24;
+        str[4*i+1] = (quads[i] >> 16) & 0xff;
+        str[4*i+2] = (quads[i] >> 8) & 0xff;
+        str[4*i+3] = quads[i] & 0xff;
     }
     str[4*i] = '\0';
+    free (quads);
     return str;
 }
 
@@ -2058,12 +2226,15 @@ dc1394_camera_new_unit (dc1394_t * d, uint64_t guid, int unit)
     uint32_t vendor_name_offset = 0;
     uint32_t model_name_offset = 0;
     uint32_t unit_sub_sw_version = 0;
-    uint32_t ghigh, glow, quad;
+    uint32_t rom[5], quad, * entries = NULL;
     uint32_t offset, num_entries;
     dc1394camera_t * camera;
     dc1394camera_priv_t * cpriv;
+    persistent_cache_t pc;
+    char * cache_path = NULL;
+    int cached = 0;
 
-    if (!d->num_cameras)
+    if (!d->num_cameras && !d->hotplug)
         refresh_enumeration (d);
 
     for (i = 0; i < d->num_cameras; i++) {
@@ -2082,23 +2253,37 @@ dc1394_camera_new_unit (dc1394_t * d, uint64_t guid, int unit)
     if (!pcam)
         return NULL;
 
-    /* Check to make sure the GUID still matches. */
-    if (disp->camera_read (pcam, 0x40C, &ghigh, 1) < 0 ||
-        disp->camera_read (pcam, 0x410, &glow, 1) < 0)
+    /* Check to make sure the GUID still matches. The quadlets before it
+       tell whether the persistent cache is still valid. */
+    if (read_rom_block (pcam, disp, 0x400, rom, 5) < 0)
         goto fail;
 
-    if (ghigh != (info->guid >> 32) || glow != (info->guid & 0xffffffff))
+    if (rom[3] != (info->guid >> 32) ||
+            rom[4] != (info->guid & 0xffffffff))
         goto fail;
 
+    cache_path = persistent_cache_path (d, info);
+    if (cache_path && persistent_cache_load (cache_path, info, rom, &pc) == 0) {
+        command_regs_base = pc.command_regs_base;
+        unit_sub_sw_version = pc.unit_sub_sw_version;
+        cached = 1;
+        goto found;
+    }
+
     if (disp->camera_read (pcam, info->unit_dependent_directory,
                 &quad, 1) < 0)
         goto fail;
 
     num_entries = quad >> 16;
     offset = info->unit_dependent_directory + 4;
+    entries = malloc (4 * num_entries + 4);
+    if (!entries || read_rom_block (pcam, disp, offset, entries,
+                num_entries) < 0) {
+        free (entries);
+        goto fail;
+    }
     for (i = 0; i < num_entries; i++) {
-        if (disp->camera_read (pcam, offset + 4 * i, &quad, 1) < 0)
-            goto fail;
+        quad = entries[i];
         if ((quad >> 24) == 0x40)
             command_regs_base = quad & 0xffffff;
         else if ((quad >> 24) == 0x81) {
@@ -2119,7 +2304,9 @@ dc1394_camera_new_unit (dc1394_t * d, uint64_t guid, int unit)
         else if ((quad >> 24) == 0x38)
             unit_sub_sw_version = quad & 0xffffff;
     }
+    free (entries);
 
+ found:
     if (!command_regs_base)
         goto fail;
 
@@ -2139,8 +2326,14 @@ dc1394_camera_new_unit (dc1394_t * d, uint64_t guid, int unit)
     camera->vendor_id = info->vendor_id;
     camera->model_id = info->model_id;
 
-    camera->vendor = get_leaf_string (pcam, disp, vendor_name_offset);
-    camera->model = get_leaf_string (pcam, disp, model_name_offset);
+    if (cached) {
+        camera->vendor = pc.vendor;
+        camera->model = pc.model;
+    }
+    else {
+        camera->vendor = get_leaf_string (pcam, disp, vendor_name_offset);
+        camera->model = get_leaf_string (pcam, disp, model_name_offset);
+    }
 
     if (camera->unit_spec_ID == 0xA02D) {
         if (info->unit_sw_version == 0x100)
@@ -2159,11 +2352,23 @@ dc1394_camera_new_unit (dc1394_t * d, uint64_t guid, int unit)
         camera->iidc_version = DC1394_IIDC_VERSION_PTGREY;
 
     disp->camera_set_parent (cpriv->pcam, camera);
+    if (cache_path) {
+        cpriv->cache_path = cache_path;
+        memcpy (cpriv->cache_rom, rom, sizeof rom);
+        persistent_cache_attach (camera, cached ? &pc : NULL);
+    }
     update_camera_info (camera);
 
     return camera;
 
  fail:
+    if (cached) {
+        free (pc.vendor);
+        free (pc.model);
+        free (pc.offsets);
+        free (pc.values);
+    }
+    free (cache_path);
     disp->camera_free (pcam);
     return NULL;
 }
@@ -2183,10 +2388,20 @@ dc1394_camera_free(dc1394camera_t *camera)
 {
     dc1394camera_priv_t * cpriv = DC1394_CAMERA_PRIV (camera);
 
+    if (cpriv->callback)
+        dc1394_capture_stop_callback (camera);
+
     if (cpriv->iso_persist!=1)
         dc1394_iso_release_all(camera);
 
+    if (cpriv->cache_path) {
+        persistent_cache_save (camera);
+        free (cpriv->cache_path);
+    }
+
     cpriv->platform->dispatch->camera_free (cpriv->pcam);
+    capture_frames_free (camera);
+    free (cpriv->register_cache);
     free (camera->vendor);
     free (camera->model);
     free (camera);
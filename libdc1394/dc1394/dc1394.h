@@ -53,5 +53,11 @@
 #include <dc1394/register.h>
 #include <dc1394/video.h>
 #include <dc1394/utils.h>
+#include <dc1394/broadcast.h>
+#include <dc1394/group.h>
+#include <dc1394/eventloop.h>
+#include <dc1394/recorder.h>
+#include <dc1394/container.h>
+#include <dc1394/snapshot.h>
 
 #endif
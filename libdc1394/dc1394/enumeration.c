@@ -242,19 +242,32 @@ free_enumeration (dc1394_t * d)
     d->cameras = NULL;
 }
 
+static void
+get_device_list (void * arg, int i)
+{
+    platform_info_t * p = (platform_info_t *) arg + i;
+
+    if (!p->p)
+        return;
+    dc1394_log_debug("Enumerating platform %s", p->name);
+    p->device_list = p->dispatch->get_device_list (p->p);
+}
+
 int
 refresh_enumeration (dc1394_t * d)
 {
     free_enumeration (d);
 
+    /* The platforms look for their devices at the same time, and the
+       cameras are then listed in the order of the platforms */
     dc1394_log_debug ("Enumerating cameras...");
+    parallel_for (d->num_platforms, get_device_list, d->platforms);
+
     int i;
     for (i = 0; i < d->num_platforms; i++) {
         platform_info_t * p = d->platforms + i;
         if (!p->p)
             continue;
-        dc1394_log_debug("Enumerating platform %s", p->name);
-        p->device_list = p->dispatch->get_device_list (p->p);
         if (!p->device_list) {
             dc1394_log_warning("Platform %s failed to get device list",
                     p->name);
@@ -277,7 +290,9 @@ refresh_enumeration (dc1394_t * d)
 dc1394error_t
 dc1394_camera_enumerate (dc1394_t * d, dc1394camera_list_t **list)
 {
-    if (refresh_enumeration (d) < 0)
+    /* While hotplug is on, the list is kept up to date as devices come
+       and go */
+    if (!d->hotplug && refresh_enumeration (d) < 0)
         return DC1394_FAILURE;
 
     dc1394camera_list_t * l;
@@ -311,3 +326,129 @@ dc1394_camera_free_list (dc1394camera_list_t *list)
     free (list);
 }
 
+
+/* Platform a device comes from, for the monitor callbacks */
+typedef struct {
+    dc1394_t * d;
+    platform_info_t * p;
+} hotplug_context_t;
+
+static void
+hotplug_added (void * arg, platform_device_t * dev)
+{
+    hotplug_context_t * ctx = arg;
+    dc1394_t * d = ctx->d;
+    int i, n = d->num_cameras;
+
+    if (identify_camera (d, ctx->p, dev) < 0)
+        return;
+    for (i = n; i < d->num_cameras; i++) {
+        dc1394camera_id_t id = { d->cameras[i].unit, d->cameras[i].guid };
+        dc1394_log_debug ("Hotplug: camera %"PRIx64":%d added",
+                id.guid, id.unit);
+        if (d->hotplug_added)
+            d->hotplug_added (d, &id, d->hotplug_data);
+    }
+}
+
+static void
+hotplug_removed (void * arg, platform_device_t * dev)
+{
+    hotplug_context_t * ctx = arg;
+    dc1394_t * d = ctx->d;
+    int i = 0;
+
+    while (i < d->num_cameras) {
+        if (d->cameras[i].device != dev) {
+            i++;
+            continue;
+        }
+        dc1394camera_id_t id = { d->cameras[i].unit, d->cameras[i].guid };
+        dc1394_log_debug ("Hotplug: camera %"PRIx64":%d removed",
+                id.guid, id.unit);
+        if (d->hotplug_removed)
+            d->hotplug_removed (d, &id, d->hotplug_data);
+        destroy_camera_info (d->cameras + i);
+        memmove (d->cameras + i, d->cameras + i + 1,
+                (d->num_cameras - i - 1) * sizeof (camera_info_t));
+        d->num_cameras--;
+    }
+}
+
+dc1394error_t
+dc1394_hotplug_start (dc1394_t * d, dc1394hotplug_callback_t added,
+        dc1394hotplug_callback_t removed, void * user_data, int * fd)
+{
+    platform_info_t * p = NULL;
+    int i, monitor_fd = -1;
+
+    if (d->hotplug)
+        dc1394_hotplug_stop (d);
+
+    /* The monitor starts before the devices are listed, so that none can
+       come or go unnoticed in between */
+    for (i = 0; i < d->num_platforms; i++) {
+        p = d->platforms + i;
+        if (p->p && p->dispatch->monitor_start &&
+                (monitor_fd = p->dispatch->monitor_start (p->p)) >= 0)
+            break;
+    }
+    if (monitor_fd < 0) {
+        dc1394_log_debug ("Hotplug: no platform can watch for devices");
+        return DC1394_FUNCTION_NOT_SUPPORTED;
+    }
+    dc1394_log_debug ("Hotplug: platform %s watching for devices", p->name);
+
+    if (refresh_enumeration (d) < 0) {
+        p->dispatch->monitor_stop (p->p);
+        return DC1394_FAILURE;
+    }
+
+    d->hotplug = p;
+    d->hotplug_added = added;
+    d->hotplug_removed = removed;
+    d->hotplug_data = user_data;
+    if (fd)
+        *fd = monitor_fd;
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_hotplug_process (dc1394_t * d)
+{
+    platform_info_t * p = d->hotplug;
+    hotplug_context_t ctx = { d, p };
+
+    if (!p)
+        return DC1394_FUNCTION_NOT_SUPPORTED;
+
+    /* Nothing to update if the platform failed to list its devices: look
+       for them again */
+    if (!p->device_list) {
+        int i, n = d->num_cameras;
+
+        p->device_list = p->dispatch->get_device_list (p->p);
+        if (!p->device_list)
+            return DC1394_FAILURE;
+        for (i = 0; i < p->device_list->num_devices; i++)
+            hotplug_added (&ctx, p->device_list->devices[i]);
+        dc1394_log_debug ("Hotplug: %d camera(s) found on %s",
+                d->num_cameras - n, p->name);
+    }
+
+    p->dispatch->monitor_update (p->p, p->device_list, hotplug_added,
+            hotplug_removed, &ctx);
+    return DC1394_SUCCESS;
+}
+
+void
+dc1394_hotplug_stop (dc1394_t * d)
+{
+    if (!d->hotplug)
+        return;
+    d->hotplug->dispatch->monitor_stop (d->hotplug->p);
+    d->hotplug = NULL;
+    d->hotplug_added = NULL;
+    d->hotplug_removed = NULL;
+    d->hotplug_data = NULL;
+}
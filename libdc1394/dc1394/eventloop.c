@@ -0,0 +1,466 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Frame delivery for many cameras from a few threads
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "eventloop.h"
+#include "internal.h"
+
+#if defined HAVE_SYS_EPOLL_H && defined HAVE_PTHREAD_H
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+
+/* The epoll data of a camera is its slot, with the generation of the
+ * camera in the slot in the upper half so that an event picked up just
+ * before a camera was removed cannot be taken for the next one. */
+#define STOP_KEY UINT64_MAX
+#define WAKE_KEY (UINT64_MAX - 1)
+
+struct loop_camera {
+    dc1394camera_t * camera;
+    dc1394capture_callback_t handler;
+    void * user_data;
+    int fd;
+    uint32_t slot;
+    uint32_t generation;
+    /* A thread is delivering its frames, or it is being removed */
+    int busy;
+    int removing;
+    /* Waiting in the ready queue of the loop */
+    int queued;
+    struct loop_camera * next;
+};
+
+struct __dc1394eventloop_t {
+    int epoll_fd;
+    int stop_pipe[2];
+    /* Tells the threads that the ready queue is not empty */
+    int wake_pipe[2];
+    uint32_t budget;
+
+    pthread_t * threads;
+    uint32_t num_threads;
+
+    /* Protects the slots and the state of the cameras in them */
+    pthread_mutex_t mutex;
+    pthread_cond_t idle;
+    struct loop_camera ** slots;
+    uint32_t num_slots;
+    uint32_t generation;
+
+    /* Cameras to service, in turn. The capture fd of a camera that used up
+     * its budget may not become readable again for the frames it still
+     * has, so it is queued here instead of going back to epoll. */
+    struct loop_camera * ready_head;
+    struct loop_camera * ready_tail;
+};
+
+/* Puts a camera back in the epoll set.  If frames are still waiting, this
+ * queues it again behind the cameras that are already ready. */
+static int
+arm_camera (dc1394eventloop_t * loop, uint32_t slot, int op)
+{
+    struct loop_camera * c = loop->slots[slot];
+    struct epoll_event ev = {
+        .events = EPOLLIN | EPOLLET | EPOLLONESHOT,
+        .data.u64 = (uint64_t) c->generation << 32 | slot,
+    };
+
+    return epoll_ctl (loop->epoll_fd, op, c->fd, &ev);
+}
+
+/* Called with the mutex held */
+static void
+queue_camera (dc1394eventloop_t * loop, struct loop_camera * c)
+{
+    c->queued = 1;
+    c->next = NULL;
+    if (loop->ready_tail)
+        loop->ready_tail->next = c;
+    else
+        loop->ready_head = c;
+    loop->ready_tail = c;
+}
+
+static struct loop_camera *
+dequeue_camera (dc1394eventloop_t * loop)
+{
+    struct loop_camera * c = loop->ready_head;
+
+    if (!c)
+        return NULL;
+    loop->ready_head = c->next;
+    if (!loop->ready_head)
+        loop->ready_tail = NULL;
+    c->queued = 0;
+    c->next = NULL;
+    return c;
+}
+
+static void
+unqueue_camera (dc1394eventloop_t * loop, struct loop_camera * c)
+{
+    struct loop_camera ** p = &loop->ready_head;
+
+    if (!c->queued)
+        return;
+    while (*p != c)
+        p = &(*p)->next;
+    *p = c->next;
+    if (loop->ready_tail == c) {
+        struct loop_camera * last = loop->ready_head;
+        while (last && last->next)
+            last = last->next;
+        loop->ready_tail = last;
+    }
+    c->queued = 0;
+    c->next = NULL;
+}
+
+/* Delivers at most budget frames of a camera. Returns nonzero if the budget
+ * was used up, in which case more frames may be waiting. */
+static int
+service_camera (dc1394eventloop_t * loop, struct loop_camera * c)
+{
+    uint32_t i;
+
+    for (i = 0; i < loop->budget; i++) {
+        dc1394video_frame_t * frame;
+
+        if (dc1394_capture_dequeue (c->camera, DC1394_CAPTURE_POLICY_POLL,
+                    &frame) != DC1394_SUCCESS) {
+            dc1394_log_error ("Event loop failed to dequeue a frame");
+            /* The backend may still hand out a frame in error */
+            if (frame)
+                dc1394_capture_enqueue (c->camera, frame);
+            return 0;
+        }
+        if (!frame)
+            return 0;
+
+        c->handler (c->camera, frame, c->user_data);
+
+        /* The frame is requeued unless the handler kept it */
+        if (dc1394_frame_unref (frame) != DC1394_SUCCESS) {
+            dc1394_log_error ("Event loop failed to requeue a frame");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void *
+loop_thread (void * arg)
+{
+    dc1394eventloop_t * loop = arg;
+
+    while (1) {
+        struct loop_camera * c = NULL;
+        struct epoll_event ev;
+        uint32_t slot, generation;
+        int n, timeout, more;
+        char buf[16];
+
+        /* Only peek at epoll while cameras are waiting in the ready queue,
+         * so that they are serviced even if no fd becomes readable */
+        pthread_mutex_lock (&loop->mutex);
+        timeout = loop->ready_head ? 0 : -1;
+        pthread_mutex_unlock (&loop->mutex);
+
+        /* One event at a time, so that ready cameras are spread over all
+         * the threads instead of being batched on one */
+        n = epoll_wait (loop->epoll_fd, &ev, 1, timeout);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            dc1394_log_error ("Event loop epoll_wait() failed: %s",
+                    strerror (errno));
+            break;
+        }
+        if (n == 1 && ev.data.u64 == STOP_KEY)
+            break;
+
+        pthread_mutex_lock (&loop->mutex);
+        if (n == 1 && ev.data.u64 == WAKE_KEY) {
+            while (read (loop->wake_pipe[0], buf, sizeof buf) > 0)
+                ;
+        }
+        else if (n == 1) {
+            /* A camera whose fd became readable takes its turn after the
+             * ones already waiting */
+            slot = ev.data.u64 & 0xffffffff;
+            generation = ev.data.u64 >> 32;
+            if (slot < loop->num_slots)
+                c = loop->slots[slot];
+            if (c && c->generation == generation && !c->busy &&
+                    !c->removing && !c->queued)
+                queue_camera (loop, c);
+        }
+        c = dequeue_camera (loop);
+        if (!c) {
+            pthread_mutex_unlock (&loop->mutex);
+            continue;
+        }
+        c->busy = 1;
+        pthread_mutex_unlock (&loop->mutex);
+
+        more = service_camera (loop, c);
+
+        pthread_mutex_lock (&loop->mutex);
+        c->busy = 0;
+        if (c->removing)
+            pthread_cond_broadcast (&loop->idle);
+        else if (more) {
+            queue_camera (loop, c);
+            if (loop->num_threads > 1 &&
+                    write (loop->wake_pipe[1], "x", 1) < 0 && errno != EAGAIN)
+                dc1394_log_error ("Event loop failed to wake its threads: %s",
+                        strerror (errno));
+        }
+        else if (arm_camera (loop, c->slot, EPOLL_CTL_MOD) < 0)
+            dc1394_log_error ("Event loop failed to rearm a camera: %s",
+                    strerror (errno));
+        pthread_mutex_unlock (&loop->mutex);
+    }
+
+    return NULL;
+}
+
+dc1394eventloop_t *
+dc1394_eventloop_new (uint32_t num_threads, uint32_t budget)
+{
+    dc1394eventloop_t * loop;
+    struct epoll_event ev = {
+        .events = EPOLLIN,
+        .data.u64 = STOP_KEY,
+    };
+    struct epoll_event wake = {
+        .events = EPOLLIN,
+        .data.u64 = WAKE_KEY,
+    };
+
+    loop = calloc (1, sizeof (dc1394eventloop_t));
+    if (!loop)
+        return NULL;
+    loop->budget = budget ? budget : 4;
+    loop->stop_pipe[0] = loop->stop_pipe[1] = -1;
+    loop->wake_pipe[0] = loop->wake_pipe[1] = -1;
+    pthread_mutex_init (&loop->mutex, NULL);
+    pthread_cond_init (&loop->idle, NULL);
+
+    loop->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0 || pipe (loop->stop_pipe) < 0)
+        goto fail;
+    /* Level triggered: stopping wakes all the threads up */
+    if (epoll_ctl (loop->epoll_fd, EPOLL_CTL_ADD, loop->stop_pipe[0], &ev) < 0)
+        goto fail;
+    if (pipe (loop->wake_pipe) < 0 ||
+            fcntl (loop->wake_pipe[0], F_SETFL, O_NONBLOCK) < 0 ||
+            fcntl (loop->wake_pipe[1], F_SETFL, O_NONBLOCK) < 0 ||
+            epoll_ctl (loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_pipe[0],
+                &wake) < 0)
+        goto fail;
+
+    if (num_threads == 0)
+        num_threads = 1;
+    loop->threads = calloc (num_threads, sizeof (pthread_t));
+    if (!loop->threads)
+        goto fail;
+    for (loop->num_threads = 0; loop->num_threads < num_threads;
+            loop->num_threads++) {
+        if (pthread_create (loop->threads + loop->num_threads, NULL,
+                    loop_thread, loop) != 0) {
+            dc1394_log_error ("Failed to launch an event loop thread");
+            goto fail;
+        }
+    }
+    return loop;
+
+ fail:
+    dc1394_eventloop_free (loop);
+    return NULL;
+}
+
+void
+dc1394_eventloop_free (dc1394eventloop_t * loop)
+{
+    uint32_t i;
+
+    if (!loop)
+        return;
+
+    if (loop->num_threads && write (loop->stop_pipe[1], "x", 1) != 1)
+        dc1394_log_error ("Failed to stop the event loop threads");
+    for (i = 0; i < loop->num_threads; i++)
+        pthread_join (loop->threads[i], NULL);
+
+    for (i = 0; i < loop->num_slots; i++)
+        free (loop->slots[i]);
+    free (loop->slots);
+    free (loop->threads);
+
+    if (loop->epoll_fd >= 0)
+        close (loop->epoll_fd);
+    if (loop->stop_pipe[0] >= 0) {
+        close (loop->stop_pipe[0]);
+        close (loop->stop_pipe[1]);
+    }
+    if (loop->wake_pipe[0] >= 0) {
+        close (loop->wake_pipe[0]);
+        close (loop->wake_pipe[1]);
+    }
+    pthread_cond_destroy (&loop->idle);
+    pthread_mutex_destroy (&loop->mutex);
+    free (loop);
+}
+
+dc1394error_t
+dc1394_eventloop_add_camera (dc1394eventloop_t * loop, dc1394camera_t * camera,
+        dc1394capture_callback_t handler, void * user_data)
+{
+    struct loop_camera * c;
+    uint32_t i, slot;
+    int fd;
+
+    if (!loop || !camera || !handler)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    if (DC1394_CAMERA_PRIV (camera)->callback)
+        return DC1394_CAPTURE_IS_RUNNING;
+
+    fd = dc1394_capture_get_fileno (camera);
+    if (fd < 0) {
+        dc1394_log_error ("Capture must be set up before adding a camera to an event loop");
+        return DC1394_CAPTURE_IS_NOT_SET;
+    }
+
+    c = calloc (1, sizeof (struct loop_camera));
+    if (!c)
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    c->camera = camera;
+    c->handler = handler;
+    c->user_data = user_data;
+    c->fd = fd;
+
+    pthread_mutex_lock (&loop->mutex);
+    slot = loop->num_slots;
+    for (i = 0; i < loop->num_slots; i++) {
+        if (loop->slots[i] && loop->slots[i]->camera == camera) {
+            pthread_mutex_unlock (&loop->mutex);
+            free (c);
+            return DC1394_INVALID_ARGUMENT_VALUE;
+        }
+        if (!loop->slots[i] && slot == loop->num_slots)
+            slot = i;
+    }
+    if (slot == loop->num_slots) {
+        struct loop_camera ** slots = realloc (loop->slots,
+                (loop->num_slots + 1) * sizeof (struct loop_camera *));
+        if (!slots) {
+            pthread_mutex_unlock (&loop->mutex);
+            free (c);
+            return DC1394_MEMORY_ALLOCATION_FAILURE;
+        }
+        loop->slots = slots;
+        loop->slots[loop->num_slots++] = NULL;
+    }
+
+    c->generation = ++loop->generation;
+    c->slot = slot;
+    loop->slots[slot] = c;
+    if (arm_camera (loop, slot, EPOLL_CTL_ADD) < 0) {
+        dc1394_log_error ("Failed to add a camera to an event loop: %s",
+                strerror (errno));
+        loop->slots[slot] = NULL;
+        pthread_mutex_unlock (&loop->mutex);
+        free (c);
+        return DC1394_FAILURE;
+    }
+    pthread_mutex_unlock (&loop->mutex);
+
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_eventloop_remove_camera (dc1394eventloop_t * loop,
+        dc1394camera_t * camera)
+{
+    struct loop_camera * c = NULL;
+    uint32_t i;
+
+    if (!loop || !camera)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    pthread_mutex_lock (&loop->mutex);
+    for (i = 0; i < loop->num_slots; i++) {
+        if (loop->slots[i] && loop->slots[i]->camera == camera) {
+            c = loop->slots[i];
+            break;
+        }
+    }
+    if (!c || c->removing) {
+        pthread_mutex_unlock (&loop->mutex);
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    }
+
+    c->removing = 1;
+    epoll_ctl (loop->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    unqueue_camera (loop, c);
+    while (c->busy)
+        pthread_cond_wait (&loop->idle, &loop->mutex);
+    loop->slots[i] = NULL;
+    pthread_mutex_unlock (&loop->mutex);
+
+    free (c);
+    return DC1394_SUCCESS;
+}
+
+#else
+
+dc1394eventloop_t *
+dc1394_eventloop_new (uint32_t num_threads, uint32_t budget)
+{
+    return NULL;
+}
+
+void
+dc1394_eventloop_free (dc1394eventloop_t * loop)
+{
+}
+
+dc1394error_t
+dc1394_eventloop_add_camera (dc1394eventloop_t * loop, dc1394camera_t * camera,
+        dc1394capture_callback_t handler, void * user_data)
+{
+    return DC1394_FUNCTION_NOT_SUPPORTED;
+}
+
+dc1394error_t
+dc1394_eventloop_remove_camera (dc1394eventloop_t * loop,
+        dc1394camera_t * camera)
+{
+    return DC1394_FUNCTION_NOT_SUPPORTED;
+}
+
+#endif
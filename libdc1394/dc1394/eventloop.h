@@ -0,0 +1,78 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Frame delivery for many cameras from a few threads
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __DC1394_EVENTLOOP_H__
+#define __DC1394_EVENTLOOP_H__
+
+/*! \file dc1394/eventloop.h
+    \brief Delivers the frames of many cameras from a fixed set of threads
+
+    An event loop watches the capture of any number of cameras and calls a handler for each of their frames, like
+    dc1394_capture_start_callback() does, but from a few threads shared by all cameras instead of one thread each. A
+    camera is serviced by one thread at a time, so its handler is never called concurrently, and its frames come in
+    capture order. Each turn delivers a bounded number of frames before the camera goes back at the end of the queue,
+    so that a fast camera cannot starve the others.
+
+    The capture fd of the cameras must be one that can be waited on: Linux juju and USB. Only available on Linux.
+*/
+
+#include <dc1394/log.h>
+#include <dc1394/video.h>
+#include <dc1394/capture.h>
+
+typedef struct __dc1394eventloop_t dc1394eventloop_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Creates an event loop and starts its threads.
+ * @param num_threads Number of delivery threads, one if zero.
+ * @param budget Number of frames delivered for a camera before servicing the next one, 4 if zero.
+ * @return The event loop, or NULL on failure.
+ */
+dc1394eventloop_t * dc1394_eventloop_new (uint32_t num_threads, uint32_t budget);
+
+/**
+ * Stops the threads of an event loop and frees it. The handlers that are running are waited for, and the cameras
+ * still in the loop are removed from it.
+ */
+void dc1394_eventloop_free (dc1394eventloop_t * loop);
+
+/**
+ * Adds a camera to an event loop, whose capture must be set up. From now on its frames are only delivered to handler,
+ * which is called from one of the threads of the loop. The frame goes back to the ring buffer when the handler
+ * returns, unless the handler keeps it with dc1394_frame_ref().
+ */
+dc1394error_t dc1394_eventloop_add_camera (dc1394eventloop_t * loop, dc1394camera_t * camera,
+                                           dc1394capture_callback_t handler, void * user_data);
+
+/**
+ * Removes a camera from an event loop, waiting for its handler to return if it is running. Must not be called from the
+ * handler of that camera.
+ */
+dc1394error_t dc1394_eventloop_remove_camera (dc1394eventloop_t * loop, dc1394camera_t * camera);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DC1394_EVENTLOOP_H__ */
@@ -671,6 +671,82 @@ dc1394_format7_get_color_filter(dc1394camera_t *camera, dc1394video_mode_t video
     return err;
 }
 
+/*==========================================================================
+ * Reads the registers of a mode in one block and decodes them like the
+ * dc1394_format7_get_* functions do. Fails when the camera rejects the
+ * block or does not have a valid packet size yet, so that the caller can
+ * fall back to reading the registers one by one.
+ *==========================================================================*/
+static dc1394error_t
+format7_get_mode_info_block(dc1394camera_t *camera, dc1394video_mode_t video_mode,
+                            dc1394format7mode_t *f7_mode)
+{
+    dc1394error_t err;
+    uint32_t csr[REG_CAMERA_FORMAT7_COLOR_FILTER_ID / 4 + 1];
+    uint32_t first, num, value;
+    int i;
+
+    if (camera->iidc_version >= DC1394_IIDC_VERSION_1_31)
+        num = REG_CAMERA_FORMAT7_COLOR_FILTER_ID / 4 + 1;
+    else if (camera->iidc_version >= DC1394_IIDC_VERSION_1_30)
+        num = REG_CAMERA_FORMAT7_UNIT_POSITION_INQ / 4 + 1;
+    else
+        num = REG_CAMERA_FORMAT7_BYTE_PER_PACKET / 4 + 1;
+
+    // 0x018 to 0x030 are reserved: read the registers on either side
+    first = REG_CAMERA_FORMAT7_PIXEL_NUMBER_INQ / 4;
+    err=get_format7_registers(camera, video_mode, 0, csr,
+                              REG_CAMERA_FORMAT7_COLOR_CODING_INQ / 4 + 1);
+    if (err!=DC1394_SUCCESS)
+        return err;
+    err=get_format7_registers(camera, video_mode, 4 * first, csr + first,
+                              num - first);
+    if (err!=DC1394_SUCCESS)
+        return err;
+
+#define F7(reg) csr[REG_CAMERA_FORMAT7_##reg / 4]
+    f7_mode->packet_size = F7(BYTE_PER_PACKET) >> 16;
+    if (f7_mode->packet_size==0)
+        return DC1394_FAILURE;
+
+    f7_mode->max_size_x = F7(MAX_IMAGE_SIZE_INQ) >> 16;
+    f7_mode->max_size_y = F7(MAX_IMAGE_SIZE_INQ) & 0xFFFF;
+    f7_mode->unit_size_x = F7(UNIT_SIZE_INQ) >> 16;
+    f7_mode->unit_size_y = F7(UNIT_SIZE_INQ) & 0xFFFF;
+    if (camera->iidc_version >= DC1394_IIDC_VERSION_1_30)
+        value = F7(UNIT_POSITION_INQ);
+    else
+        value = F7(UNIT_SIZE_INQ);
+    f7_mode->unit_pos_x = value >> 16;
+    f7_mode->unit_pos_y = value & 0xFFFF;
+    f7_mode->pos_x = F7(IMAGE_POSITION) >> 16;
+    f7_mode->pos_y = F7(IMAGE_POSITION) & 0xFFFF;
+    f7_mode->size_x = F7(IMAGE_SIZE) >> 16;
+    f7_mode->size_y = F7(IMAGE_SIZE) & 0xFFFF;
+    f7_mode->unit_packet_size = F7(PACKET_PARA_INQ) >> 16;
+    f7_mode->max_packet_size = F7(PACKET_PARA_INQ) & 0xFFFF;
+    f7_mode->pixnum = F7(PIXEL_NUMBER_INQ);
+    f7_mode->total_bytes = (uint64_t) F7(TOTAL_BYTES_HI_INQ) << 32 |
+        F7(TOTAL_BYTES_LO_INQ);
+    f7_mode->color_coding = (F7(COLOR_CODING_ID) >> 24) + DC1394_COLOR_CODING_MIN;
+
+    f7_mode->color_codings.num=0;
+    for (i=0;i<DC1394_COLOR_CODING_NUM;i++) {
+        if (F7(COLOR_CODING_INQ) & (0x1 << (31-i))) {
+            f7_mode->color_codings.codings[f7_mode->color_codings.num]=i+DC1394_COLOR_CODING_MIN;
+            f7_mode->color_codings.num++;
+        }
+    }
+
+    if (camera->iidc_version >= DC1394_IIDC_VERSION_1_31)
+        f7_mode->color_filter = (F7(COLOR_FILTER_ID) >> 24) + DC1394_COLOR_FILTER_MIN;
+    else
+        f7_mode->color_filter = 0;
+#undef F7
+
+    return DC1394_SUCCESS;
+}
+
 dc1394error_t
 dc1394_format7_get_mode_info(dc1394camera_t *camera, dc1394video_mode_t video_mode, dc1394format7mode_t *f7_mode)
 {
@@ -679,6 +755,10 @@ dc1394_format7_get_mode_info(dc1394camera_t *camera, dc1394video_mode_t video_mo
     if (!dc1394_is_video_mode_scalable(video_mode))
         return DC1394_INVALID_VIDEO_MODE;
 
+    if (f7_mode->present>0 &&
+        format7_get_mode_info_block(camera, video_mode, f7_mode)==DC1394_SUCCESS)
+        return DC1394_SUCCESS;
+
     if (f7_mode->present>0) { // check for mode presence before query
         err=dc1394_format7_get_max_image_size(camera,video_mode,&f7_mode->max_size_x,&f7_mode->max_size_y);
         DC1394_ERR_RTN(err,"Got a problem querying format7 max image size");
@@ -0,0 +1,423 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Synchronized capture from several cameras
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "group.h"
+#include "internal.h"
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#elif defined HAVE_POLL_H
+#include <poll.h>
+#endif
+
+struct group_camera {
+    dc1394camera_t * camera;
+    int fd;
+    /* Whether waiting on fd waits for a frame, see
+     * capture_fileno_pollable() */
+    int pollable;
+    /* Oldest frame of the camera that is not part of a set yet */
+    dc1394video_frame_t * pending;
+    uint64_t key;
+    uint64_t sequence;
+    int armed;
+};
+
+struct __dc1394group_t {
+    dc1394group_match_t match;
+    uint64_t window;
+    uint64_t timeout;
+    uint64_t orphans;
+
+    struct group_camera * cameras;
+    uint32_t num_cameras;
+#ifdef HAVE_SYS_EPOLL_H
+    int epoll_fd;
+#endif
+};
+
+static uint64_t
+now_us (void)
+{
+    struct timeval tv;
+
+    gettimeofday (&tv, NULL);
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+dc1394group_t *
+dc1394_group_new (dc1394group_match_t match, uint64_t window,
+        uint64_t timeout)
+{
+    dc1394group_t * group;
+
+    if (match < DC1394_GROUP_MATCH_MIN || match > DC1394_GROUP_MATCH_MAX)
+        return NULL;
+
+    group = calloc (1, sizeof (dc1394group_t));
+    if (!group)
+        return NULL;
+    group->match = match;
+    group->window = match == DC1394_GROUP_MATCH_TIMESTAMP ? window : 0;
+    group->timeout = timeout;
+
+#ifdef HAVE_SYS_EPOLL_H
+    group->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+    if (group->epoll_fd < 0) {
+        dc1394_log_error ("Failed to create the epoll fd of a camera group");
+        free (group);
+        return NULL;
+    }
+#endif
+    return group;
+}
+
+/* Gives a frame that belongs to no set back to its camera */
+static void
+drop_pending (dc1394group_t * group, struct group_camera * c)
+{
+    dc1394_capture_enqueue (c->camera, c->pending);
+    c->pending = NULL;
+    group->orphans++;
+}
+
+void
+dc1394_group_free (dc1394group_t * group)
+{
+    uint32_t i;
+
+    if (!group)
+        return;
+
+    for (i = 0; i < group->num_cameras; i++) {
+        if (group->cameras[i].pending)
+            dc1394_capture_enqueue (group->cameras[i].camera,
+                    group->cameras[i].pending);
+    }
+#ifdef HAVE_SYS_EPOLL_H
+    close (group->epoll_fd);
+#endif
+    free (group->cameras);
+    free (group);
+}
+
+dc1394error_t
+dc1394_group_add_camera (dc1394group_t * group, dc1394camera_t * camera)
+{
+    struct group_camera * cameras;
+    uint32_t i;
+    int fd;
+
+    if (!group || !camera)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    for (i = 0; i < group->num_cameras; i++) {
+        if (group->cameras[i].camera == camera)
+            return DC1394_INVALID_ARGUMENT_VALUE;
+    }
+
+    fd = dc1394_capture_get_fileno (camera);
+    if (fd < 0) {
+        dc1394_log_error ("Capture must be set up before adding a camera to a group");
+        return DC1394_CAPTURE_IS_NOT_SET;
+    }
+
+    cameras = realloc (group->cameras,
+            (group->num_cameras + 1) * sizeof (struct group_camera));
+    if (!cameras)
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    group->cameras = cameras;
+
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event ev = {
+        .events = EPOLLIN,
+        .data.u32 = group->num_cameras,
+    };
+    if (epoll_ctl (group->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        dc1394_log_error ("Failed to add a camera to the group epoll fd");
+        return DC1394_FAILURE;
+    }
+#endif
+
+    cameras[group->num_cameras] = (struct group_camera) {
+        .camera = camera,
+        .fd = fd,
+        .pollable = capture_fileno_pollable (camera),
+        .armed = 1,
+    };
+    group->num_cameras++;
+    return DC1394_SUCCESS;
+}
+
+/* Dequeues a frame from every camera that has none pending, without
+ * waiting.  got is the number of frames dequeued. */
+static dc1394error_t
+fill_pending (dc1394group_t * group, int * got)
+{
+    uint32_t i;
+
+    *got = 0;
+    for (i = 0; i < group->num_cameras; i++) {
+        struct group_camera * c = group->cameras + i;
+        dc1394video_frame_t * frame;
+        dc1394error_t err;
+
+        if (c->pending)
+            continue;
+        err = dc1394_capture_dequeue (c->camera, DC1394_CAPTURE_POLICY_POLL,
+                &frame);
+        if (err != DC1394_SUCCESS) {
+            /* The backend may still hand out a frame in error */
+            if (frame)
+                dc1394_capture_enqueue (c->camera, frame);
+            return err;
+        }
+        if (!frame)
+            continue;
+
+        c->pending = frame;
+        c->key = group->match == DC1394_GROUP_MATCH_TIMESTAMP ?
+            frame->timestamp : c->sequence;
+        c->sequence++;
+        (*got)++;
+    }
+    return DC1394_SUCCESS;
+}
+
+/* Once every camera has a frame pending: returns 1 if they make a set,
+ * otherwise drops those that are too old to ever be part of one. */
+static int
+match_pending (dc1394group_t * group)
+{
+    uint64_t newest = 0, oldest = UINT64_MAX;
+    uint32_t i;
+
+    for (i = 0; i < group->num_cameras; i++) {
+        uint64_t key = group->cameras[i].key;
+        if (key > newest)
+            newest = key;
+        if (key < oldest)
+            oldest = key;
+    }
+    if (newest - oldest <= group->window)
+        return 1;
+
+    for (i = 0; i < group->num_cameras; i++) {
+        if (group->cameras[i].key + group->window < newest)
+            drop_pending (group, group->cameras + i);
+    }
+    return 0;
+}
+
+/* Builds a set out of the pending frames that match the most recent one,
+ * and drops the others.  Returns NULL if no frame is pending. */
+static dc1394frameset_t *
+make_set (dc1394group_t * group, dc1394error_t * err)
+{
+    dc1394frameset_t * set;
+    uint64_t newest = 0;
+    uint32_t i, count = 0;
+
+    for (i = 0; i < group->num_cameras; i++) {
+        if (group->cameras[i].pending && group->cameras[i].key >= newest)
+            newest = group->cameras[i].key;
+    }
+
+    for (i = 0; i < group->num_cameras; i++) {
+        struct group_camera * c = group->cameras + i;
+        if (c->pending && c->key + group->window < newest)
+            drop_pending (group, c);
+        else if (c->pending)
+            count++;
+    }
+    if (count == 0)
+        return NULL;
+
+    /* The frame pointers are allocated along with the set */
+    set = calloc (1, sizeof (dc1394frameset_t) +
+            group->num_cameras * sizeof (dc1394video_frame_t *));
+    if (!set) {
+        *err = DC1394_MEMORY_ALLOCATION_FAILURE;
+        return NULL;
+    }
+    set->num_cameras = group->num_cameras;
+    set->frames = (dc1394video_frame_t **) (set + 1);
+    set->complete = count == group->num_cameras ? DC1394_TRUE : DC1394_FALSE;
+
+    for (i = 0; i < group->num_cameras; i++) {
+        struct group_camera * c = group->cameras + i;
+        if (!c->pending)
+            continue;
+        if (c->pending->timestamp > set->timestamp)
+            set->timestamp = c->pending->timestamp;
+        set->frames[i] = c->pending;
+        c->pending = NULL;
+    }
+    return set;
+}
+
+/* Waits until a camera without a pending frame has something to dequeue.
+ * Returns 0 on timeout, -1 on error.  timeout is in milliseconds, -1 to
+ * wait forever. */
+static int
+wait_cameras (dc1394group_t * group, int timeout)
+{
+    uint32_t i;
+
+    /* Cameras that cannot be waited on are checked every millisecond */
+    for (i = 0; i < group->num_cameras; i++) {
+        if (!group->cameras[i].pending && !group->cameras[i].pollable &&
+                (timeout < 0 || timeout > 1))
+            timeout = 1;
+    }
+
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event events[16];
+    int n;
+
+    /* Only wait on the cameras whose frame is missing: the others may
+     * well have more frames queued */
+    for (i = 0; i < group->num_cameras; i++) {
+        struct group_camera * c = group->cameras + i;
+        int want = c->pending == NULL && c->pollable;
+        struct epoll_event ev = {
+            .events = want ? EPOLLIN : 0,
+            .data.u32 = i,
+        };
+
+        if (want == c->armed)
+            continue;
+        if (epoll_ctl (group->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev) < 0)
+            return -1;
+        c->armed = want;
+    }
+
+    do
+        n = epoll_wait (group->epoll_fd, events, 16, timeout);
+    while (n < 0 && errno == EINTR);
+    return n;
+#elif defined HAVE_POLL_H
+    struct pollfd fds[group->num_cameras];
+    nfds_t nfds = 0;
+    int n;
+
+    for (i = 0; i < group->num_cameras; i++) {
+        if (group->cameras[i].pending || !group->cameras[i].pollable)
+            continue;
+        fds[nfds].fd = group->cameras[i].fd;
+        fds[nfds].events = POLLIN;
+        nfds++;
+    }
+
+    do
+        n = poll (fds, nfds, timeout);
+    while (n < 0 && errno == EINTR);
+    return n;
+#else
+    usleep (1000);
+    return 1;
+#endif
+}
+
+dc1394error_t
+dc1394_group_dequeue (dc1394group_t * group, dc1394capture_policy_t policy,
+        dc1394frameset_t ** set)
+{
+    dc1394error_t err = DC1394_SUCCESS;
+    uint64_t deadline = 0;
+
+    if ((policy < DC1394_CAPTURE_POLICY_MIN)
+            || (policy > DC1394_CAPTURE_POLICY_MAX))
+        return DC1394_INVALID_CAPTURE_POLICY;
+
+    *set = NULL;
+    if (!group || group->num_cameras == 0)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    if (policy == DC1394_CAPTURE_POLICY_WAIT && group->timeout)
+        deadline = now_us () + group->timeout;
+
+    while (1) {
+        uint32_t i, missing = 0;
+        int got, timeout = -1;
+
+        err = fill_pending (group, &got);
+        if (err != DC1394_SUCCESS)
+            return err;
+
+        for (i = 0; i < group->num_cameras; i++) {
+            if (!group->cameras[i].pending)
+                missing++;
+        }
+        if (missing == 0) {
+            if (match_pending (group))
+                break;
+            /* Try again with the next frames of the dropped cameras */
+            continue;
+        }
+        if (policy == DC1394_CAPTURE_POLICY_POLL)
+            return DC1394_SUCCESS;
+
+        if (deadline) {
+            uint64_t now = now_us ();
+            if (now >= deadline)
+                break;
+            timeout = (deadline - now + 999) / 1000;
+        }
+
+        if (wait_cameras (group, timeout) < 0) {
+            dc1394_log_error ("Failed to wait for the cameras of a group");
+            return DC1394_FAILURE;
+        }
+    }
+
+    *set = make_set (group, &err);
+    return err;
+}
+
+dc1394error_t
+dc1394_group_enqueue (dc1394group_t * group, dc1394frameset_t * set)
+{
+    dc1394error_t err = DC1394_SUCCESS;
+    uint32_t i;
+
+    if (!group || !set)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    for (i = 0; i < set->num_cameras; i++) {
+        dc1394video_frame_t * frame = set->frames[i];
+        if (frame && dc1394_capture_enqueue (frame->camera, frame) !=
+                DC1394_SUCCESS)
+            err = DC1394_FAILURE;
+    }
+    free (set);
+    return err;
+}
+
+uint64_t
+dc1394_group_get_orphans (dc1394group_t * group)
+{
+    return group->orphans;
+}
@@ -0,0 +1,104 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Synchronized capture from several cameras
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __DC1394_GROUP_H__
+#define __DC1394_GROUP_H__
+
+/*! \file dc1394/group.h
+    \brief Dequeues matching frames from several cameras at once
+
+    A camera group waits on the capture of all its cameras and hands out frame sets: one frame per camera, taken at the
+    same trigger. Frames that cannot be part of a set (a camera dropped the matching frame, or delivered it too late)
+    are requeued by the group itself. This is meant for externally triggered cameras, e.g. stereo or multi-view rigs.
+*/
+
+#include <dc1394/log.h>
+#include <dc1394/video.h>
+#include <dc1394/capture.h>
+
+/**
+ * How the frames of a set are matched
+ */
+typedef enum {
+    DC1394_GROUP_MATCH_TIMESTAMP=864,
+    DC1394_GROUP_MATCH_SEQUENCE
+} dc1394group_match_t;
+#define DC1394_GROUP_MATCH_MIN    DC1394_GROUP_MATCH_TIMESTAMP
+#define DC1394_GROUP_MATCH_MAX    DC1394_GROUP_MATCH_SEQUENCE
+#define DC1394_GROUP_MATCH_NUM   (DC1394_GROUP_MATCH_MAX - DC1394_GROUP_MATCH_MIN + 1)
+
+/**
+ * A set of frames, one per camera of the group in the order the cameras were added
+ */
+typedef struct {
+    uint32_t                 num_cameras;
+    dc1394video_frame_t   ** frames;        /* NULL for the cameras missing from an incomplete set */
+    dc1394bool_t             complete;
+    uint64_t                 timestamp;     /* of the most recent frame of the set */
+} dc1394frameset_t;
+
+typedef struct __dc1394group_t dc1394group_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Creates an empty camera group.
+ * @param match \a DC1394_GROUP_MATCH_TIMESTAMP: frames belong to the same set if their timestamps are at most window
+ *              microseconds apart. \a DC1394_GROUP_MATCH_SEQUENCE: the n-th frame of each camera belong to the same set,
+ *              which only holds as long as no camera drops frames; window is ignored.
+ * @param timeout How long dc1394_group_dequeue() waits for the missing frames of a set, in microseconds, before
+ *                returning it incomplete. Zero waits forever.
+ */
+dc1394group_t * dc1394_group_new (dc1394group_match_t match, uint64_t window, uint64_t timeout);
+
+/**
+ * Frees a camera group, requeuing the frames it still holds. The frame sets still dequeued must have been enqueued.
+ */
+void dc1394_group_free (dc1394group_t * group);
+
+/**
+ * Adds a camera to a group. The capture of the camera must be set up, and its frames must only be dequeued through
+ * the group from now on.
+ */
+dc1394error_t dc1394_group_add_camera (dc1394group_t * group, dc1394camera_t * camera);
+
+/**
+ * Gets the next frame set, waiting for it or not depending on policy. set is NULL if there is none yet. With
+ * DC1394_CAPTURE_POLICY_WAIT and a timeout, the set may come out incomplete.
+ */
+dc1394error_t dc1394_group_dequeue (dc1394group_t * group, dc1394capture_policy_t policy, dc1394frameset_t ** set);
+
+/**
+ * Requeues the frames of a set to their cameras and frees it.
+ */
+dc1394error_t dc1394_group_enqueue (dc1394group_t * group, dc1394frameset_t * set);
+
+/**
+ * Number of frames the group requeued because they did not match any set.
+ */
+uint64_t dc1394_group_get_orphans (dc1394group_t * group);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DC1394_GROUP_H__ */
@@ -25,6 +25,10 @@
 #include "log.h"
 #include "register.h"
 
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
 /*
   These arrays define how many image quadlets there
   are in a packet given a mode and a frame rate
@@ -288,3 +292,46 @@ capture_basic_setup (dc1394camera_t * camera, dc1394video_frame_t * frame)
     return DC1394_SUCCESS;
 }
 
+/* Most threads parallel_for runs, the calling one included */
+#define PARALLEL_MAX_THREADS 16
+
+typedef struct {
+    void (*fn) (void * arg, int i);
+    void * arg;
+    int n;
+    int next;
+} parallel_job_t;
+
+static void *
+parallel_worker (void * p)
+{
+    parallel_job_t * job = p;
+    int i;
+
+    while ((i = __atomic_fetch_add (&job->next, 1, __ATOMIC_RELAXED)) < job->n)
+        job->fn (job->arg, i);
+    return NULL;
+}
+
+/* Calls fn for i from 0 to n - 1, from several threads when there are
+ * any. Meant for calls that mostly wait on the bus or the kernel. */
+void
+parallel_for (int n, void (*fn) (void * arg, int i), void * arg)
+{
+    parallel_job_t job = { fn, arg, n, 0 };
+#ifdef HAVE_PTHREAD_H
+    pthread_t threads[PARALLEL_MAX_THREADS];
+    int i, num = 0;
+
+    for (i = 1; i < n && i < PARALLEL_MAX_THREADS; i++) {
+        if (pthread_create (&threads[num], NULL, parallel_worker, &job) != 0)
+            break;
+        num++;
+    }
+    parallel_worker (&job);
+    for (i = 0; i < num; i++)
+        pthread_join (threads[i], NULL);
+#else
+    parallel_worker (&job);
+#endif
+}
@@ -43,6 +43,25 @@ typedef struct _dc1394camera_priv_t {
     uint64_t allocated_channels;
     int allocated_bandwidth;
     int iso_persist;
+
+    dc1394capture_options_t capture_options;
+    struct _capture_callback_t * callback;
+    struct _capture_frames_t * frames;
+    struct _register_cache_t * register_cache;
+    /* Set once the camera has rejected a block read as a type or address
+     * error */
+    int no_block_reads;
+
+    int has_retry_policy;
+    dc1394retry_policy_t retry_policy;
+    /* State of the generator of the retry jitter, 0 until first used */
+    uint32_t retry_seed;
+    dc1394transaction_stats_t transaction_stats;
+
+    /* File of the persistent cache, and the start of the configuration ROM
+       it is valid for */
+    char * cache_path;
+    uint32_t cache_rom[5];
 } dc1394camera_priv_t;
 
 #define DC1394_CAMERA_PRIV(c) ((dc1394camera_priv_t *)c)
@@ -68,6 +87,15 @@ struct __dc1394_t {
 
     int num_cameras;
     camera_info_t * cameras;
+
+    /* Directory of the persistent cache, NULL if off */
+    char * cache_dir;
+
+    /* Platform watching for devices, see dc1394_hotplug_start() */
+    platform_info_t * hotplug;
+    dc1394hotplug_callback_t hotplug_added;
+    dc1394hotplug_callback_t hotplug_removed;
+    void * hotplug_data;
 };
 
 void juju_init(dc1394_t *d);
@@ -75,6 +103,7 @@ void linux_init(dc1394_t *d);
 void macosx_init(dc1394_t *d);
 void windows_init(dc1394_t *d);
 void dc1394_usb_init(dc1394_t *d);
+void dc1394_virtual_init(dc1394_t *d);
 
 void register_platform (dc1394_t * d, const platform_dispatch_t * dispatch,
         const char * name);
@@ -186,6 +215,105 @@ is_feature_bit_set(uint32_t value, uint32_t feature);
 dc1394bool_t
 _dc1394_iidc_check_video_mode(dc1394camera_t *camera, dc1394video_mode_t *mode);
 */
+/* Block reads of consecutive registers, see register.c */
+dc1394error_t get_registers_block (dc1394camera_t * camera, uint64_t offset,
+        uint32_t * value, uint32_t num_regs);
+dc1394error_t get_format7_registers (dc1394camera_t * camera,
+        dc1394video_mode_t mode, uint64_t offset, uint32_t * value,
+        uint32_t num_regs);
+dc1394error_t get_absolute_registers (dc1394camera_t * camera,
+        dc1394feature_t feature, uint64_t offset, uint32_t * value,
+        uint32_t num_regs);
+
+/* Number of quadlets in the register cache is 1 << REGISTER_CACHE_BITS. A
+ * camera has a few hundred cacheable registers, of which applications use a
+ * few dozens. */
+#define REGISTER_CACHE_BITS 9
+#define REGISTER_CACHE_SIZE (1 << REGISTER_CACHE_BITS)
+
+/* Contents of the register cache, for the persistent cache. The arrays
+   given to register_cache_export hold REGISTER_CACHE_SIZE values. */
+void register_cache_fill (dc1394camera_t * camera, const uint64_t * offsets,
+        const uint32_t * values, uint32_t num);
+uint32_t register_cache_export (dc1394camera_t * camera, uint64_t * offsets,
+        uint32_t * values, int * dirty);
+
+/* Feature registers read in blocks, see control.c */
+int feature_register_index (dc1394feature_t feature);
+dc1394error_t get_feature_registers (dc1394camera_t * camera,
+        uint32_t presence[2], uint32_t inquiry[64], uint32_t status[64]);
+
+/* Why a transaction is retried */
+typedef enum {
+    RETRY_BUSY,
+    RETRY_GENERATION,
+} retry_cause_t;
+
+/* Retries of platform transactions under the policy of the camera, see
+ * register.c. camera may be NULL when there is no camera yet, then
+ * default_retries attempts are made. retry_next returns the delay before
+ * the next attempt in microseconds, or -1 to give up. */
+void retry_begin (platform_retry_t * retry);
+uint64_t retry_now (void);
+int retry_next (dc1394camera_t * camera, platform_retry_t * retry,
+        retry_cause_t cause, int default_retries);
+
+/* Failed waits in a row after which a request still in flight is given up
+ * on and left allocated, see dc1394_request_wait() */
+#define REQUEST_MAX_POLL_FAILURES 16
+
 dc1394error_t capture_basic_setup (dc1394camera_t * camera, dc1394video_frame_t * frame);
 
+/* Capture ring and thread placement, see dc1394capture_options_t */
+#define CAPTURE_MAX_NUMA_NODES 1024
+
+typedef struct {
+    int changed;
+    int mode;
+    unsigned long mask[CAPTURE_MAX_NUMA_NODES / (8 * sizeof (unsigned long))];
+} capture_mempolicy_t;
+
+void * capture_alloc_buffer (dc1394camera_t * camera, size_t size,
+        size_t * alloc_size);
+void capture_free_buffer (void * buffer, size_t alloc_size);
+void capture_lock_buffer (dc1394camera_t * camera, void * buffer, size_t size);
+void capture_enter_numa_node (dc1394camera_t * camera,
+        capture_mempolicy_t * saved);
+void capture_leave_numa_node (capture_mempolicy_t * saved);
+void capture_frames_free (dc1394camera_t * camera);
+int capture_fileno_pollable (dc1394camera_t * camera);
+
+/* Recording container, see container.h */
+uint32_t container_crc32 (uint32_t crc, const void * data, size_t len);
+void container_fill_header (dc1394container_header_t * header);
+void container_fill_record (dc1394container_record_t * record,
+        const dc1394video_frame_t * frame, uint64_t sequence);
+
+/* What dc1394_camera_new_unit and the inquiry functions read from a camera,
+   kept on disk, see cache.c */
+typedef struct {
+    uint32_t command_regs_base;
+    uint32_t unit_sub_sw_version;
+    char * vendor;
+    char * model;
+    /* the Format_7 color coding registers the values were read with, then
+       the values of the register cache */
+    uint32_t num_guards;
+    uint32_t num_regs;
+    uint64_t * offsets;
+    uint32_t * values;
+} persistent_cache_t;
+
+char * persistent_cache_path (dc1394_t * d, const camera_info_t * info);
+int persistent_cache_load (const char * path, const camera_info_t * info,
+        const uint32_t rom[5], persistent_cache_t * pc);
+void persistent_cache_attach (dc1394camera_t * camera, persistent_cache_t * pc);
+void persistent_cache_save (dc1394camera_t * camera);
+
+void parallel_for (int n, void (*fn) (void * arg, int i), void * arg);
+
+/* Big-endian quadlets in files, see snapshot.c */
+void put_be32 (unsigned char * p, uint32_t v);
+uint32_t get_be32 (const unsigned char * p);
+
 #endif /* _DC1394_INTERNAL_H */
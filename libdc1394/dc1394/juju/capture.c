@@ -39,16 +39,85 @@
 #define ptr_to_u64(p) ((__u64)(unsigned long)(p))
 #define u64_to_ptr(p) ((void *)(unsigned long)(p))
 
+/* Largest number of packets a single fw_cdev_iso_packet can describe: its
+ * header length field has 8 bits and its payload length 16 bits. */
+static uint32_t
+max_packets_per_descriptor (platform_camera_t *craw, uint32_t packet_size)
+{
+    uint32_t n = 0xff / craw->header_size;
+    if (packet_size && 0xffff / packet_size < n)
+        n = 0xffff / packet_size;
+    return n ? n : 1;
+}
+
+/* Upper bound of the frame rate of the current mode: Format_7 cameras send
+ * at most one packet per 125 us bus cycle. */
+static float
+estimate_framerate (platform_camera_t *craw, dc1394video_frame_t *proto)
+{
+    dc1394framerate_t framerate;
+    float fps = 8000.0 / proto->packets_per_frame;
+    float f;
+
+    if (!dc1394_is_video_mode_scalable (proto->video_mode) &&
+            dc1394_video_get_framerate (craw->camera, &framerate)
+            == DC1394_SUCCESS &&
+            dc1394_framerate_as_float (framerate, &f) == DC1394_SUCCESS &&
+            f < fps)
+        fps = f;
+    return fps;
+}
+
+static void
+setup_interrupt_coalescing (platform_camera_t *craw,
+        dc1394video_frame_t *proto, uint32_t num_dma_buffers)
+{
+    const dc1394capture_options_t * opt =
+        &DC1394_CAMERA_PRIV (craw->camera)->capture_options;
+    uint32_t max_ppd = max_packets_per_descriptor (craw, proto->packet_size);
+    uint32_t fpi;
+
+    craw->packets_per_descriptor = opt->packets_per_descriptor;
+    if (craw->packets_per_descriptor == 0 ||
+            craw->packets_per_descriptor > max_ppd)
+        craw->packets_per_descriptor = max_ppd;
+    if (craw->packets_per_descriptor > proto->packets_per_frame)
+        craw->packets_per_descriptor = proto->packets_per_frame;
+
+    fpi = opt->frames_per_interrupt;
+    if (fpi == 0) {
+        /* Aim at about one wakeup per millisecond, but keep at least
+         * two interrupt groups in the ring so that it never stalls. */
+        fpi = estimate_framerate (craw, proto) / 1000;
+        if (fpi > num_dma_buffers / 2)
+            fpi = num_dma_buffers / 2;
+    }
+    if (fpi > num_dma_buffers)
+        fpi = num_dma_buffers;
+    /* The kernel flushes the collected headers once they fill a page, so
+     * a group must not need more than that or events would split it. */
+    if (fpi > 1 && fpi * proto->packets_per_frame * craw->header_size >
+            (uint32_t) getpagesize ())
+        fpi = getpagesize () / (proto->packets_per_frame * craw->header_size);
+    craw->frames_per_interrupt = fpi ? fpi : 1;
+
+    dc1394_log_debug ("Juju: %d packets per descriptor, "
+            "%d frames per interrupt", craw->packets_per_descriptor,
+            craw->frames_per_interrupt);
+}
+
 static dc1394error_t
-init_frame(platform_camera_t *craw, int index, dc1394video_frame_t *proto)
+init_frame(platform_camera_t *craw, int index, dc1394video_frame_t *proto,
+        unsigned char ** buffers)
 {
-    int N = 8;        /* Number of iso packets per fw_cdev_iso_packet. */
+    int N = craw->packets_per_descriptor;
     struct juju_frame *f = craw->frames + index;
     size_t total;
     int i, count;
 
     memcpy (&f->frame, proto, sizeof f->frame);
-    f->frame.image = craw->buffer + index * proto->total_bytes;
+    f->dma = craw->buffer + index * proto->total_bytes;
+    f->frame.image = buffers ? buffers[index] : f->dma;
     f->frame.id = index;
     count = (proto->packets_per_frame + N - 1) / N;
     f->size = count * sizeof *f->packets;
@@ -67,7 +136,15 @@ init_frame(platform_camera_t *craw, int index, dc1394video_frame_t *proto)
         total -= N;
     }
     f->packets[0].control |= FW_CDEV_ISO_SKIP;
-    f->packets[i - 1].control |= FW_CDEV_ISO_INTERRUPT;
+
+    /* Only the last frame of each group of frames_per_interrupt frames
+     * (and the last frame of the ring) raises an interrupt. */
+    f->interrupt = (index + 1) % craw->frames_per_interrupt == 0 ||
+        index == craw->num_frames - 1;
+    if (f->interrupt)
+        f->packets[i - 1].control |= FW_CDEV_ISO_INTERRUPT;
+
+    f->corrupt = 0;
 
     return DC1394_SUCCESS;
 }
@@ -88,7 +165,7 @@ queue_frame (platform_camera_t *craw, int index)
     int retval;
 
     queue.size = f->size;
-    queue.data = ptr_to_u64(f->frame.image);
+    queue.data = ptr_to_u64(f->dma);
     queue.packets = ptr_to_u64(f->packets);
     queue.handle = craw->iso_handle;
 
@@ -101,14 +178,17 @@ queue_frame (platform_camera_t *craw, int index)
     return DC1394_SUCCESS;
 }
 
-dc1394error_t
-dc1394_juju_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
-        uint32_t flags)
+/* The kernel only receives into the buffer mapped from the iso context:
+ * with user buffers, frames are copied out of it when dequeued. */
+static dc1394error_t
+capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
+        uint32_t flags, unsigned char ** buffers, size_t buffer_size)
 {
     struct fw_cdev_create_iso_context create;
     struct fw_cdev_start_iso start_iso;
     dc1394error_t err;
     dc1394video_frame_t proto;
+    capture_mempolicy_t mempolicy;
     int i, j, retval;
     dc1394camera_t * camera = craw->camera;
 
@@ -137,6 +217,12 @@ dc1394_juju_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
         return DC1394_FAILURE;
     }
 
+    if (buffers && buffer_size < proto.total_bytes) {
+        dc1394_log_error("Juju: buffers of %zu bytes are too small for "
+                "frames of %"PRIu64" bytes", buffer_size, proto.total_bytes);
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    }
+
     if (flags & (DC1394_CAPTURE_FLAGS_CHANNEL_ALLOC |
                 DC1394_CAPTURE_FLAGS_BANDWIDTH_ALLOC)) {
         uint64_t channels_allowed = 0;
@@ -188,20 +274,35 @@ dc1394_juju_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
 
     craw->num_frames = num_dma_buffers;
     craw->current = -1;
+    craw->frames_ready = 0;
+    setup_interrupt_coalescing (craw, &proto, num_dma_buffers);
     craw->buffer_size = proto.total_bytes * num_dma_buffers;
+    /* The kernel allocates the DMA pages when the buffer gets mapped */
+    capture_enter_numa_node (camera, &mempolicy);
     craw->buffer =
         mmap(NULL, craw->buffer_size, PROT_READ | PROT_WRITE , MAP_SHARED, craw->iso_fd, 0);
+    capture_leave_numa_node (&mempolicy);
     err = DC1394_IOCTL_FAILURE;
     if (craw->buffer == MAP_FAILED)
         goto error_fd;
+    capture_lock_buffer (camera, craw->buffer, craw->buffer_size);
 
     err = DC1394_MEMORY_ALLOCATION_FAILURE;
+    /* Iso interrupt events are read into this buffer, large enough for the
+     * headers of all the packets of an interrupt group.  The slack also
+     * covers the other (smaller) events that can show up on the iso fd. */
+    craw->event_size = sizeof *craw->event + craw->frames_per_interrupt *
+        proto.packets_per_frame * craw->header_size + 16 * sizeof (__u32);
+    craw->event = malloc (craw->event_size);
+    if (craw->event == NULL)
+        goto error_mmap;
+
     craw->frames = malloc (num_dma_buffers * sizeof *craw->frames);
     if (craw->frames == NULL)
-        goto error_mmap;
+        goto error_event;
 
     for (i = 0; i < num_dma_buffers; i++) {
-        err = init_frame(craw, i, &proto);
+        err = init_frame(craw, i, &proto, buffers);
         if (err != DC1394_SUCCESS) {
             dc1394_log_error("error initing frames");
             break;
@@ -210,7 +311,7 @@ dc1394_juju_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
     if (err != DC1394_SUCCESS) {
         for (j = 0; j < i; j++)
             release_frame(craw, j);
-        goto error_mmap;
+        goto error_buffers;
     }
 
     for (i = 0; i < num_dma_buffers; i++) {
@@ -248,6 +349,12 @@ dc1394_juju_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
 error_frames:
     for (i = 0; i < num_dma_buffers; i++)
         release_frame(craw, i);
+error_buffers:
+    free (craw->frames);
+    craw->frames = NULL;
+error_event:
+    free (craw->event);
+    craw->event = NULL;
 error_mmap:
     munmap(craw->buffer, craw->buffer_size);
 error_fd:
@@ -256,6 +363,21 @@ error_fd:
     return err;
 }
 
+dc1394error_t
+dc1394_juju_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
+        uint32_t flags)
+{
+    return capture_setup (craw, num_dma_buffers, flags, NULL, 0);
+}
+
+dc1394error_t
+dc1394_juju_capture_setup_with_buffers(platform_camera_t *craw,
+        uint32_t num_buffers, uint32_t flags, unsigned char ** buffers,
+        size_t buffer_size)
+{
+    return capture_setup (craw, num_buffers, flags, buffers, buffer_size);
+}
+
 dc1394error_t
 dc1394_juju_capture_stop(platform_camera_t *craw)
 {
@@ -276,6 +398,8 @@ dc1394_juju_capture_stop(platform_camera_t *craw)
         release_frame(craw, i);
     free (craw->frames);
     craw->frames = NULL;
+    free (craw->event);
+    craw->event = NULL;
     craw->capture_is_set = 0;
 
     if (craw->capture_iso_resource) {
@@ -303,72 +427,90 @@ bus_time_to_usec (uint32_t bus)
     return sec * 1000000 + cycles * 125 + subcycle * 125 / 3072;
 }
 
-dc1394error_t
-dc1394_juju_capture_dequeue (platform_camera_t * craw,
-        dc1394capture_policy_t policy, dc1394video_frame_t **frame_return)
+/* Checks the stripped iso packet headers of a completed frame.  Every
+ * packet must carry exactly packet_size bytes and use the same tag, and
+ * only the first packet may have the sy field set: a sync packet further
+ * into the frame means that a packet was lost and the frame boundary has
+ * slipped.  The kernel caps the headers of one event to a page, so only
+ * the packets whose headers were delivered can be checked. */
+static int
+frame_headers_corrupt (platform_camera_t * craw, struct juju_frame * f,
+        const __u32 * headers, int num_packets)
 {
-    struct pollfd fds[1];
-    struct juju_frame *f;
-    int err, len;
-    struct fw_cdev_get_cycle_timer tm;
-    struct {
-        struct fw_cdev_event_iso_interrupt i;
-        __u32 headers[craw->frames[0].frame.packets_per_frame*2 + 16];
-    } iso;
-
-    if ( (policy<DC1394_CAPTURE_POLICY_MIN) || (policy>DC1394_CAPTURE_POLICY_MAX) )
-        return DC1394_INVALID_CAPTURE_POLICY;
-
-    // default: return NULL in case of failures or lack of frames
-    *frame_return=NULL;
-
-    fds[0].fd = craw->iso_fd;
-    fds[0].events = POLLIN;
+    int quads = craw->header_size / 4;
+    uint32_t tag = 0;
+    int i;
 
-    while (1) {
-        err = poll(fds, 1, (policy == DC1394_CAPTURE_POLICY_POLL) ? 0 : -1);
-        if (err < 0) {
-            if (errno == EINTR)
-                continue;
-            dc1394_log_error("poll() failed for device %s.", craw->filename);
-            return DC1394_FAILURE;
-        } else if (err == 0) {
-            return DC1394_SUCCESS;
+    for (i = 0; i < num_packets; i++) {
+        uint32_t h = ntohl (headers[i * quads]);
+        uint32_t data_length = h >> 16;
+        uint32_t t = (h >> 14) & 0x3;
+        uint32_t sy = h & 0xf;
+
+        if (data_length != f->frame.packet_size) {
+            dc1394_log_debug("Juju: packet %d of frame %d has %d bytes, "
+                    "expected %d", i, f->frame.id, data_length,
+                    f->frame.packet_size);
+            return 1;
         }
-
-        len = read (craw->iso_fd, &iso, sizeof iso);
-        if (len < 0) {
-            dc1394_log_error("Juju: dequeue failed to read a response: %m");
-            return DC1394_FAILURE;
+        if (i == 0) {
+            tag = t;
+            if (sy != 1)
+                return 1;
+        }
+        else if (t != tag || sy != 0) {
+            dc1394_log_debug("Juju: packet %d of frame %d has tag %d sy %d",
+                    i, f->frame.id, t, sy);
+            return 1;
         }
-
-        if (iso.i.type == FW_CDEV_EVENT_ISO_INTERRUPT)
-            break;
     }
 
-    craw->current = (craw->current + 1) % craw->num_frames;
-    f = craw->frames + craw->current;
-
-    dc1394_log_debug("Juju: got iso event, cycle 0x%04x, header_len %d",
-            iso.i.cycle, iso.i.header_length);
+    return 0;
+}
 
-    f->frame.frames_behind = 0;
-    f->frame.timestamp = 0;
+/* Fills in the timestamp and the corruption status of the count frames
+ * starting at ring index first, which were all completed by the same iso
+ * interrupt event. */
+static void
+complete_frames (platform_camera_t * craw, int first, int count,
+        const struct fw_cdev_event_iso_interrupt * event)
+{
+    struct fw_cdev_get_cycle_timer tm;
+    int quads = craw->header_size / 4;
+    int ppf = craw->frames[0].frame.packets_per_frame;
+    int num_headers = event->header_length / craw->header_size;
+    int have_cycle_timer, k;
+
+    have_cycle_timer =
+        ioctl(craw->iso_fd, FW_CDEV_IOC_GET_CYCLE_TIMER, &tm) == 0;
+
+    for (k = 0; k < count; k++) {
+        struct juju_frame *f = craw->frames + (first + k) % craw->num_frames;
+        /* Headers of this frame within the event */
+        const __u32 * headers = event->header + k * ppf * quads;
+        int n = num_headers - k * ppf;
+
+        if (n > ppf)
+            n = ppf;
+        if (n < 0)
+            n = 0;
+
+        f->corrupt = frame_headers_corrupt (craw, f, headers, n);
+        f->frame.timestamp = 0;
+        if (!have_cycle_timer)
+            continue;
 
-    /* Compute timestamp */
-    if (ioctl(craw->iso_fd, FW_CDEV_IOC_GET_CYCLE_TIMER, &tm) == 0) {
         /* Current bus time in usec as retrieved by the ioctl */
         uint32_t bus_time = bus_time_to_usec(tm.cycle_timer);
-        /* Bus time of the interrupt packet (end of frame) */
-        uint32_t dma_time = iso.i.cycle;
-        /* Estimated usec between start of frame and end of frame */
-        uint32_t diff =
-            (craw->frames[0].frame.packets_per_frame - 1) * 125;
+        /* Bus time of the interrupt packet (end of the group) */
+        uint32_t dma_time = event->cycle;
+        /* Estimated usec between start of frame and end of the group */
+        uint32_t diff = ((count - k) * ppf - 1) * 125;
 
         /* If per-packet timestamps are available in the headers use them */
-        if (craw->header_size >= 8) {
-            uint8_t * b = (uint8_t *)(iso.i.header + 1);
-            /* Bus time of the first frame in the packet */
+        if (craw->header_size >= 8 && n > 0) {
+            uint8_t * b = (uint8_t *)(headers + 1);
+            /* Bus time of the first packet of the frame */
             dma_time = (b[2] << 8) | b[3];
             dc1394_log_debug("Juju: using cycle 0x%04x (diff was %d)",
                     dma_time, diff);
@@ -383,7 +525,98 @@ dc1394_juju_capture_dequeue (platform_camera_t * craw,
 
         f->frame.timestamp = tm.local_time - diff;
     }
+}
+
+/* Waits for the iso interrupt event completing the next group of frames
+ * and makes these frames available.  Returns with no frame ready if the
+ * policy is polling and no event is pending.  The cdev hands out exactly
+ * one event per read(), so a blocking wait is a single syscall and a poll
+ * costs at most two, whatever the size of the frames. */
+static dc1394error_t
+wait_for_frames (platform_camera_t * craw, dc1394capture_policy_t policy)
+{
+    struct pollfd fds[1];
+    struct juju_frame *f;
+    int first, count, err, len;
+
+    /* The group runs up to the next frame flagged for interrupt */
+    first = (craw->current + 1) % craw->num_frames;
+    count = 1;
+    f = craw->frames + first;
+    while (!f->interrupt) {
+        f = craw->frames + (first + count) % craw->num_frames;
+        count++;
+    }
+
+    fds[0].fd = craw->iso_fd;
+    fds[0].events = POLLIN;
+
+    while (1) {
+        if (policy == DC1394_CAPTURE_POLICY_POLL) {
+            err = poll(fds, 1, 0);
+            if (err < 0) {
+                if (errno == EINTR)
+                    continue;
+                dc1394_log_error("poll() failed for device %s.",
+                        craw->filename);
+                return DC1394_FAILURE;
+            } else if (err == 0) {
+                return DC1394_SUCCESS;
+            }
+        }
+
+        len = read (craw->iso_fd, craw->event, craw->event_size);
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            dc1394_log_error("Juju: dequeue failed to read a response: %m");
+            return DC1394_FAILURE;
+        }
+
+        if (craw->event->type == FW_CDEV_EVENT_ISO_INTERRUPT)
+            break;
+    }
 
+    dc1394_log_debug("Juju: got iso event, cycle 0x%04x, header_len %d, "
+            "%d frame(s)", craw->event->cycle, craw->event->header_length,
+            count);
+
+    complete_frames (craw, first, count, craw->event);
+    craw->frames_ready = count;
+
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_juju_capture_dequeue (platform_camera_t * craw,
+        dc1394capture_policy_t policy, dc1394video_frame_t **frame_return)
+{
+    struct juju_frame *f;
+    dc1394error_t err;
+
+    if ( (policy<DC1394_CAPTURE_POLICY_MIN) || (policy>DC1394_CAPTURE_POLICY_MAX) )
+        return DC1394_INVALID_CAPTURE_POLICY;
+
+    // default: return NULL in case of failures or lack of frames
+    *frame_return=NULL;
+
+    if (craw->frames_ready == 0) {
+        err = wait_for_frames (craw, policy);
+        if (err != DC1394_SUCCESS)
+            return err;
+        if (craw->frames_ready == 0)
+            return DC1394_SUCCESS;
+    }
+
+    craw->current = (craw->current + 1) % craw->num_frames;
+    craw->frames_ready--;
+    f = craw->frames + craw->current;
+
+    /* The one copy of user buffer capture */
+    if (f->frame.image != f->dma)
+        memcpy (f->frame.image, f->dma, f->frame.image_bytes);
+
+    f->frame.frames_behind = craw->frames_ready;
     *frame_return = &f->frame;
 
     return DC1394_SUCCESS;
@@ -412,3 +645,14 @@ dc1394_juju_capture_get_fileno (platform_camera_t * craw)
     return craw->iso_fd;
 }
 
+dc1394bool_t
+dc1394_juju_capture_is_frame_corrupt (platform_camera_t * craw,
+        dc1394video_frame_t * frame)
+{
+    struct juju_frame * f = (struct juju_frame *) frame;
+
+    if (f->corrupt)
+        return DC1394_TRUE;
+
+    return DC1394_FALSE;
+}
@@ -30,6 +30,8 @@
 #include <sys/ioctl.h>
 #include <inttypes.h>
 #include <arpa/inet.h>
+#include <poll.h>
+#include <sys/inotify.h>
 
 #include "config.h"
 #include "platform.h"
@@ -66,11 +68,15 @@ dc1394_juju_new (void)
     }
 
     platform_t * p = calloc (1, sizeof (platform_t));
+    if (p)
+        p->inotify_fd = -1;
     return p;
 }
 static void
 dc1394_juju_free (platform_t * p)
 {
+    if (p->inotify_fd >= 0)
+        close (p->inotify_fd);
     free (p);
 }
 
@@ -79,82 +85,118 @@ struct _platform_device_t {
     char filename[32];
 };
 
+/* A device file to look at, see dc1394_juju_get_device_list */
+typedef struct {
+    char filename[32];
+    platform_device_t * device;
+} juju_probe_t;
+
+/* Orders /dev/fw<n> by n, so that devices keep their order from one
+   enumeration to the next. Earlier versions listed them in the order of
+   readdir(), which is not stable. */
+static int
+compare_probes (const void * a, const void * b)
+{
+    const juju_probe_t * pa = a, * pb = b;
+    long na = strtol (pa->filename + 7, NULL, 10);
+    long nb = strtol (pb->filename + 7, NULL, 10);
+    return na < nb ? -1 : na > nb;
+}
+
+static void
+probe_device (void * arg, int i)
+{
+    juju_probe_t * probe = (juju_probe_t *) arg + i;
+    platform_device_t * device;
+    struct fw_cdev_get_info get_info;
+    struct fw_cdev_event_bus_reset reset;
+    int fd;
+
+    fd = open(probe->filename, O_RDWR);
+    if (fd < 0) {
+        dc1394_log_debug("Juju: Failed to open %s: %s", probe->filename,
+                strerror (errno));
+        return;
+    }
+    dc1394_log_debug("Juju: Opened %s successfully", probe->filename);
+
+    device = malloc (sizeof (platform_device_t));
+    if (!device) {
+        close (fd);
+        return;
+    }
+
+    get_info.version = FW_CDEV_VERSION;
+    get_info.rom = ptr_to_u64(&device->config_rom);
+    get_info.rom_length = 1024;
+    get_info.bus_reset = ptr_to_u64(&reset);
+    if (ioctl(fd, FW_CDEV_IOC_GET_INFO, &get_info) < 0) {
+        dc1394_log_error("GET_CONFIG_ROM failed for %s: %m", probe->filename);
+        free (device);
+        close(fd);
+        return;
+    }
+    close (fd);
+
+    strcpy (device->filename, probe->filename);
+    probe->device = device;
+}
+
+/* The device files are opened and their configuration ROM read at the same
+ * time, as each open can wait for the kernel to finish reading the ROM of
+ * a node that just appeared. */
 static platform_device_list_t *
 dc1394_juju_get_device_list (platform_t * p)
 {
     DIR * dir;
     struct dirent * de;
     platform_device_list_t * list;
-    uint32_t allocated_size = 64;
-
-    list = calloc (1, sizeof (platform_device_list_t));
-    if (!list)
-        return NULL;
-    list->devices = malloc(allocated_size * sizeof(platform_device_t *));
-    if (!list->devices) {
-        free (list);
-        return NULL;
-    }
+    juju_probe_t * probes = NULL, * tmp;
+    int num_probes = 0, allocated_size = 0, i;
 
     dir = opendir("/dev");
     if (dir == NULL) {
         dc1394_log_error("opendir: %m");
-        free (list->devices);
-        free (list);
         return NULL;
     }
 
     while ((de = readdir(dir))) {
-        char filename[32];
-        int fd;
-        platform_device_t * device;
-        struct fw_cdev_get_info get_info;
-        struct fw_cdev_event_bus_reset reset;
-
         if (strncmp(de->d_name, "fw", 2) != 0 ||
                 de->d_name[2] < '0' || de->d_name[2] > '9')
             continue;
 
-        snprintf(filename, sizeof filename, "/dev/%s", de->d_name);
-        fd = open(filename, O_RDWR);
-        if (fd < 0) {
-            dc1394_log_debug("Juju: Failed to open %s: %s", filename,
-                    strerror (errno));
-            continue;
-        }
-        dc1394_log_debug("Juju: Opened %s successfully", filename);
-
-        device = malloc (sizeof (platform_device_t));
-        if (!device) {
-            close (fd);
-            continue;
-        }
-
-        get_info.version = FW_CDEV_VERSION;
-        get_info.rom = ptr_to_u64(&device->config_rom);
-        get_info.rom_length = 1024;
-        get_info.bus_reset = ptr_to_u64(&reset);
-        if (ioctl(fd, FW_CDEV_IOC_GET_INFO, &get_info) < 0) {
-            dc1394_log_error("GET_CONFIG_ROM failed for %s: %m",filename);
-            free (device);
-            close(fd);
-            continue;
-        }
-        close (fd);
-
-        strcpy (device->filename, filename);
-        list->devices[list->num_devices] = device;
-        list->num_devices++;
-
-        if (list->num_devices >= allocated_size) {
+        if (num_probes >= allocated_size) {
             allocated_size += 64;
-            list->devices = realloc (list->devices, allocated_size * sizeof (platform_device_t *));
-            if (!list->devices)
-                return NULL;
+            tmp = realloc (probes, allocated_size * sizeof (juju_probe_t));
+            if (!tmp)
+                break;
+            probes = tmp;
         }
+        snprintf(probes[num_probes].filename, sizeof probes->filename,
+                "/dev/%s", de->d_name);
+        probes[num_probes].device = NULL;
+        num_probes++;
     }
     closedir(dir);
 
+    qsort (probes, num_probes, sizeof (juju_probe_t), compare_probes);
+    parallel_for (num_probes, probe_device, probes);
+
+    list = calloc (1, sizeof (platform_device_list_t));
+    if (list)
+        list->devices = malloc ((num_probes + 1) * sizeof (platform_device_t *));
+    if (!list || !list->devices) {
+        for (i = 0; i < num_probes; i++)
+            free (probes[i].device);
+        free (probes);
+        free (list);
+        return NULL;
+    }
+    for (i = 0; i < num_probes; i++)
+        if (probes[i].device)
+            list->devices[list->num_devices++] = probes[i].device;
+    free (probes);
+
     return list;
 }
 
@@ -168,6 +210,182 @@ dc1394_juju_free_device_list (platform_device_list_t * d)
     free (d);
 }
 
+static int
+dc1394_juju_monitor_start (platform_t * p)
+{
+    if (p->inotify_fd >= 0)
+        return p->inotify_fd;
+
+    p->inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if (p->inotify_fd < 0) {
+        dc1394_log_error ("Juju: inotify_init1 failed: %m");
+        return -1;
+    }
+    /* udev creates device files, then gives them their permissions: the
+       ones that could not be opened yet are tried again on IN_ATTRIB */
+    if (inotify_add_watch (p->inotify_fd, "/dev", IN_CREATE | IN_ATTRIB |
+                IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO) < 0) {
+        dc1394_log_error ("Juju: inotify_add_watch failed: %m");
+        close (p->inotify_fd);
+        p->inotify_fd = -1;
+    }
+    return p->inotify_fd;
+}
+
+static void
+dc1394_juju_monitor_stop (platform_t * p)
+{
+    if (p->inotify_fd >= 0)
+        close (p->inotify_fd);
+    p->inotify_fd = -1;
+}
+
+static int
+is_device_name (const char * name)
+{
+    return strncmp (name, "fw", 2) == 0 && name[2] >= '0' && name[2] <= '9';
+}
+
+static int
+find_device (platform_device_list_t * list, const char * filename)
+{
+    int i;
+    for (i = 0; i < list->num_devices; i++)
+        if (strcmp (list->devices[i]->filename, filename) == 0)
+            return i;
+    return -1;
+}
+
+static void
+remove_device (platform_device_list_t * list, int i,
+        platform_monitor_callback_t removed, void * arg)
+{
+    platform_device_t * device = list->devices[i];
+
+    dc1394_log_debug ("Juju: %s removed", device->filename);
+    removed (arg, device);
+    free (device);
+    memmove (list->devices + i, list->devices + i + 1,
+            (list->num_devices - i - 1) * sizeof (platform_device_t *));
+    list->num_devices--;
+}
+
+/* Queues a device file to be read, unless it already is or is listed */
+static void
+queue_probe (juju_probe_t ** probes, int * num_probes,
+        platform_device_list_t * list, const char * name)
+{
+    juju_probe_t * tmp;
+    char filename[32];
+    int i;
+
+    snprintf (filename, sizeof filename, "/dev/%s", name);
+    if (find_device (list, filename) >= 0)
+        return;
+    for (i = 0; i < *num_probes; i++)
+        if (strcmp ((*probes)[i].filename, filename) == 0)
+            return;
+
+    tmp = realloc (*probes, (*num_probes + 1) * sizeof (juju_probe_t));
+    if (!tmp)
+        return;
+    *probes = tmp;
+    strcpy (tmp[*num_probes].filename, filename);
+    tmp[*num_probes].device = NULL;
+    (*num_probes)++;
+}
+
+/* After lost events: drops the devices whose file is gone, and queues the
+   files that are not listed */
+static void
+resync_devices (platform_device_list_t * list, juju_probe_t ** probes,
+        int * num_probes, platform_monitor_callback_t removed, void * arg)
+{
+    DIR * dir;
+    struct dirent * de;
+    int i = 0;
+
+    dc1394_log_debug ("Juju: inotify queue overflow, looking at /dev again");
+    while (i < list->num_devices) {
+        if (access (list->devices[i]->filename, F_OK) < 0)
+            remove_device (list, i, removed, arg);
+        else
+            i++;
+    }
+
+    dir = opendir ("/dev");
+    if (!dir)
+        return;
+    while ((de = readdir (dir)))
+        if (is_device_name (de->d_name))
+            queue_probe (probes, num_probes, list, de->d_name);
+    closedir (dir);
+}
+
+/* Removals are handled in the order they come. Files that appear are read
+ * at the end, all at the same time, and the ones gone by then simply fail
+ * to open. */
+static void
+dc1394_juju_monitor_update (platform_t * p, platform_device_list_t * list,
+        platform_monitor_callback_t added, platform_monitor_callback_t removed,
+        void * arg)
+{
+    char buffer[4096]
+        __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    const struct inotify_event * event;
+    juju_probe_t * probes = NULL;
+    platform_device_t ** tmp;
+    int num_probes = 0, i;
+    ssize_t len;
+    char * ptr;
+
+    if (p->inotify_fd < 0)
+        return;
+
+    while ((len = read (p->inotify_fd, buffer, sizeof buffer)) > 0) {
+        for (ptr = buffer; ptr < buffer + len;
+                ptr += sizeof (struct inotify_event) + event->len) {
+            event = (const struct inotify_event *) ptr;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                resync_devices (list, &probes, &num_probes, removed, arg);
+                continue;
+            }
+            if (!event->len || !is_device_name (event->name))
+                continue;
+
+            if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                char filename[32];
+                snprintf (filename, sizeof filename, "/dev/%s", event->name);
+                if ((i = find_device (list, filename)) >= 0)
+                    remove_device (list, i, removed, arg);
+            }
+            else
+                queue_probe (&probes, &num_probes, list, event->name);
+        }
+    }
+    if (len < 0 && errno != EAGAIN)
+        dc1394_log_error ("Juju: failed to read inotify events: %m");
+
+    parallel_for (num_probes, probe_device, probes);
+
+    for (i = 0; i < num_probes; i++) {
+        if (!probes[i].device)
+            continue;
+        tmp = realloc (list->devices,
+                (list->num_devices + 1) * sizeof (platform_device_t *));
+        if (!tmp) {
+            free (probes[i].device);
+            continue;
+        }
+        list->devices = tmp;
+        list->devices[list->num_devices++] = probes[i].device;
+        dc1394_log_debug ("Juju: %s added", probes[i].filename);
+        added (arg, probes[i].device);
+    }
+    free (probes);
+}
+
 static int
 dc1394_juju_device_get_config_rom (platform_device_t * device,
                                 uint32_t * quads, int * num_quads)
@@ -267,13 +485,113 @@ dc1394_juju_camera_print_info (platform_camera_t * camera, FILE *fd)
 
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 
-typedef struct _juju_response_info {
-    int got_response;
-    uint32_t rcode;
-    uint32_t *data;
-    int num_quads;
-    int actual_num_quads;
-} juju_response_info;
+static dc1394error_t
+juju_send_request (platform_camera_t * cam, platform_request_t * req)
+{
+    struct fw_cdev_send_request request;
+    uint32_t in_buffer[req->write ? req->num_quads : 0];
+    int i, iotype = FW_CDEV_IOC_SEND_REQUEST;
+
+    for (i = 0; req->write && i < req->num_quads; i++)
+        in_buffer[i] = htonl (req->quads[i]);
+
+    if (req->write) {
+        request.tcode = req->num_quads > 1 ? TCODE_WRITE_BLOCK_REQUEST :
+            TCODE_WRITE_QUADLET_REQUEST;
+        if (cam->broadcast_enabled)
+            iotype = FW_CDEV_IOC_SEND_BROADCAST_REQUEST;
+    }
+    else
+        request.tcode = req->num_quads > 1 ? TCODE_READ_BLOCK_REQUEST :
+            TCODE_READ_QUADLET_REQUEST;
+    request.closure = ptr_to_u64(req);
+    request.offset = CONFIG_ROM_BASE + req->offset;
+    request.data = ptr_to_u64(in_buffer);
+    request.length = req->num_quads * 4;
+    request.generation = cam->generation;
+
+    if (ioctl (cam->fd, iotype, &request) < 0) {
+        dc1394_log_error("juju: Send request failed: %m");
+        return DC1394_FAILURE;
+    }
+    return DC1394_SUCCESS;
+}
+
+static void
+juju_complete_request (platform_camera_t * cam, platform_request_t * req,
+        uint32_t rcode, const uint32_t * data, int num_quads)
+{
+    int i, delay;
+
+    if (rcode == 0) {
+        if (!req->write) {
+            if (req->num_quads != num_quads)
+                dc1394_log_warning("juju: Expected response len %d, got %d",
+                        req->num_quads, num_quads);
+            for (i = 0; i < MIN(num_quads, req->num_quads); i++)
+                req->quads[i] = ntohl (data[i]);
+        }
+        req->result = DC1394_SUCCESS;
+        req->done = 1;
+        return;
+    }
+
+    if (rcode != RCODE_BUSY
+            && rcode != RCODE_CONFLICT_ERROR
+            && rcode != RCODE_GENERATION) {
+        dc1394_log_debug ("juju: Response error, rcode 0x%x", rcode);
+        /* The camera does not take this kind of transaction there */
+        if (rcode == RCODE_TYPE_ERROR || rcode == RCODE_ADDRESS_ERROR)
+            req->result = DC1394_FUNCTION_NOT_SUPPORTED;
+        else
+            req->result = DC1394_FAILURE;
+        req->done = 1;
+        return;
+    }
+
+    /* retry if we get any of the rcodes listed above. The request is sent
+       again from camera_poll once its delay is over, so that the other
+       completions are not held up meanwhile. */
+    delay = retry_next (cam->camera, &req->retry, rcode == RCODE_GENERATION ?
+            RETRY_GENERATION : RETRY_BUSY, 300);
+    if (delay >= 0) {
+        dc1394_log_debug("juju: retry rcode 0x%x offset %"PRIx64,
+                rcode, req->offset);
+        req->retry.due = retry_now () + delay;
+        req->next = cam->retries;
+        cam->retries = req;
+        return;
+    }
+    dc1394_log_error("juju: Max retries for offset %"PRIx64, req->offset);
+    req->result = DC1394_FAILURE;
+    req->done = 1;
+}
+
+/* Sends the retries that are due. Returns the time in microseconds until
+ * the next one, or -1 if none is left. */
+static int64_t
+juju_send_retries (platform_camera_t * cam)
+{
+    platform_request_t ** p = &cam->retries, * req;
+    uint64_t now = retry_now ();
+    int64_t next = -1;
+
+    while ((req = *p)) {
+        if (req->retry.due > now) {
+            if (next < 0 || req->retry.due - now < next)
+                next = req->retry.due - now;
+            p = &req->next;
+            continue;
+        }
+        *p = req->next;
+        req->next = NULL;
+        if (juju_send_request (cam, req) != DC1394_SUCCESS) {
+            req->result = DC1394_FAILURE;
+            req->done = 1;
+        }
+    }
+    return next;
+}
 
 static int
 juju_handle_event (platform_camera_t * cam)
@@ -286,11 +604,12 @@ juju_handle_event (platform_camera_t * cam)
         struct fw_cdev_event_bus_reset reset;
         struct fw_cdev_event_iso_resource resource;
     } u;
-    int len, i;
-    juju_response_info *resp_info;
+    int len;
     juju_iso_info *iso_info;
 
-    len = read (cam->fd, &u, sizeof u);
+    do
+        len = read (cam->fd, &u, sizeof u);
+    while (len < 0 && errno == EINTR);
     if (len < 0) {
         dc1394_log_error("juju: Read failed: %m");
         return -1;
@@ -310,21 +629,16 @@ juju_handle_event (platform_camera_t * cam)
                     u.response.r.rcode, u.response.r.length);
             break;
         }
-        resp_info = u64_to_ptr(u.response.r.closure);
-        resp_info->rcode = u.response.r.rcode;
-        resp_info->actual_num_quads = u.response.r.length/4;
-        resp_info->got_response = 1;
-        if (resp_info->rcode || !resp_info->data)
-            break;
-        if (cam->max_response_quads < resp_info->actual_num_quads) {
+        if (cam->max_response_quads < u.response.r.length / 4) {
             dc1394_log_error ("juju: read buffer too small, have %d needed %d",
-                    cam->max_response_quads, resp_info->actual_num_quads);
+                    cam->max_response_quads, u.response.r.length / 4);
+            juju_complete_request (cam, u64_to_ptr(u.response.r.closure),
+                    RCODE_TYPE_ERROR, NULL, 0);
             break;
         }
-
-        len = MIN(resp_info->actual_num_quads, resp_info->num_quads);
-        for (i = 0; i < len; i++)
-            resp_info->data[i] = ntohl (u.response.r.data[i]);
+        juju_complete_request (cam, u64_to_ptr(u.response.r.closure),
+                u.response.r.rcode, u.response.r.data,
+                u.response.r.length / 4);
         break;
 
     case FW_CDEV_EVENT_ISO_RESOURCE_ALLOCATED:
@@ -373,101 +687,122 @@ juju_handle_event (platform_camera_t * cam)
 }
 
 static dc1394error_t
-do_transaction(platform_camera_t * cam, int tcode, uint64_t offset,
-        const uint32_t * in, uint32_t * out, uint32_t num_quads)
+dc1394_juju_camera_submit (platform_camera_t * cam, platform_request_t * req)
 {
-    struct fw_cdev_send_request request;
-    juju_response_info resp;
-    int i, len;
-    uint32_t in_buffer[in ? num_quads : 0];
-    int retry = 300;
-
-    for (i = 0; in && i < num_quads; i++)
-        in_buffer[i] = htonl (in[i]);
+    req->done = 0;
+    retry_begin (&req->retry);
+    if (!req->write && req->num_quads > cam->max_response_quads)
+        cam->max_response_quads = req->num_quads;
 
-    resp.data = out;
-    resp.num_quads = out ? num_quads : 0;
-    cam->max_response_quads = resp.num_quads;
-
-    request.closure = ptr_to_u64(&resp);
-    request.offset = CONFIG_ROM_BASE + offset;
-    request.data = ptr_to_u64(in_buffer);
-    request.length = num_quads * 4;
-    request.tcode = tcode;
-
-    while (retry > 0) {
-        int retval;
-
-        request.generation = cam->generation;
-
-        int iotype = FW_CDEV_IOC_SEND_REQUEST;
-        if (cam->broadcast_enabled && (tcode == TCODE_WRITE_BLOCK_REQUEST ||
-                    tcode == TCODE_WRITE_QUADLET_REQUEST))
-            iotype = FW_CDEV_IOC_SEND_BROADCAST_REQUEST;
+    return juju_send_request (cam, req);
+}
 
-        len = ioctl (cam->fd, iotype, &request);
-        if (len < 0) {
-            dc1394_log_error("juju: Send request failed: %m");
+/* When blocking, waits for one event or for the next retry to be due */
+static dc1394error_t
+dc1394_juju_camera_poll (platform_camera_t * cam, dc1394bool_t block)
+{
+    struct pollfd pfd = { .fd = cam->fd, .events = POLLIN };
+    int64_t next;
+    int n;
+
+    if (block) {
+        next = juju_send_retries (cam);
+        n = poll (&pfd, 1, next < 0 ? -1 : (int) ((next + 999) / 1000));
+        if (n < 0 && errno != EINTR) {
+            dc1394_log_error("juju: poll failed: %m");
             return DC1394_FAILURE;
         }
+        if (n > 0 && juju_handle_event (cam) < 0)
+            return DC1394_FAILURE;
+        juju_send_retries (cam);
+        return DC1394_SUCCESS;
+    }
 
-        resp.got_response = 0;
-        while (!resp.got_response)
-            if ((retval = juju_handle_event (cam)) < 0)
-                return retval;
+    while (poll (&pfd, 1, 0) > 0)
+        if (juju_handle_event (cam) < 0)
+            return DC1394_FAILURE;
+    juju_send_retries (cam);
+    return DC1394_SUCCESS;
+}
 
-        if (resp.rcode == 0) {
-            if (resp.num_quads != resp.actual_num_quads)
-                dc1394_log_warning("juju: Expected response len %d, got %d",
-                        resp.num_quads, resp.actual_num_quads);
+static dc1394error_t
+dc1394_juju_camera_cancel (platform_camera_t * cam, platform_request_t * req)
+{
+    platform_request_t ** p;
+
+    for (p = &cam->retries; *p; p = &(*p)->next) {
+        if (*p == req) {
+            *p = req->next;
+            req->next = NULL;
+            req->result = DC1394_FAILURE;
+            req->done = 1;
             return DC1394_SUCCESS;
         }
+    }
+    /* Sent to the kernel, which will answer it */
+    return req->done ? DC1394_SUCCESS : DC1394_FAILURE;
+}
+
+/* The kernel answers through the request, and a retry sends its data
+ * again, so the request and its data are allocated, and left allocated if
+ * the request has to be given up on while still in flight, as in
+ * dc1394_request_wait() */
+static dc1394error_t
+do_transaction(platform_camera_t * cam, uint64_t offset,
+        const uint32_t * in, uint32_t * out, uint32_t num_quads)
+{
+    platform_request_t * req;
+    dc1394error_t err;
+    uint32_t failures = 0;
+
+    req = calloc (1, sizeof (platform_request_t) +
+            num_quads * sizeof (uint32_t));
+    if (!req)
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    req->offset = offset;
+    req->quads = (uint32_t *) (req + 1);
+    if (in)
+        memcpy (req->quads, in, num_quads * sizeof (uint32_t));
+    req->num_quads = num_quads;
+    req->write = in ? DC1394_TRUE : DC1394_FALSE;
+
+    err = dc1394_juju_camera_submit (cam, req);
+    if (err != DC1394_SUCCESS) {
+        free (req);
+        return err;
+    }
 
-        if (resp.rcode != RCODE_BUSY
-                && resp.rcode != RCODE_CONFLICT_ERROR
-                && resp.rcode != RCODE_GENERATION) {
-            dc1394_log_debug ("juju: Response error, rcode 0x%x",
-                    resp.rcode);
+    while (!req->done) {
+        if (dc1394_juju_camera_poll (cam, DC1394_TRUE) == DC1394_SUCCESS) {
+            failures = 0;
+            continue;
+        }
+        if (dc1394_juju_camera_cancel (cam, req) == DC1394_SUCCESS)
+            break;
+        if (++failures >= REQUEST_MAX_POLL_FAILURES) {
+            dc1394_log_error ("juju: Giving up on the transaction at "
+                    "0x%"PRIx64", which is left in flight", offset);
             return DC1394_FAILURE;
         }
-
-        /* retry if we get any of the rcodes listed above */
-        dc1394_log_debug("juju: retry rcode 0x%x tcode 0x%x offset %"PRIx64,
-                resp.rcode, tcode, offset);
-        usleep (DC1394_SLOW_DOWN);
-        retry--;
     }
 
-    dc1394_log_error("juju: Max retries for tcode 0x%x, offset %"PRIx64,
-            tcode, offset);
-    return DC1394_FAILURE;
+    err = req->result;
+    if (err == DC1394_SUCCESS && out)
+        memcpy (out, req->quads, num_quads * sizeof (uint32_t));
+    free (req);
+    return err;
 }
 
 static dc1394error_t
 dc1394_juju_camera_read (platform_camera_t * cam, uint64_t offset, uint32_t * quads, int num_quads)
 {
-    int tcode;
-
-    if (num_quads > 1)
-        tcode = TCODE_READ_BLOCK_REQUEST;
-    else
-        tcode = TCODE_READ_QUADLET_REQUEST;
-
-    dc1394error_t err = do_transaction(cam, tcode, offset, NULL, quads, num_quads);
-    return err;
+    return do_transaction(cam, offset, NULL, quads, num_quads);
 }
 
 static dc1394error_t
 dc1394_juju_camera_write (platform_camera_t * cam, uint64_t offset, const uint32_t * quads, int num_quads)
 {
-    int tcode;
-
-    if (num_quads > 1)
-        tcode = TCODE_WRITE_BLOCK_REQUEST;
-    else
-        tcode = TCODE_WRITE_QUADLET_REQUEST;
-
-    return do_transaction(cam, tcode, offset, quads, NULL, num_quads);
+    return do_transaction(cam, offset, quads, NULL, num_quads);
 }
 
 static dc1394error_t
@@ -660,6 +995,9 @@ juju_dispatch = {
 
     .camera_read = dc1394_juju_camera_read,
     .camera_write = dc1394_juju_camera_write,
+    .camera_submit = dc1394_juju_camera_submit,
+    .camera_poll = dc1394_juju_camera_poll,
+    .camera_cancel = dc1394_juju_camera_cancel,
 
     .reset_bus = dc1394_juju_reset_bus,
     .camera_print_info = dc1394_juju_camera_print_info,
@@ -669,10 +1007,16 @@ juju_dispatch = {
     .get_broadcast = dc1394_juju_get_broadcast,
 
     .capture_setup = dc1394_juju_capture_setup,
+    .capture_setup_with_buffers = dc1394_juju_capture_setup_with_buffers,
     .capture_stop = dc1394_juju_capture_stop,
     .capture_dequeue = dc1394_juju_capture_dequeue,
     .capture_enqueue = dc1394_juju_capture_enqueue,
     .capture_get_fileno = dc1394_juju_capture_get_fileno,
+    .capture_is_frame_corrupt = dc1394_juju_capture_is_frame_corrupt,
+
+    .monitor_start = dc1394_juju_monitor_start,
+    .monitor_stop = dc1394_juju_monitor_stop,
+    .monitor_update = dc1394_juju_monitor_update,
 
     //.iso_allocate_channel = dc1394_juju_iso_allocate_channel,
 };
@@ -31,7 +31,8 @@
 #include "offsets.h"
 
 struct _platform_t {
-    int dummy;
+    /* Watches /dev for device files, -1 if not */
+    int inotify_fd;
 };
 
 typedef struct _juju_iso_info {
@@ -49,6 +50,8 @@ struct _platform_camera_t {
     int generation;
     uint32_t node_id;
     int max_response_quads;
+    /* Requests waiting to be sent again, see juju_complete_request */
+    platform_request_t * retries;
     juju_iso_info *iso_resources;
     uint8_t header_size;
     uint8_t broadcast_enabled;
@@ -63,6 +66,11 @@ struct _platform_camera_t {
     uint32_t flags;
     unsigned int num_frames;
     int current;
+    int frames_ready;
+    uint32_t packets_per_descriptor;
+    uint32_t frames_per_interrupt;
+    struct fw_cdev_event_iso_interrupt *event;
+    size_t event_size;
 
     unsigned int iso_channel;
     int capture_is_set;
@@ -73,14 +81,22 @@ struct _platform_camera_t {
 
 struct juju_frame {
     dc1394video_frame_t                 frame;
+    unsigned char                  *dma;
     size_t                         size;
     struct fw_cdev_iso_packet        *packets;
+    int                            interrupt;
+    int                            corrupt;
 };
 
 dc1394error_t
 dc1394_juju_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
         uint32_t flags);
 
+dc1394error_t
+dc1394_juju_capture_setup_with_buffers(platform_camera_t *craw,
+        uint32_t num_buffers, uint32_t flags, unsigned char ** buffers,
+        size_t buffer_size);
+
 dc1394error_t
 dc1394_juju_capture_stop(platform_camera_t *craw);
 
@@ -95,6 +111,10 @@ dc1394_juju_capture_enqueue (platform_camera_t * craw,
 int
 dc1394_juju_capture_get_fileno (platform_camera_t * craw);
 
+dc1394bool_t
+dc1394_juju_capture_is_frame_corrupt (platform_camera_t * craw,
+        dc1394video_frame_t * frame);
+
 dc1394error_t
 juju_iso_allocate (platform_camera_t *cam, uint64_t allowed_channels,
         int bandwidth_units, juju_iso_info **out);
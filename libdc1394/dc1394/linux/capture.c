@@ -35,6 +35,7 @@
 #include <fcntl.h>
 #include <string.h>
 #include <errno.h>
+#include <inttypes.h>
 #if HAVE_SYS_MMAN_H
 #include <sys/mman.h>
 #endif
@@ -100,11 +101,14 @@ open_dma_device(platform_camera_t * craw)
 
 ******************************************************/
 static dc1394error_t
-capture_linux_setup(platform_camera_t * craw, uint32_t num_dma_buffers)
+capture_linux_setup(platform_camera_t * craw, uint32_t num_dma_buffers,
+                    unsigned char ** buffers)
 {
     struct video1394_mmap vmmap;
     struct video1394_wait vwait;
+    capture_mempolicy_t mempolicy;
     uint32_t i;
+    int retval;
     dc1394video_frame_t * f;
 
     memset(&vmmap, 0, sizeof(vmmap));
@@ -121,8 +125,12 @@ capture_linux_setup(platform_camera_t * craw, uint32_t num_dma_buffers)
     vmmap.buf_size= craw->capture.frames[0].total_bytes; //number of bytes needed
     vmmap.channel= craw->iso_channel;
 
-    /* tell the video1394 system that we want to listen to the given channel */
-    if (ioctl(craw->capture.dma_fd, VIDEO1394_IOC_LISTEN_CHANNEL, &vmmap) < 0) {
+    /* tell the video1394 system that we want to listen to the given channel.
+       This is where the kernel allocates the DMA ring. */
+    capture_enter_numa_node (craw->camera, &mempolicy);
+    retval = ioctl(craw->capture.dma_fd, VIDEO1394_IOC_LISTEN_CHANNEL, &vmmap);
+    capture_leave_numa_node (&mempolicy);
+    if (retval < 0) {
         dc1394_log_error("VIDEO1394_IOC_LISTEN_CHANNEL ioctl failed: %s", strerror(errno));
         close (craw->capture.dma_fd);
         return DC1394_IOCTL_FAILURE;
@@ -176,13 +184,18 @@ capture_linux_setup(platform_camera_t * craw, uint32_t num_dma_buffers)
     }
 
     craw->capture.dma_buffer_size= vmmap.buf_size * vmmap.nb_buffers;
+    capture_lock_buffer (craw->camera, (void *) craw->capture.dma_ring_buffer,
+            craw->capture.dma_buffer_size);
 
     for (i = 0; i < num_dma_buffers; i++) {
         f = craw->capture.frames + i;
         if (i > 0)
             memcpy (f, craw->capture.frames, sizeof (dc1394video_frame_t));
-        f->image = (unsigned char *)(craw->capture.dma_ring_buffer +
-                                     i * craw->capture.dma_frame_size);
+        if (buffers)
+            f->image = buffers[i];
+        else
+            f->image = (unsigned char *)(craw->capture.dma_ring_buffer +
+                                         i * craw->capture.dma_frame_size);
         f->id = i;
     }
 
@@ -207,9 +220,11 @@ dc1394_capture_set_device_filename(dc1394camera_t* camera, char *filename)
     return DC1394_SUCCESS;
 }
 
-dc1394error_t
-dc1394_linux_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
-                     uint32_t flags)
+/* video1394 only receives into its own ring: with user buffers, frames
+ * are copied out of it when dequeued. */
+static dc1394error_t
+capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
+              uint32_t flags, unsigned char ** buffers, size_t buffer_size)
 {
     dc1394camera_t * camera = craw->camera;
     dc1394error_t err;
@@ -261,12 +276,18 @@ dc1394_linux_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
     if (err != DC1394_SUCCESS)
         goto fail;
 
+    if (buffers && buffer_size < craw->capture.frames[0].total_bytes) {
+        dc1394_log_error("Buffers of %zu bytes are too small for frames of %"PRIu64" bytes",
+                         buffer_size, craw->capture.frames[0].total_bytes);
+        goto fail;
+    }
+
     if (dc1394_video_get_iso_channel (camera, &craw->iso_channel)
         != DC1394_SUCCESS)
         goto fail;
 
     // the capture_is_set flag is set inside this function:
-    err=capture_linux_setup (craw, num_dma_buffers);
+    err=capture_linux_setup (craw, num_dma_buffers, buffers);
     if (err != DC1394_SUCCESS)
         goto fail;
 
@@ -301,6 +322,21 @@ dc1394_linux_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
     return DC1394_FAILURE;
 }
 
+dc1394error_t
+dc1394_linux_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
+                     uint32_t flags)
+{
+    return capture_setup (craw, num_dma_buffers, flags, NULL, 0);
+}
+
+dc1394error_t
+dc1394_linux_capture_setup_with_buffers(platform_camera_t *craw,
+                     uint32_t num_buffers, uint32_t flags,
+                     unsigned char ** buffers, size_t buffer_size)
+{
+    return capture_setup (craw, num_buffers, flags, buffers, buffer_size);
+}
+
 /*****************************************************
  CAPTURE_STOP
 *****************************************************/
@@ -379,6 +415,7 @@ dc1394_linux_capture_dequeue (platform_camera_t * craw,
     dc1394capture_t * capture = &(craw->capture);
     struct video1394_wait vwait;
     dc1394video_frame_t * frame_tmp;
+    const unsigned char * dma;
     int cb;
     int result=-1;
 
@@ -422,6 +459,11 @@ dc1394_linux_capture_dequeue (platform_camera_t * craw,
 
     capture->dma_last_buffer = cb;
 
+    /* The one copy of user buffer capture */
+    dma = capture->dma_ring_buffer + cb * capture->dma_frame_size;
+    if (frame_tmp->image != dma)
+        memcpy (frame_tmp->image, dma, frame_tmp->image_bytes);
+
     frame_tmp->frames_behind = vwait.buffer;
     frame_tmp->timestamp = (uint64_t) vwait.filltime.tv_sec * 1000000 + vwait.filltime.tv_usec;
 
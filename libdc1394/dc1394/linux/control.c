@@ -100,13 +100,86 @@ read_retry (struct raw1394_handle * handle, nodeid_t node, nodeaddr_t addr,
     return -1;
 }
 
+/* Quadlets of the configuration ROM read in one transaction, which fits in
+   the payload of the slowest speed, 512 bytes at S100 */
+#define ROM_BLOCK_QUADS 64
+
+/* Reads up to 256 quadlets of a configuration ROM, in blocks while the
+ * node accepts them. Returns how many could be read, or -1. */
+static int
+read_config_rom (raw1394handle_t handle, nodeid_t node, uint32_t * rom)
+{
+    quadlet_t quads[ROM_BLOCK_QUADS];
+    int k, n, i, block = 1;
+
+    if (read_retry (handle, node, CONFIG_ROM_BASE + 0x400, 4, quads) < 0)
+        return -1;
+    rom[0] = ntohl (quads[0]);
+
+    for (k = 1; k < 256; k += n) {
+        n = 256 - k < ROM_BLOCK_QUADS ? 256 - k : ROM_BLOCK_QUADS;
+        if (block && read_retry (handle, node, CONFIG_ROM_BASE + 0x400 + 4*k,
+                    4*n, quads) == 0) {
+            for (i = 0; i < n; i++)
+                rom[k + i] = ntohl (quads[i]);
+            continue;
+        }
+
+        /* Either the node does not do block reads, or the ROM ends in this
+           block: go on one quadlet at a time */
+        block = 0;
+        for (i = 0; i < n; i++) {
+            if (read_retry (handle, node, CONFIG_ROM_BASE + 0x400 + 4*(k + i),
+                        4, quads) < 0)
+                return k + i;
+            rom[k + i] = ntohl (quads[0]);
+        }
+    }
+    return 256;
+}
+
+/* A node to look at, see dc1394_linux_get_device_list */
+typedef struct {
+    int port, node;
+    platform_device_t * device;
+} linux_probe_t;
+
+static void
+probe_node (void * arg, int i)
+{
+    linux_probe_t * probe = (linux_probe_t *) arg + i;
+    platform_device_t * device;
+    raw1394handle_t handle;
+
+    handle = raw1394_new_handle_on_port (probe->port);
+    if (!handle)
+        return;
+
+    device = malloc (sizeof (platform_device_t));
+    if (device) {
+        device->num_quads = read_config_rom (handle, 0xFFC0 | probe->node,
+                device->config_rom);
+        device->port = probe->port;
+        device->node = probe->node;
+        device->generation = raw1394_get_generation (handle);
+        if (device->num_quads < 0) {
+            free (device);
+            device = NULL;
+        }
+    }
+    probe->device = device;
+    raw1394_destroy_handle (handle);
+}
+
+/* The nodes of all ports are read at the same time, each with its own
+ * handle, and listed by port and node. */
 static platform_device_list_t *
 dc1394_linux_get_device_list (platform_t * p)
 {
     platform_device_list_t * list;
-    uint32_t allocated_size = 64;
+    linux_probe_t * probes = NULL, * tmp;
     raw1394handle_t handle;
-    int num_ports, i;
+    int num_ports, num_probes = 0, i, j;
 
     handle = raw1394_new_handle ();
     if (!handle)
@@ -116,17 +189,8 @@ dc1394_linux_get_device_list (platform_t * p)
     dc1394_log_debug ("linux: Found %d port(s)", num_ports);
     raw1394_destroy_handle (handle);
 
-    list = calloc (1, sizeof (platform_device_list_t));
-    if (!list)
-        return NULL;
-    list->devices = malloc(allocated_size * sizeof(platform_device_t *));
-    if (!list->devices) {
-        free (list);
-        return NULL;
-    }
-
     for (i = 0; i < num_ports; i++) {
-        int num_nodes, j;
+        int num_nodes;
 
         handle = raw1394_new_handle_on_port (i);
         if (!handle)
@@ -135,42 +199,37 @@ dc1394_linux_get_device_list (platform_t * p)
         num_nodes = raw1394_get_nodecount (handle);
         dc1394_log_debug ("linux: Port %d opened with %d node(s)",
                 i, num_nodes);
+        raw1394_destroy_handle (handle);
+
+        tmp = realloc (probes, (num_probes + num_nodes) * sizeof (linux_probe_t));
+        if (!tmp)
+            break;
+        probes = tmp;
         for (j = 0; j < num_nodes; j++) {
-            platform_device_t * device;
-            uint32_t quad;
-            int k;
-
-            if (read_retry (handle, 0xFFC0 | j, CONFIG_ROM_BASE + 0x400, 4, &quad) < 0)
-                continue;
-
-            device = malloc (sizeof (platform_device_t));
-            if (!device)
-                continue;
-
-            device->config_rom[0] = ntohl (quad);
-            device->port = i;
-            device->node = j;
-            device->generation = raw1394_get_generation (handle);
-            for (k = 1; k < 256; k++) {
-                if (read_retry (handle, 0xFFC0 | j, CONFIG_ROM_BASE + 0x400 + 4*k, 4, &quad) < 0)
-                    break;
-                device->config_rom[k] = ntohl (quad);
-            }
-            device->num_quads = k;
-
-            list->devices[list->num_devices] = device;
-            list->num_devices++;
-
-            if (list->num_devices >= allocated_size) {
-                allocated_size += 64;
-                list->devices = realloc (list->devices, allocated_size * sizeof (platform_device_t *));
-                if (!list->devices)
-                    return NULL;
-            }
+            probes[num_probes].port = i;
+            probes[num_probes].node = j;
+            probes[num_probes].device = NULL;
+            num_probes++;
         }
-        raw1394_destroy_handle (handle);
     }
 
+    parallel_for (num_probes, probe_node, probes);
+
+    list = calloc (1, sizeof (platform_device_list_t));
+    if (list)
+        list->devices = malloc ((num_probes + 1) * sizeof (platform_device_t *));
+    if (!list || !list->devices) {
+        for (i = 0; i < num_probes; i++)
+            free (probes[i].device);
+        free (probes);
+        free (list);
+        return NULL;
+    }
+    for (i = 0; i < num_probes; i++)
+        if (probes[i].device)
+            list->devices[list->num_devices++] = probes[i].device;
+    free (probes);
+
     return list;
 }
 
@@ -252,10 +311,12 @@ static dc1394error_t
 dc1394_linux_camera_read (platform_camera_t * cam, uint64_t offset,
         uint32_t * quads, int num_quads)
 {
-    int i, retval, retry = DC1394_MAX_RETRIES;
+    int i, retval, delay;
+    platform_retry_t retry;
 
     /* retry a few times if necessary (addition by PDJ) */
-    while(retry--)  {
+    retry_begin (&retry);
+    while (1) {
 #ifdef DC1394_DEBUG_LOWEST_LEVEL
         fprintf(stderr,"get %d regs at 0x%llx : ",
                 num_quads, offset + CONFIG_ROM_BASE);
@@ -266,26 +327,33 @@ dc1394_linux_camera_read (platform_camera_t * cam, uint64_t offset,
 #endif
 
         if (!retval)
-            goto out;
+            break;
+        /* libraw1394 reports type and address errors as EPERM and EINVAL */
+        else if (errno == EPERM || errno == EINVAL)
+            return DC1394_FUNCTION_NOT_SUPPORTED;
         else if (errno != EAGAIN)
-            return ( retval ? DC1394_RAW1394_FAILURE : DC1394_SUCCESS );
+            return DC1394_RAW1394_FAILURE;
 
         // usleep is executed only if the read fails!!!
-        usleep(DC1394_SLOW_DOWN);
+        delay = retry_next (cam->camera, &retry, RETRY_BUSY, DC1394_MAX_RETRIES);
+        if (delay < 0)
+            return DC1394_RAW1394_FAILURE;
+        usleep (delay);
     }
 
- out:
+
     /* conditionally byte swap the value */
     for (i = 0; i < num_quads; i++)
         quads[i] = ntohl (quads[i]);
-    return ( retval ? DC1394_RAW1394_FAILURE : DC1394_SUCCESS );
+    return DC1394_SUCCESS;
 }
 
 static dc1394error_t
 dc1394_linux_camera_write (platform_camera_t * cam, uint64_t offset,
         const uint32_t * quads, int num_quads)
 {
-    int i, retval, retry= DC1394_MAX_RETRIES;
+    int i, retval, delay;
+    platform_retry_t retry;
     uint32_t value[num_quads];
 
     /* conditionally byte swap the value (addition by PDJ) */
@@ -293,7 +361,8 @@ dc1394_linux_camera_write (platform_camera_t * cam, uint64_t offset,
         value[i] = htonl (quads[i]);
 
     /* retry a few times if necessary */
-    while(retry--) {
+    retry_begin (&retry);
+    while (1) {
 #ifdef DC1394_DEBUG_LOWEST_LEVEL
         fprintf(stderr,"set %d regs at 0x%llx to value 0x%lx [...]\n",
                 num_quads, offset + CONFIG_ROM_BASE, value[0]);
@@ -303,11 +372,12 @@ dc1394_linux_camera_write (platform_camera_t * cam, uint64_t offset,
         if (!retval || (errno != EAGAIN))
             return ( retval ? DC1394_RAW1394_FAILURE : DC1394_SUCCESS );
 
-        // usleep is executed only if the read fails!!!
-        usleep(DC1394_SLOW_DOWN);
+        // usleep is executed only if the write fails!!!
+        delay = retry_next (cam->camera, &retry, RETRY_BUSY, DC1394_MAX_RETRIES);
+        if (delay < 0)
+            return DC1394_RAW1394_FAILURE;
+        usleep (delay);
     }
-
-    return DC1394_RAW1394_FAILURE;
 }
 
 static dc1394error_t
@@ -475,10 +545,13 @@ linux_dispatch = {
     .read_cycle_timer = dc1394_linux_read_cycle_timer,
 
     .capture_setup = dc1394_linux_capture_setup,
+    .capture_setup_with_buffers = dc1394_linux_capture_setup_with_buffers,
     .capture_stop = dc1394_linux_capture_stop,
     .capture_dequeue = dc1394_linux_capture_dequeue,
     .capture_enqueue = dc1394_linux_capture_enqueue,
     .capture_get_fileno = dc1394_linux_capture_get_fileno,
+    /* video1394 has no poll support */
+    .capture_fileno_not_pollable = 1,
 
     .iso_set_persist = dc1394_linux_iso_set_persist,
     .iso_allocate_channel = dc1394_linux_iso_allocate_channel,
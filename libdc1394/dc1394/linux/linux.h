@@ -76,6 +76,11 @@ dc1394error_t
 dc1394_linux_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
         uint32_t flags);
 
+dc1394error_t
+dc1394_linux_capture_setup_with_buffers(platform_camera_t *craw,
+                     uint32_t num_buffers, uint32_t flags,
+                     unsigned char ** buffers, size_t buffer_size);
+
 dc1394error_t
 dc1394_linux_capture_stop(platform_camera_t *craw);
 
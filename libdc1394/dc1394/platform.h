@@ -30,12 +30,41 @@ typedef struct _platform_t platform_t;
 typedef struct _platform_device_t platform_device_t;
 typedef struct _platform_camera_t platform_camera_t;
 
+/* Progress of the retries of a transaction, see retry_next() */
+typedef struct _platform_retry_t {
+    uint32_t attempts;
+    uint32_t delay;
+    uint64_t start;
+    /* When to send again, on the clock of retry_now() */
+    uint64_t due;
+} platform_retry_t;
+
+/* An asynchronous register transaction. The caller fills the first four
+ * fields and keeps the structure around until done is set. */
+typedef struct _platform_request_t {
+    uint64_t offset;
+    uint32_t * quads;
+    uint32_t num_quads;
+    dc1394bool_t write;
+
+    /* Set by the platform when the transaction has completed */
+    int done;
+    dc1394error_t result;
+    /* Private to the platform */
+    platform_retry_t retry;
+    struct _platform_request_t * next;
+} platform_request_t;
+
 typedef struct _platform_device_list_t {
     platform_t * p;
     platform_device_t ** devices;
     int num_devices;
 } platform_device_list_t;
 
+/* Called by monitor_update for a device that appeared, or that is about to
+ * be freed */
+typedef void (*platform_monitor_callback_t)(void * arg, platform_device_t *);
+
 typedef struct _platform_dispatch_t {
     platform_t * (*platform_new)(void);
     void (*platform_free)(platform_t *);
@@ -49,10 +78,19 @@ typedef struct _platform_dispatch_t {
     void (*camera_free)(platform_camera_t *);
     void (*camera_set_parent)(platform_camera_t *, dc1394camera_t *);
 
+    /* Both return DC1394_FUNCTION_NOT_SUPPORTED when the device rejects
+     * the transaction, e.g. with a type or address error */
     dc1394error_t (*camera_read)(platform_camera_t *, uint64_t,
             uint32_t *, int);
     dc1394error_t (*camera_write)(platform_camera_t *, uint64_t,
             const uint32_t *, int);
+    /* Optional: sends a request without waiting for its completion, and
+     * handles the completions that arrived, or waits for one */
+    dc1394error_t (*camera_submit)(platform_camera_t *, platform_request_t *);
+    dc1394error_t (*camera_poll)(platform_camera_t *, dc1394bool_t);
+    /* Optional: withdraws a request that is not in flight, e.g. waiting to
+     * be retried, so that it can be freed before completing */
+    dc1394error_t (*camera_cancel)(platform_camera_t *, platform_request_t *);
 
     dc1394error_t (*reset_bus)(platform_camera_t *);
     dc1394error_t (*read_cycle_timer)(platform_camera_t *, uint32_t *,
@@ -64,6 +102,8 @@ typedef struct _platform_dispatch_t {
     dc1394error_t (*get_broadcast)(platform_camera_t *, dc1394bool_t *);
 
     dc1394error_t (*capture_setup)(platform_camera_t *, uint32_t, uint32_t);
+    dc1394error_t (*capture_setup_with_buffers)(platform_camera_t *, uint32_t,
+            uint32_t, unsigned char **, size_t);
     dc1394error_t (*capture_stop)(platform_camera_t *);
 
     dc1394error_t (*capture_dequeue)(platform_camera_t *,
@@ -72,6 +112,9 @@ typedef struct _platform_dispatch_t {
             dc1394video_frame_t *);
 
     int (*capture_get_fileno)(platform_camera_t *);
+    /* Set when the descriptor of capture_get_fileno cannot be waited on:
+     * it is always readable, frame or not */
+    int capture_fileno_not_pollable;
     dc1394bool_t (*capture_is_frame_corrupt)(platform_camera_t *,
             dc1394video_frame_t *);
 
@@ -81,6 +124,16 @@ typedef struct _platform_dispatch_t {
     dc1394error_t (*iso_release_channel)(platform_camera_t *, int);
     dc1394error_t (*iso_allocate_bandwidth)(platform_camera_t *, int);
     dc1394error_t (*iso_release_bandwidth)(platform_camera_t *, int);
+
+    /* Optional: watches for devices appearing and disappearing. monitor_start
+     * returns an fd that becomes readable when monitor_update has something
+     * to do; monitor_update adds and frees devices of the list, and calls
+     * back for each. */
+    int (*monitor_start)(platform_t *);
+    void (*monitor_stop)(platform_t *);
+    void (*monitor_update)(platform_t *, platform_device_list_t *,
+            platform_monitor_callback_t added,
+            platform_monitor_callback_t removed, void * arg);
 } platform_dispatch_t;
 
 
@@ -0,0 +1,1041 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Recording of captured frames to disk
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* For O_DIRECT, and 64-bit file offsets on 32-bit systems */
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "recorder.h"
+#include "container.h"
+#include "internal.h"
+
+#if defined HAVE_PTHREAD_H && defined HAVE_UNISTD_H
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+/* O_DIRECT wants the offset, size and address of every write aligned on
+ * the logical block size of the device, which is at most a page */
+#define ALIGNMENT 4096
+
+struct staging_buffer {
+    unsigned char * data;
+    size_t used;
+    uint64_t offset;
+    dc1394recorder_file_t * file;
+    struct staging_buffer * next;
+};
+
+/* A frame kept in the ring of a pre-trigger file */
+struct ring_entry {
+    dc1394container_record_t record;
+    uint64_t offset;
+    uint64_t length;
+    int compressed;
+    /* Copied in, and to be saved */
+    int ready;
+    int flush;
+};
+
+/* The frames of a pre-trigger file, oldest at head.  Their data is laid
+ * out in the same order in a circular byte buffer. */
+struct pretrigger {
+    dc1394pretrigger_options_t options;
+    unsigned char * data;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t flush;
+    struct ring_entry * entries;
+    uint32_t capacity;
+    uint32_t head;
+    uint32_t count;
+    uint64_t head_offset;
+    uint64_t tail_offset;
+    uint64_t used;
+    uint32_t post_left;
+    int stop;
+
+    /* Thread saving the frames, and where it decompresses them */
+    pthread_t thread;
+    int thread_created;
+    unsigned char * scratch;
+    uint64_t scratch_size;
+
+    uint64_t dropped;
+    uint64_t flush_bytes;
+    uint64_t flush_time;
+};
+
+struct __dc1394recorder_file_t {
+    dc1394recorder_t * recorder;
+    int fd;
+    int direct;
+    /* Set for files opened by dc1394_recorder_attach() */
+    dc1394camera_t * camera;
+
+    /* Buffer being filled and index of the records, only touched by the
+     * writing thread */
+    struct staging_buffer * current;
+    uint64_t size;
+    uint64_t next_offset;
+    dc1394container_index_t * index;
+    uint64_t index_size;
+    uint64_t count;
+    uint64_t sequence;
+    struct pretrigger * ring;
+
+    /* Under the recorder mutex */
+    int in_flight;
+    int error;
+
+    dc1394recorder_file_t * next;
+};
+
+struct __dc1394recorder_t {
+    dc1394recorder_options_t options;
+    unsigned char * pool;
+    struct staging_buffer * buffers;
+
+    pthread_mutex_t mutex;
+    /* Signalled when a buffer is queued for writing, when one is free again
+     * and when the last write of a file is done */
+    pthread_cond_t work;
+    pthread_cond_t buffer_free;
+    pthread_cond_t written;
+    struct staging_buffer * free_list;
+    struct staging_buffer * queue_head;
+    struct staging_buffer * queue_tail;
+    int stop;
+
+    pthread_t * threads;
+    uint32_t num_threads;
+
+    dc1394recorder_file_t * files;
+    dc1394recorder_stats_t stats;
+};
+
+static int
+write_buffer (dc1394recorder_file_t * file, struct staging_buffer * b,
+        size_t * written)
+{
+    /* The last buffer of a file is padded, and the file truncated later */
+    size_t len = file->direct ?
+        (b->used + ALIGNMENT - 1) & ~(size_t) (ALIGNMENT - 1) : b->used;
+    size_t done = 0;
+
+    memset (b->data + b->used, 0, len - b->used);
+    while (done < len) {
+        ssize_t n = pwrite (file->fd, b->data + done, len - done,
+                b->offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return n < 0 ? errno : EIO;
+        done += n;
+    }
+    *written = len;
+    return 0;
+}
+
+static void *
+worker_thread (void * arg)
+{
+    dc1394recorder_t * rec = arg;
+
+    pthread_mutex_lock (&rec->mutex);
+    while (1) {
+        struct staging_buffer * b;
+        dc1394recorder_file_t * file;
+        size_t written = 0;
+        int err;
+
+        while (!rec->queue_head && !rec->stop)
+            pthread_cond_wait (&rec->work, &rec->mutex);
+        if (!rec->queue_head)
+            break;
+
+        b = rec->queue_head;
+        rec->queue_head = b->next;
+        if (!rec->queue_head)
+            rec->queue_tail = NULL;
+        pthread_mutex_unlock (&rec->mutex);
+
+        file = b->file;
+        err = write_buffer (file, b, &written);
+
+        pthread_mutex_lock (&rec->mutex);
+        if (err) {
+            dc1394_log_error ("Recorder failed to write %zu bytes: %s",
+                    b->used, strerror (err));
+            rec->stats.errors++;
+            if (!file->error)
+                file->error = err;
+        }
+        else
+            rec->stats.bytes_written += written;
+
+        b->file = NULL;
+        b->next = rec->free_list;
+        rec->free_list = b;
+        pthread_cond_signal (&rec->buffer_free);
+
+        if (--file->in_flight == 0)
+            pthread_cond_broadcast (&rec->written);
+    }
+    pthread_mutex_unlock (&rec->mutex);
+
+    return NULL;
+}
+
+dc1394recorder_t *
+dc1394_recorder_new (const dc1394recorder_options_t * options)
+{
+    dc1394recorder_t * rec;
+    uint32_t i;
+
+    rec = calloc (1, sizeof (dc1394recorder_t));
+    if (!rec)
+        return NULL;
+    if (options)
+        rec->options = *options;
+    if (!rec->options.num_buffers)
+        rec->options.num_buffers = 16;
+    if (!rec->options.buffer_size)
+        rec->options.buffer_size = 4 * 1024 * 1024;
+    rec->options.buffer_size = (rec->options.buffer_size + ALIGNMENT - 1) &
+        ~(ALIGNMENT - 1);
+    if (!rec->options.num_threads)
+        rec->options.num_threads = 2;
+
+    pthread_mutex_init (&rec->mutex, NULL);
+    pthread_cond_init (&rec->work, NULL);
+    pthread_cond_init (&rec->buffer_free, NULL);
+    pthread_cond_init (&rec->written, NULL);
+
+    if (posix_memalign ((void **) &rec->pool, ALIGNMENT,
+                (size_t) rec->options.num_buffers *
+                rec->options.buffer_size) != 0) {
+        rec->pool = NULL;
+        goto fail;
+    }
+    rec->buffers = calloc (rec->options.num_buffers,
+            sizeof (struct staging_buffer));
+    if (!rec->buffers)
+        goto fail;
+    for (i = 0; i < rec->options.num_buffers; i++) {
+        rec->buffers[i].data = rec->pool +
+            (size_t) i * rec->options.buffer_size;
+        rec->buffers[i].next = rec->free_list;
+        rec->free_list = rec->buffers + i;
+    }
+
+    rec->threads = calloc (rec->options.num_threads, sizeof (pthread_t));
+    if (!rec->threads)
+        goto fail;
+    for (; rec->num_threads < rec->options.num_threads; rec->num_threads++) {
+        if (pthread_create (rec->threads + rec->num_threads, NULL,
+                    worker_thread, rec) != 0) {
+            dc1394_log_error ("Failed to launch a recorder thread");
+            goto fail;
+        }
+    }
+    return rec;
+
+ fail:
+    dc1394_recorder_free (rec);
+    return NULL;
+}
+
+void
+dc1394_recorder_free (dc1394recorder_t * rec)
+{
+    uint32_t i;
+
+    if (!rec)
+        return;
+
+    while (rec->files) {
+        dc1394recorder_file_t * file = rec->files;
+        if (file->camera)
+            dc1394_recorder_detach (rec, file->camera);
+        else
+            dc1394_recorder_close (file);
+    }
+
+    pthread_mutex_lock (&rec->mutex);
+    rec->stop = 1;
+    pthread_cond_broadcast (&rec->work);
+    pthread_mutex_unlock (&rec->mutex);
+    for (i = 0; i < rec->num_threads; i++)
+        pthread_join (rec->threads[i], NULL);
+
+    free (rec->threads);
+    free (rec->buffers);
+    free (rec->pool);
+    pthread_cond_destroy (&rec->written);
+    pthread_cond_destroy (&rec->buffer_free);
+    pthread_cond_destroy (&rec->work);
+    pthread_mutex_destroy (&rec->mutex);
+    free (rec);
+}
+
+/* Hands the current buffer of a file over to the workers */
+static void
+submit_buffer (dc1394recorder_file_t * file)
+{
+    dc1394recorder_t * rec = file->recorder;
+    struct staging_buffer * b = file->current;
+
+    file->current = NULL;
+    b->next = NULL;
+
+    pthread_mutex_lock (&rec->mutex);
+    file->in_flight++;
+    if (rec->queue_tail)
+        rec->queue_tail->next = b;
+    else
+        rec->queue_head = b;
+    rec->queue_tail = b;
+    pthread_cond_signal (&rec->work);
+    pthread_mutex_unlock (&rec->mutex);
+}
+
+/* Copies bytes at the end of a file, through its staging buffers */
+static dc1394error_t
+stage_bytes (dc1394recorder_file_t * file, const void * data, uint64_t len)
+{
+    dc1394recorder_t * rec = file->recorder;
+    const unsigned char * src = data;
+
+    file->size += len;
+    while (len) {
+        struct staging_buffer * b = file->current;
+        size_t n;
+
+        if (!b) {
+            pthread_mutex_lock (&rec->mutex);
+            if (file->error) {
+                pthread_mutex_unlock (&rec->mutex);
+                return DC1394_FAILURE;
+            }
+            if (!rec->free_list)
+                rec->stats.stalls++;
+            while (!rec->free_list)
+                pthread_cond_wait (&rec->buffer_free, &rec->mutex);
+            b = rec->free_list;
+            rec->free_list = b->next;
+            pthread_mutex_unlock (&rec->mutex);
+
+            b->file = file;
+            b->used = 0;
+            b->offset = file->next_offset;
+            file->next_offset += rec->options.buffer_size;
+            file->current = b;
+        }
+
+        n = rec->options.buffer_size - b->used;
+        if (n > len)
+            n = len;
+        memcpy (b->data + b->used, src, n);
+        b->used += n;
+        src += n;
+        len -= n;
+
+        if (b->used == rec->options.buffer_size)
+            submit_buffer (file);
+    }
+    return DC1394_SUCCESS;
+}
+
+dc1394recorder_file_t *
+dc1394_recorder_open (dc1394recorder_t * rec, const char * path)
+{
+    dc1394recorder_file_t * file;
+    dc1394container_header_t header;
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+    if (!rec || !path)
+        return NULL;
+
+    file = calloc (1, sizeof (dc1394recorder_file_t));
+    if (!file)
+        return NULL;
+    file->recorder = rec;
+    file->fd = -1;
+
+#ifdef O_DIRECT
+    if (!(rec->options.flags & DC1394_RECORDER_FLAGS_BUFFERED_IO)) {
+        file->fd = open (path, flags | O_DIRECT, 0644);
+        if (file->fd >= 0)
+            file->direct = 1;
+        /* Some file systems (tmpfs) refuse O_DIRECT */
+        else if (errno == EINVAL)
+            dc1394_log_warning ("%s does not support direct I/O, writing "
+                    "through the page cache", path);
+    }
+#endif
+    if (file->fd < 0)
+        file->fd = open (path, flags, 0644);
+    if (file->fd < 0) {
+        dc1394_log_error ("Failed to create %s: %s", path, strerror (errno));
+        free (file);
+        return NULL;
+    }
+
+#ifdef HAVE_POSIX_FALLOCATE
+    if (rec->options.preallocate) {
+        int err = posix_fallocate (file->fd, 0, rec->options.preallocate);
+        if (err)
+            dc1394_log_warning ("Failed to preallocate %s: %s", path,
+                    strerror (err));
+    }
+#endif
+
+    container_fill_header (&header);
+    if (stage_bytes (file, &header, sizeof header) != DC1394_SUCCESS) {
+        dc1394_log_error ("Failed to write the header of %s", path);
+        if (file->current) {
+            pthread_mutex_lock (&rec->mutex);
+            file->current->next = rec->free_list;
+            rec->free_list = file->current;
+            pthread_cond_signal (&rec->buffer_free);
+            pthread_mutex_unlock (&rec->mutex);
+        }
+        close (file->fd);
+        free (file);
+        return NULL;
+    }
+
+    pthread_mutex_lock (&rec->mutex);
+    file->next = rec->files;
+    rec->files = file;
+    pthread_mutex_unlock (&rec->mutex);
+    return file;
+}
+
+/* Appends a record to a file, through its staging buffers */
+static dc1394error_t
+write_record (dc1394recorder_file_t * file,
+        const dc1394container_record_t * record, const unsigned char * image)
+{
+    static const unsigned char zeros[DC1394_CONTAINER_ALIGNMENT];
+    dc1394recorder_t * rec = file->recorder;
+    dc1394error_t err;
+
+    if (file->count == file->index_size) {
+        uint64_t size = file->index_size ? 2 * file->index_size : 1024;
+        dc1394container_index_t * index = realloc (file->index,
+                size * sizeof (dc1394container_index_t));
+        if (!index)
+            return DC1394_MEMORY_ALLOCATION_FAILURE;
+        file->index = index;
+        file->index_size = size;
+    }
+    file->index[file->count].offset = file->size;
+    file->index[file->count].sequence = record->sequence;
+    file->index[file->count].timestamp = record->timestamp;
+
+    err = stage_bytes (file, record, sizeof *record);
+    if (err == DC1394_SUCCESS)
+        err = stage_bytes (file, image, record->image_bytes);
+    if (err == DC1394_SUCCESS)
+        err = stage_bytes (file, zeros,
+                record->record_size - sizeof *record - record->image_bytes);
+    if (err != DC1394_SUCCESS)
+        return err;
+    file->count++;
+
+    pthread_mutex_lock (&rec->mutex);
+    rec->stats.frames++;
+    rec->stats.bytes += record->record_size;
+    pthread_mutex_unlock (&rec->mutex);
+
+    return DC1394_SUCCESS;
+}
+
+static uint64_t
+now_us (void)
+{
+    struct timeval tv;
+
+    gettimeofday (&tv, NULL);
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void
+ring_pop (struct pretrigger * ring)
+{
+    ring->used -= ring->entries[ring->head].length;
+    ring->head = (ring->head + 1) % ring->capacity;
+    ring->count--;
+    if (ring->count)
+        ring->head_offset = ring->entries[ring->head].offset;
+    else
+        ring->head_offset = ring->tail_offset = 0;
+}
+
+/* Finds room for length bytes after the newest frame, or returns -1 */
+static int64_t
+ring_reserve (struct pretrigger * ring, uint64_t length)
+{
+    uint64_t size = ring->options.ring_size;
+
+    if (ring->count == 0)
+        return length <= size ? 0 : -1;
+    if (ring->tail_offset > ring->head_offset) {
+        if (size - ring->tail_offset >= length)
+            return ring->tail_offset;
+        /* Wrap around, keeping head and tail apart */
+        if (length < ring->head_offset)
+            return 0;
+        return -1;
+    }
+    if (ring->head_offset - ring->tail_offset > length)
+        return ring->tail_offset;
+    return -1;
+}
+
+/* Keeps a frame in the ring of a pre-trigger file */
+static dc1394error_t
+ring_push (dc1394recorder_file_t * file,
+        const dc1394container_record_t * record, const unsigned char * image)
+{
+    struct pretrigger * ring = file->ring;
+    uint64_t length = record->image_bytes;
+    uint32_t slot;
+    int64_t offset;
+    int compress = 0;
+
+#ifdef HAVE_LIBZ
+    if (ring->options.flags & DC1394_PRETRIGGER_FLAGS_COMPRESS) {
+        compress = 1;
+        length = compressBound (record->image_bytes);
+    }
+#endif
+
+    pthread_mutex_lock (&ring->mutex);
+
+    /* Forget what is too old, unless it is to be saved */
+    while (ring->count && !ring->entries[ring->head].flush &&
+            ((ring->options.max_frames &&
+              ring->count >= ring->options.max_frames) ||
+             (ring->options.max_age && record->timestamp >
+              ring->entries[ring->head].record.timestamp +
+              ring->options.max_age)))
+        ring_pop (ring);
+
+    while ((offset = ring_reserve (ring, length)) < 0 && ring->count &&
+            !ring->entries[ring->head].flush)
+        ring_pop (ring);
+
+    if (offset < 0) {
+        ring->dropped++;
+        pthread_mutex_unlock (&ring->mutex);
+        return DC1394_SUCCESS;
+    }
+
+    if (ring->count == ring->capacity) {
+        uint32_t capacity = ring->capacity ? 2 * ring->capacity : 256;
+        struct ring_entry * entries = malloc (capacity * sizeof *entries);
+        uint32_t i;
+
+        if (!entries) {
+            ring->dropped++;
+            pthread_mutex_unlock (&ring->mutex);
+            return DC1394_MEMORY_ALLOCATION_FAILURE;
+        }
+        for (i = 0; i < ring->count; i++)
+            entries[i] = ring->entries[(ring->head + i) % ring->capacity];
+        free (ring->entries);
+        ring->entries = entries;
+        ring->capacity = capacity;
+        ring->head = 0;
+    }
+
+    slot = (ring->head + ring->count) % ring->capacity;
+    ring->entries[slot].record = *record;
+    ring->entries[slot].offset = offset;
+    ring->entries[slot].length = length;
+    ring->entries[slot].compressed = compress;
+    ring->entries[slot].ready = 0;
+    ring->entries[slot].flush = 0;
+    if (ring->post_left) {
+        ring->entries[slot].flush = 1;
+        ring->post_left--;
+    }
+    if (ring->count == 0)
+        ring->head_offset = offset;
+    ring->count++;
+    ring->tail_offset = offset + length;
+    ring->used += length;
+    pthread_mutex_unlock (&ring->mutex);
+
+    /* Only this thread adds frames, and the saving thread does not touch
+     * them before they are ready: copy without the lock */
+#ifdef HAVE_LIBZ
+    if (compress) {
+        uLongf n = length;
+        if (compress2 (ring->data + offset, &n, image, record->image_bytes,
+                    1) == Z_OK)
+            length = n;
+        else
+            compress = 0;
+    }
+#endif
+    if (!compress)
+        memcpy (ring->data + offset, image, record->image_bytes);
+
+    pthread_mutex_lock (&ring->mutex);
+    slot = (ring->head + ring->count - 1) % ring->capacity;
+    if (!compress)
+        length = record->image_bytes;
+    ring->entries[slot].compressed = compress;
+    ring->used -= ring->entries[slot].length - length;
+    ring->entries[slot].length = length;
+    ring->tail_offset = offset + length;
+    ring->entries[slot].ready = 1;
+    if (ring->entries[slot].flush)
+        pthread_cond_signal (&ring->flush);
+    pthread_mutex_unlock (&ring->mutex);
+
+    return DC1394_SUCCESS;
+}
+
+/* Saves the frames of the ring that were triggered, oldest first */
+static void *
+flush_thread (void * arg)
+{
+    dc1394recorder_file_t * file = arg;
+    struct pretrigger * ring = file->ring;
+
+    pthread_mutex_lock (&ring->mutex);
+    while (1) {
+        struct ring_entry e;
+        const unsigned char * image;
+        uint64_t start;
+
+        while (!(ring->count && ring->entries[ring->head].flush &&
+                    ring->entries[ring->head].ready) && !ring->stop)
+            pthread_cond_wait (&ring->flush, &ring->mutex);
+        /* Stopping only once all that was triggered is saved */
+        if (!(ring->count && ring->entries[ring->head].flush &&
+                    ring->entries[ring->head].ready))
+            break;
+        e = ring->entries[ring->head];
+        pthread_mutex_unlock (&ring->mutex);
+
+        start = now_us ();
+        image = ring->data + e.offset;
+#ifdef HAVE_LIBZ
+        if (e.compressed) {
+            uLongf n = e.record.image_bytes;
+            if (ring->scratch_size < n) {
+                free (ring->scratch);
+                ring->scratch = malloc (n);
+                ring->scratch_size = ring->scratch ? n : 0;
+            }
+            if (!ring->scratch || uncompress (ring->scratch, &n, image,
+                        e.length) != Z_OK || n != e.record.image_bytes) {
+                dc1394_log_error ("Failed to decompress a frame to save");
+                image = NULL;
+            }
+            else
+                image = ring->scratch;
+        }
+#endif
+        if (image)
+            write_record (file, &e.record, image);
+
+        pthread_mutex_lock (&ring->mutex);
+        ring->flush_bytes += e.record.record_size;
+        ring->flush_time += now_us () - start;
+        ring_pop (ring);
+    }
+    pthread_mutex_unlock (&ring->mutex);
+
+    return NULL;
+}
+
+static void
+ring_free (struct pretrigger * ring)
+{
+    pthread_cond_destroy (&ring->flush);
+    pthread_mutex_destroy (&ring->mutex);
+    free (ring->scratch);
+    free (ring->entries);
+    free (ring->data);
+    free (ring);
+}
+
+dc1394error_t
+dc1394_recorder_set_pretrigger (dc1394recorder_file_t * file,
+        const dc1394pretrigger_options_t * options)
+{
+    struct pretrigger * ring;
+
+    if (!file || file->ring || file->sequence)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    ring = calloc (1, sizeof (struct pretrigger));
+    if (!ring)
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    if (options)
+        ring->options = *options;
+    if (!ring->options.ring_size)
+        ring->options.ring_size = 256 * 1024 * 1024;
+#ifndef HAVE_LIBZ
+    if (ring->options.flags & DC1394_PRETRIGGER_FLAGS_COMPRESS)
+        dc1394_log_warning ("Built without zlib: pre-trigger frames are "
+                "kept uncompressed");
+#endif
+    pthread_mutex_init (&ring->mutex, NULL);
+    pthread_cond_init (&ring->flush, NULL);
+
+    ring->data = malloc (ring->options.ring_size);
+    if (!ring->data) {
+        ring_free (ring);
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    }
+
+    file->ring = ring;
+    if (pthread_create (&ring->thread, NULL, flush_thread, file) != 0) {
+        dc1394_log_error ("Failed to launch the pre-trigger thread");
+        file->ring = NULL;
+        ring_free (ring);
+        return DC1394_FAILURE;
+    }
+    ring->thread_created = 1;
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_recorder_trigger (dc1394recorder_file_t * file)
+{
+    struct pretrigger * ring;
+    uint32_t i;
+
+    if (!file || !file->ring)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    ring = file->ring;
+
+    pthread_mutex_lock (&ring->mutex);
+    for (i = 0; i < ring->count; i++)
+        ring->entries[(ring->head + i) % ring->capacity].flush = 1;
+    ring->post_left = ring->options.post_frames;
+    pthread_cond_signal (&ring->flush);
+    pthread_mutex_unlock (&ring->mutex);
+
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_recorder_write (dc1394recorder_file_t * file,
+        const dc1394video_frame_t * frame)
+{
+    dc1394container_record_t record;
+
+    if (!file || !frame)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    container_fill_record (&record, frame, file->sequence++);
+    if (file->ring)
+        return ring_push (file, &record, frame->image);
+    return write_record (file, &record, frame->image);
+}
+
+dc1394error_t
+dc1394_recorder_close (dc1394recorder_file_t * file)
+{
+    dc1394recorder_t * rec;
+    dc1394recorder_file_t ** f;
+    dc1394container_trailer_t trailer;
+    struct pretrigger * ring;
+    dc1394error_t staged;
+    int err;
+
+    if (!file)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    rec = file->recorder;
+
+    if (file->ring) {
+        pthread_mutex_lock (&file->ring->mutex);
+        file->ring->stop = 1;
+        pthread_cond_signal (&file->ring->flush);
+        pthread_mutex_unlock (&file->ring->mutex);
+        pthread_join (file->ring->thread, NULL);
+
+        /* Keep its counters in those of the recorder */
+        pthread_mutex_lock (&rec->mutex);
+        ring = file->ring;
+        rec->stats.ring_dropped += ring->dropped;
+        rec->stats.flush_bytes += ring->flush_bytes;
+        rec->stats.flush_time += ring->flush_time;
+        file->ring = NULL;
+        pthread_mutex_unlock (&rec->mutex);
+        ring_free (ring);
+    }
+
+    /* The index goes last, so that a file cut short is still readable */
+    trailer.index_offset = file->size;
+    trailer.count = file->count;
+    trailer.index_crc = container_crc32 (0, file->index,
+            file->count * sizeof (dc1394container_index_t));
+    trailer.magic = DC1394_CONTAINER_TRAILER_MAGIC;
+    staged = stage_bytes (file, file->index,
+            file->count * sizeof (dc1394container_index_t));
+    if (staged == DC1394_SUCCESS)
+        staged = stage_bytes (file, &trailer, sizeof trailer);
+    free (file->index);
+
+    if (file->current && file->current->used)
+        submit_buffer (file);
+    else if (file->current) {
+        /* Nothing staged in it: give it back */
+        pthread_mutex_lock (&rec->mutex);
+        file->current->next = rec->free_list;
+        rec->free_list = file->current;
+        pthread_cond_signal (&rec->buffer_free);
+        pthread_mutex_unlock (&rec->mutex);
+        file->current = NULL;
+    }
+
+    pthread_mutex_lock (&rec->mutex);
+    while (file->in_flight)
+        pthread_cond_wait (&rec->written, &rec->mutex);
+    err = file->error;
+    for (f = &rec->files; *f; f = &(*f)->next) {
+        if (*f == file) {
+            *f = file->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock (&rec->mutex);
+
+    /* Drop the padding of the last buffer and what was preallocated */
+    if (ftruncate (file->fd, file->size) < 0 && !err)
+        err = errno;
+    if (!(rec->options.flags & DC1394_RECORDER_FLAGS_NO_SYNC) &&
+            fsync (file->fd) < 0 && !err)
+        err = errno;
+    if (close (file->fd) < 0 && !err)
+        err = errno;
+    free (file);
+
+    if (err) {
+        dc1394_log_error ("Recording failed: %s", strerror (err));
+        return DC1394_FAILURE;
+    }
+    if (staged != DC1394_SUCCESS) {
+        dc1394_log_error ("Failed to write the index of the recording");
+        return DC1394_FAILURE;
+    }
+    return DC1394_SUCCESS;
+}
+
+static void
+record_frame (dc1394camera_t * camera, dc1394video_frame_t * frame,
+        void * user_data)
+{
+    /* The frame is requeued on return, once copied */
+    dc1394_recorder_write (user_data, frame);
+}
+
+dc1394error_t
+dc1394_recorder_attach (dc1394recorder_t * rec, dc1394camera_t * camera,
+        const char * path)
+{
+    dc1394recorder_file_t * file;
+    dc1394error_t err;
+
+    if (!rec || !camera)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    file = dc1394_recorder_open (rec, path);
+    if (!file)
+        return DC1394_FAILURE;
+    file->camera = camera;
+
+    err = dc1394_capture_start_callback (camera, record_frame, file, NULL);
+    if (err != DC1394_SUCCESS) {
+        file->camera = NULL;
+        dc1394_recorder_close (file);
+        unlink (path);
+    }
+    return err;
+}
+
+dc1394recorder_file_t *
+dc1394_recorder_attach_pretrigger (dc1394recorder_t * rec,
+        dc1394camera_t * camera, const char * path,
+        const dc1394pretrigger_options_t * options)
+{
+    dc1394recorder_file_t * file;
+
+    if (!rec || !camera)
+        return NULL;
+
+    file = dc1394_recorder_open (rec, path);
+    if (!file)
+        return NULL;
+    file->camera = camera;
+
+    if (dc1394_recorder_set_pretrigger (file, options) != DC1394_SUCCESS ||
+            dc1394_capture_start_callback (camera, record_frame, file,
+                NULL) != DC1394_SUCCESS) {
+        file->camera = NULL;
+        dc1394_recorder_close (file);
+        unlink (path);
+        return NULL;
+    }
+    return file;
+}
+
+dc1394error_t
+dc1394_recorder_detach (dc1394recorder_t * rec, dc1394camera_t * camera)
+{
+    dc1394recorder_file_t * file;
+
+    if (!rec || !camera)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    pthread_mutex_lock (&rec->mutex);
+    for (file = rec->files; file; file = file->next) {
+        if (file->camera == camera)
+            break;
+    }
+    pthread_mutex_unlock (&rec->mutex);
+    if (!file)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    dc1394_capture_stop_callback (camera);
+    return dc1394_recorder_close (file);
+}
+
+dc1394error_t
+dc1394_recorder_get_stats (dc1394recorder_t * rec,
+        dc1394recorder_stats_t * stats)
+{
+    dc1394recorder_file_t * file;
+
+    if (!rec || !stats)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    pthread_mutex_lock (&rec->mutex);
+    *stats = rec->stats;
+    /* Closed files are already counted, add the rings still open */
+    for (file = rec->files; file; file = file->next) {
+        struct pretrigger * ring = file->ring;
+        if (!ring)
+            continue;
+        pthread_mutex_lock (&ring->mutex);
+        stats->ring_size += ring->options.ring_size;
+        stats->ring_bytes += ring->used;
+        stats->ring_frames += ring->count;
+        stats->ring_dropped += ring->dropped;
+        stats->flush_bytes += ring->flush_bytes;
+        stats->flush_time += ring->flush_time;
+        pthread_mutex_unlock (&ring->mutex);
+    }
+    pthread_mutex_unlock (&rec->mutex);
+    return DC1394_SUCCESS;
+}
+
+#else
+
+dc1394recorder_t *
+dc1394_recorder_new (const dc1394recorder_options_t * options)
+{
+    return NULL;
+}
+
+void
+dc1394_recorder_free (dc1394recorder_t * recorder)
+{
+}
+
+dc1394recorder_file_t *
+dc1394_recorder_open (dc1394recorder_t * recorder, const char * path)
+{
+    return NULL;
+}
+
+dc1394error_t
+dc1394_recorder_write (dc1394recorder_file_t * file,
+        const dc1394video_frame_t * frame)
+{
+    return DC1394_FUNCTION_NOT_SUPPORTED;
+}
+
+dc1394error_t
+dc1394_recorder_close (dc1394recorder_file_t * file)
+{
+    return DC1394_FUNCTION_NOT_SUPPORTED;
+}
+
+dc1394error_t
+dc1394_recorder_attach (dc1394recorder_t * recorder, dc1394camera_t * camera,
+        const char * path)
+{
+    return DC1394_FUNCTION_NOT_SUPPORTED;
+}
+
+dc1394error_t
+dc1394_recorder_detach (dc1394recorder_t * recorder, dc1394camera_t * camera)
+{
+    return DC1394_FUNCTION_NOT_SUPPORTED;
+}
+
+dc1394error_t
+dc1394_recorder_set_pretrigger (dc1394recorder_file_t * file,
+        const dc1394pretrigger_options_t * options)
+{
+    return DC1394_FUNCTION_NOT_SUPPORTED;
+}
+
+dc1394error_t
+dc1394_recorder_trigger (dc1394recorder_file_t * file)
+{
+    return DC1394_FUNCTION_NOT_SUPPORTED;
+}
+
+dc1394recorder_file_t *
+dc1394_recorder_attach_pretrigger (dc1394recorder_t * recorder,
+        dc1394camera_t * camera, const char * path,
+        const dc1394pretrigger_options_t * options)
+{
+    return NULL;
+}
+
+dc1394error_t
+dc1394_recorder_get_stats (dc1394recorder_t * recorder,
+        dc1394recorder_stats_t * stats)
+{
+    return DC1394_FUNCTION_NOT_SUPPORTED;
+}
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Recording of captured frames to disk
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __DC1394_RECORDER_H__
+#define __DC1394_RECORDER_H__
+
+/*! \file dc1394/recorder.h
+    \brief Streams captured frames to disk without stalling capture
+
+    A recorder copies frames into a bounded pool of aligned staging buffers, which worker threads write out with
+    O_DIRECT where the file system allows it. The capture thread never waits for the disk: only for a free staging
+    buffer, which the DMA ring buffer of the camera absorbs. Several files, typically one per camera, share the pool and
+    the workers, and are written in parallel. Files are written in the format of container.h, and can be read back
+    with dc1394_reader_open(). Not available on Windows.
+*/
+
+#include <dc1394/log.h>
+#include <dc1394/video.h>
+#include <dc1394/capture.h>
+
+/**
+ * Recorder options, passed to dc1394_recorder_new(). Zero (or a NULL pointer for the whole struct) selects the default.
+ *
+ * num_buffers:  number of staging buffers shared by all files. Default: 16.
+ * buffer_size:  size of a staging buffer, in bytes, rounded up to a multiple of 4096. Default: 4 MiB.
+ * num_threads:  number of worker threads writing buffers out. Default: 2.
+ * preallocate:  bytes to reserve on disk when a file is opened, so that the file system does not have to allocate
+ *               blocks while recording. The file is truncated to what was recorded when it is closed.
+ * flags:        DC1394_RECORDER_FLAGS_*.
+ */
+#define DC1394_RECORDER_FLAGS_BUFFERED_IO 0x00000001U /* write through the page cache instead of O_DIRECT */
+#define DC1394_RECORDER_FLAGS_NO_SYNC     0x00000002U /* do not flush files to disk when closing them */
+
+typedef struct {
+    uint32_t                 num_buffers;
+    uint32_t                 buffer_size;
+    uint32_t                 num_threads;
+    uint64_t                 preallocate;
+    uint32_t                 flags;
+} dc1394recorder_options_t;
+
+/**
+ * Pre-trigger options, see dc1394_recorder_set_pretrigger(). Zero selects the default.
+ *
+ * ring_size:    memory kept for the frames, in bytes. Default: 256 MiB.
+ * max_frames:   number of frames kept before the trigger. Default: as many as fit in the ring.
+ * max_age:      how old the frames kept before the trigger may be, in microseconds. Default: no limit.
+ * post_frames:  number of frames saved after the trigger, on top of those before it.
+ * flags:        DC1394_PRETRIGGER_FLAGS_*.
+ */
+#define DC1394_PRETRIGGER_FLAGS_COMPRESS  0x00000001U /* deflate the frames kept in memory (needs zlib) */
+
+typedef struct {
+    uint64_t                 ring_size;
+    uint32_t                 max_frames;
+    uint64_t                 max_age;
+    uint32_t                 post_frames;
+    uint32_t                 flags;
+} dc1394pretrigger_options_t;
+
+/**
+ * Recorder statistics, see dc1394_recorder_get_stats()
+ */
+typedef struct {
+    uint64_t                 frames;        /* frames staged */
+    uint64_t                 bytes;         /* bytes staged for the frames, with their headers */
+    uint64_t                 bytes_written; /* bytes on disk, including the padding of the last buffer of each file */
+    uint64_t                 stalls;        /* times a frame had to wait for a free staging buffer */
+    uint64_t                 errors;        /* failed writes */
+    /* Pre-trigger files */
+    uint64_t                 ring_size;     /* memory allocated for their rings */
+    uint64_t                 ring_bytes;    /* memory used by the frames in their rings */
+    uint64_t                 ring_frames;   /* frames in their rings */
+    uint64_t                 ring_dropped;  /* frames to save that did not fit in their rings */
+    uint64_t                 flush_bytes;   /* bytes flushed from their rings */
+    uint64_t                 flush_time;    /* time spent flushing them, in microseconds: flush_bytes / flush_time
+                                               is the flush bandwidth */
+} dc1394recorder_stats_t;
+
+typedef struct __dc1394recorder_t dc1394recorder_t;
+typedef struct __dc1394recorder_file_t dc1394recorder_file_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Creates a recorder and starts its worker threads.
+ */
+dc1394recorder_t * dc1394_recorder_new (const dc1394recorder_options_t * options);
+
+/**
+ * Closes the files of a recorder that are still open, detaching their cameras, then stops its threads and frees it.
+ */
+void dc1394_recorder_free (dc1394recorder_t * recorder);
+
+/**
+ * Creates (or truncates) a file to record frames to with dc1394_recorder_write().
+ */
+dc1394recorder_file_t * dc1394_recorder_open (dc1394recorder_t * recorder, const char * path);
+
+/**
+ * Stages a frame for writing, image and metadata. The frame can be requeued as soon as this returns. Frames are
+ * written one after the other, and only one thread may write to a given file at a time.
+ */
+dc1394error_t dc1394_recorder_write (dc1394recorder_file_t * file, const dc1394video_frame_t * frame);
+
+/**
+ * Writes out what is left of a file, waits for its writes to complete and closes it.
+ * @return DC1394_FAILURE if any write to the file failed.
+ */
+dc1394error_t dc1394_recorder_close (dc1394recorder_file_t * file);
+
+/**
+ * Records all the frames of a camera to a new file, through dc1394_capture_start_callback(). Capture must be set up.
+ */
+dc1394error_t dc1394_recorder_attach (dc1394recorder_t * recorder, dc1394camera_t * camera, const char * path);
+
+/**
+ * Stops recording a camera attached with dc1394_recorder_attach() and closes its file.
+ */
+dc1394error_t dc1394_recorder_detach (dc1394recorder_t * recorder, dc1394camera_t * camera);
+
+/**
+ * Switches a file to pre-trigger recording, before any frame is written to it. The frames are then kept in memory, in
+ * a ring of the most recent ones, and only saved once dc1394_recorder_trigger() is called. Saving is done by a thread
+ * of the file, so that writing frames never waits for the disk; if the ring fills up with frames still to be saved,
+ * the newest frames are dropped instead.
+ */
+dc1394error_t dc1394_recorder_set_pretrigger (dc1394recorder_file_t * file, const dc1394pretrigger_options_t * options);
+
+/**
+ * Saves the frames in the ring of a pre-trigger file, and the post_frames next ones. Can be called from any thread.
+ */
+dc1394error_t dc1394_recorder_trigger (dc1394recorder_file_t * file);
+
+/**
+ * Like dc1394_recorder_attach(), in pre-trigger mode.
+ * @return The file, to pass to dc1394_recorder_trigger(), or NULL on failure. It is closed by dc1394_recorder_detach().
+ */
+dc1394recorder_file_t * dc1394_recorder_attach_pretrigger (dc1394recorder_t * recorder, dc1394camera_t * camera,
+                                                           const char * path,
+                                                           const dc1394pretrigger_options_t * options);
+
+/**
+ * Gets the statistics of a recorder, for all its files.
+ */
+dc1394error_t dc1394_recorder_get_stats (dc1394recorder_t * recorder, dc1394recorder_stats_t * stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DC1394_RECORDER_H__ */
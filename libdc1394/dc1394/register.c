@@ -21,6 +21,8 @@
  */
 
 #include <inttypes.h>
+#include <stdlib.h>
+#include <sys/time.h>
 #include "control.h"
 #include "internal.h"
 #include "offsets.h"
@@ -28,6 +30,17 @@
 #include "utils.h"
 #include "config.h"
 
+#define STATS_ADD(cp, field) \
+    __atomic_fetch_add (&(cp)->transaction_stats.field, 1, __ATOMIC_RELAXED)
+
+static void
+count_transaction (dc1394camera_priv_t * cp, dc1394error_t err)
+{
+    STATS_ADD (cp, transactions);
+    if (err != DC1394_SUCCESS)
+        STATS_ADD (cp, failures);
+}
+
 /* Note: debug modes can be very verbose. */
 
 /* To debug config rom structure: */
@@ -60,6 +73,302 @@
     }
 
 
+/********************************************************************************/
+/* Register cache                                                               */
+/********************************************************************************/
+
+typedef struct {
+    uint64_t offset;
+    uint32_t value;
+    int valid;
+} register_cache_entry_t;
+
+/* Values of the registers that a camera never changes on its own: the
+ * configuration ROM, the inquiry registers and the Format_7 inquiry
+ * registers that do not depend on the current settings. Everything is
+ * forgotten when the bus generation changes. */
+struct _register_cache_t {
+    uint32_t generation;
+    /* Set when a value was read from the camera, see cache.c */
+    int dirty;
+    register_cache_entry_t entries[REGISTER_CACHE_SIZE];
+};
+
+static inline register_cache_entry_t *
+cache_entry (struct _register_cache_t * cache, uint64_t offset)
+{
+    uint64_t h = (offset >> 2) * 0x9E3779B97F4A7C15ULL;
+    return cache->entries + (h >> (64 - REGISTER_CACHE_BITS));
+}
+
+/* Offset of a register in the Format_7 CSRs of a mode, or -1 */
+static int
+format7_register (dc1394camera_t * camera, uint64_t offset, int * mode)
+{
+    int i;
+
+    for (i = 0; i < DC1394_VIDEO_MODE_FORMAT7_NUM; i++) {
+        uint64_t base = camera->format7_csr[i];
+        if (base && offset >= base && offset < base + 0x100) {
+            *mode = i;
+            return offset - base;
+        }
+    }
+    return -1;
+}
+
+static int
+register_is_cacheable (dc1394camera_t * camera, uint64_t offset)
+{
+    uint64_t base = camera->command_registers_base;
+    int mode, reg;
+
+    /* Configuration ROM */
+    if (offset >= 0x400 && offset < 0x800)
+        return 1;
+
+    if (offset >= base && offset < base + 0x800) {
+        reg = offset - base;
+        return (reg >= REG_CAMERA_V_FORMAT_INQ && reg < 0x300) ||
+            (reg >= REG_CAMERA_BASIC_FUNC_INQ &&
+             reg <= REG_CAMERA_STROBE_CONTROL_CSR_INQ) ||
+            (reg >= REG_CAMERA_FEATURE_HI_BASE_INQ && reg < 0x600) ||
+            reg >= REG_CAMERA_FEATURE_ABS_HI_BASE;
+    }
+
+    reg = format7_register (camera, offset, &mode);
+    return reg == REG_CAMERA_FORMAT7_MAX_IMAGE_SIZE_INQ ||
+        reg == REG_CAMERA_FORMAT7_UNIT_SIZE_INQ ||
+        reg == REG_CAMERA_FORMAT7_COLOR_CODING_INQ ||
+        reg == REG_CAMERA_FORMAT7_UNIT_POSITION_INQ;
+}
+
+static void
+cache_flush (struct _register_cache_t * cache)
+{
+    int i;
+    for (i = 0; i < REGISTER_CACHE_SIZE; i++)
+        cache->entries[i].valid = 0;
+}
+
+static void
+cache_flush_range (struct _register_cache_t * cache, uint64_t offset,
+        uint64_t size)
+{
+    int i;
+    for (i = 0; i < REGISTER_CACHE_SIZE; i++) {
+        register_cache_entry_t * e = cache->entries + i;
+        if (e->valid && e->offset >= offset && e->offset < offset + size)
+            e->valid = 0;
+    }
+}
+
+/* Forgets everything if there was a bus reset since the last access */
+static void
+cache_check_generation (dc1394camera_t * camera,
+        struct _register_cache_t * cache)
+{
+    uint32_t generation;
+
+    if (dc1394_camera_get_node (camera, NULL, &generation) != DC1394_SUCCESS)
+        return;
+    if (generation != cache->generation) {
+        dc1394_log_debug ("Bus generation %u, flushing the register cache",
+                generation);
+        cache_flush (cache);
+        cache->generation = generation;
+    }
+}
+
+static dc1394error_t
+cache_read (dc1394camera_t * camera, struct _register_cache_t * cache,
+        uint64_t offset, uint32_t * value, uint32_t num_regs)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (camera);
+    dc1394error_t err;
+    uint32_t i;
+
+    cache_check_generation (camera, cache);
+
+    for (i = 0; i < num_regs; i++) {
+        register_cache_entry_t * e = cache_entry (cache, offset + 4 * i);
+        if (!e->valid || e->offset != offset + 4 * i)
+            break;
+        value[i] = e->value;
+    }
+    if (i == num_regs)
+        return DC1394_SUCCESS;
+
+    err = cp->platform->dispatch->camera_read (cp->pcam, offset, value,
+            num_regs);
+    count_transaction (cp, err);
+    if (err != DC1394_SUCCESS)
+        return err;
+
+    for (i = 0; i < num_regs; i++) {
+        register_cache_entry_t * e;
+        if (!register_is_cacheable (camera, offset + 4 * i))
+            continue;
+        e = cache_entry (cache, offset + 4 * i);
+        e->offset = offset + 4 * i;
+        e->value = value[i];
+        e->valid = 1;
+        cache->dirty = 1;
+    }
+    return DC1394_SUCCESS;
+}
+
+/* Whether a register belongs to the absolute value CSR of a feature. Their
+ * offsets are read from 0x700 to 0x7FF before any absolute access, so only
+ * those in the cache are looked at. */
+static int
+absolute_register (dc1394camera_t * camera, struct _register_cache_t * cache,
+        uint64_t offset)
+{
+    uint64_t base = camera->command_registers_base;
+    uint64_t reg;
+
+    for (reg = REG_CAMERA_FEATURE_ABS_HI_BASE; reg < 0x800; reg += 4) {
+        register_cache_entry_t * e = cache_entry (cache, base + reg);
+        uint64_t csr;
+        if (!e->valid || e->offset != base + reg || !e->value)
+            continue;
+        csr = (uint64_t) e->value * 4;
+        if (offset >= csr && offset <= csr + REG_CAMERA_ABS_VALUE)
+            return 1;
+    }
+    return 0;
+}
+
+/* Drops what a write may change, before it is done */
+static void
+cache_write (dc1394camera_t * camera, struct _register_cache_t * cache,
+        uint64_t offset, uint32_t num_regs)
+{
+    uint64_t base = camera->command_registers_base;
+    int mode, reg;
+    uint32_t i;
+
+    for (i = 0; i < num_regs; i++) {
+        register_cache_entry_t * e = cache_entry (cache, offset + 4 * i);
+        if (e->offset == offset + 4 * i)
+            e->valid = 0;
+    }
+
+    if (offset >= base && offset < base + 0x1000) {
+        /* Resetting the camera is the only command that can change the
+           inquiry registers */
+        if (offset == base + REG_CAMERA_INITIALIZE)
+            cache_flush (cache);
+        return;
+    }
+
+    reg = format7_register (camera, offset, &mode);
+    if (reg >= 0) {
+        /* Some cameras have different unit sizes for each color coding */
+        if (reg <= REG_CAMERA_FORMAT7_COLOR_CODING_ID &&
+                reg + 4 * num_regs > REG_CAMERA_FORMAT7_COLOR_CODING_ID)
+            cache_flush_range (cache, camera->format7_csr[mode], 0x100);
+        return;
+    }
+
+    if ((camera->PIO_control_csr && offset >= camera->PIO_control_csr &&
+                offset < camera->PIO_control_csr + 0x100) ||
+            (camera->SIO_control_csr && offset >= camera->SIO_control_csr &&
+             offset < camera->SIO_control_csr + 0x100) ||
+            (camera->strobe_control_csr &&
+             offset >= camera->strobe_control_csr &&
+             offset < camera->strobe_control_csr + 0x100))
+        return;
+
+    /* Absolute values change with the feature, not the inquiry registers */
+    if (absolute_register (camera, cache, offset))
+        return;
+
+    /* Advanced features and other vendor registers may switch the camera
+       to another set of modes, with other inquiry values */
+    cache_flush (cache);
+}
+
+dc1394error_t
+dc1394_camera_set_register_cache (dc1394camera_t * camera, dc1394switch_t pwr)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (camera);
+
+    if (camera == NULL)
+        return DC1394_CAMERA_NOT_INITIALIZED;
+
+    if (pwr == DC1394_OFF) {
+        free (cp->register_cache);
+        cp->register_cache = NULL;
+        return DC1394_SUCCESS;
+    }
+
+    if (cp->register_cache)
+        return DC1394_SUCCESS;
+    cp->register_cache = calloc (1, sizeof (struct _register_cache_t));
+    if (!cp->register_cache)
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    if (dc1394_camera_get_node (camera, NULL,
+                &cp->register_cache->generation) != DC1394_SUCCESS)
+        cp->register_cache->generation = 0;
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_camera_flush_register_cache (dc1394camera_t * camera)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (camera);
+
+    if (camera == NULL)
+        return DC1394_CAMERA_NOT_INITIALIZED;
+
+    if (cp->register_cache)
+        cache_flush (cp->register_cache);
+    return DC1394_SUCCESS;
+}
+
+void
+register_cache_fill (dc1394camera_t * camera, const uint64_t * offsets,
+        const uint32_t * values, uint32_t num)
+{
+    struct _register_cache_t * cache = DC1394_CAMERA_PRIV (camera)->register_cache;
+    register_cache_entry_t * e;
+    uint32_t i;
+
+    if (!cache)
+        return;
+    for (i = 0; i < num; i++) {
+        if (!offsets[i])
+            continue;
+        e = cache_entry (cache, offsets[i]);
+        e->offset = offsets[i];
+        e->value = values[i];
+        e->valid = 1;
+    }
+}
+
+uint32_t
+register_cache_export (dc1394camera_t * camera, uint64_t * offsets,
+        uint32_t * values, int * dirty)
+{
+    struct _register_cache_t * cache = DC1394_CAMERA_PRIV (camera)->register_cache;
+    uint32_t i, num = 0;
+
+    *dirty = 0;
+    if (!cache)
+        return 0;
+    for (i = 0; i < REGISTER_CACHE_SIZE; i++) {
+        if (!cache->entries[i].valid)
+            continue;
+        offsets[num] = cache->entries[i].offset;
+        values[num] = cache->entries[i].value;
+        num++;
+    }
+    *dirty = cache->dirty;
+    return num;
+}
+
 dc1394error_t
 dc1394_get_registers (dc1394camera_t *camera, uint64_t offset,
                       uint32_t *value, uint32_t num_regs)
@@ -69,8 +378,16 @@ dc1394_get_registers (dc1394camera_t *camera, uint64_t offset,
     if (camera == NULL)
         return DC1394_CAMERA_NOT_INITIALIZED;
 
-    return cp->platform->dispatch->camera_read (cp->pcam, offset, value,
+    dc1394error_t err;
+
+    if (cp->register_cache)
+        return cache_read (camera, cp->register_cache, offset, value,
+                num_regs);
+
+    err = cp->platform->dispatch->camera_read (cp->pcam, offset, value,
             num_regs);
+    count_transaction (cp, err);
+    return err;
 }
 
 dc1394error_t
@@ -82,8 +399,351 @@ dc1394_set_registers (dc1394camera_t *camera, uint64_t offset,
     if (camera == NULL)
         return DC1394_CAMERA_NOT_INITIALIZED;
 
-    return cp->platform->dispatch->camera_write (cp->pcam, offset, value,
+    dc1394error_t err;
+
+    if (cp->register_cache)
+        cache_write (camera, cp->register_cache, offset, num_regs);
+
+    err = cp->platform->dispatch->camera_write (cp->pcam, offset, value,
             num_regs);
+    count_transaction (cp, err);
+    return err;
+}
+
+
+/********************************************************************************/
+/* Retries and statistics                                                       */
+/********************************************************************************/
+
+/* Longest delay between two retries when the policy does not set one */
+#define RETRY_MAX_DELAY 1000000
+
+uint64_t
+retry_now (void)
+{
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void
+retry_begin (platform_retry_t * retry)
+{
+    retry->attempts = 0;
+    retry->delay = 0;
+    retry->start = retry_now ();
+}
+
+/* Xorshift generator of a camera for the retry jitter. Retries run from the
+ * threads of several cameras, and the sequence of rand() belongs to the
+ * application. */
+static uint32_t
+retry_random (dc1394camera_t * camera)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (camera);
+    uint32_t x = __atomic_load_n (&cp->retry_seed, __ATOMIC_RELAXED);
+
+    if (!x)
+        x = (uint32_t) (camera->guid ^ (camera->guid >> 32) ^ retry_now ()) | 1;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    __atomic_store_n (&cp->retry_seed, x, __ATOMIC_RELAXED);
+    return x;
+}
+
+int
+retry_next (dc1394camera_t * camera, platform_retry_t * retry,
+        retry_cause_t cause, int default_retries)
+{
+    dc1394camera_priv_t * cp = camera ? DC1394_CAMERA_PRIV (camera) : NULL;
+    const dc1394retry_policy_t * p;
+    uint64_t delay, max_delay;
+
+    if (cp && cause == RETRY_GENERATION)
+        STATS_ADD (cp, generation);
+    else if (cp)
+        STATS_ADD (cp, busy);
+
+    retry->attempts++;
+    if (!cp || !cp->has_retry_policy) {
+        if (retry->attempts >= default_retries)
+            goto give_up;
+        /* DC1394_SLOW_DOWN, without touching rand() when there is a
+         * camera */
+        delay = camera ? retry_random (camera) % 20 + 10 : DC1394_SLOW_DOWN;
+    }
+    else {
+        p = &cp->retry_policy;
+        if ((p->max_retries && retry->attempts > p->max_retries) ||
+                (!p->max_retries && !p->deadline))
+            goto give_up;
+
+        max_delay = p->max_delay ? p->max_delay : RETRY_MAX_DELAY;
+        if (retry->attempts == 1)
+            delay = p->initial_delay;
+        else
+            delay = retry->delay * p->multiplier;
+        if (delay > max_delay)
+            delay = max_delay;
+        retry->delay = delay;
+
+        if (p->jitter && delay > 1)
+            delay = delay / 2 + retry_random (camera) %
+                (delay - delay / 2 + 1);
+        if (p->deadline && retry_now () + delay - retry->start > p->deadline)
+            goto give_up;
+    }
+
+    if (cp)
+        STATS_ADD (cp, retries);
+    return delay;
+
+ give_up:
+    if (cp)
+        STATS_ADD (cp, timeouts);
+    return -1;
+}
+
+dc1394error_t
+dc1394_camera_set_retry_policy (dc1394camera_t * camera,
+        const dc1394retry_policy_t * policy)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (camera);
+
+    if (camera == NULL)
+        return DC1394_CAMERA_NOT_INITIALIZED;
+
+    if (!policy) {
+        cp->has_retry_policy = 0;
+        return DC1394_SUCCESS;
+    }
+    if (policy->multiplier < 1)
+        return DC1394_INVALID_ARGUMENT_VALUE;
+
+    cp->retry_policy = *policy;
+    cp->has_retry_policy = 1;
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_camera_get_transaction_stats (dc1394camera_t * camera,
+        dc1394transaction_stats_t * stats)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (camera);
+    dc1394transaction_stats_t * s = &cp->transaction_stats;
+
+    if (camera == NULL)
+        return DC1394_CAMERA_NOT_INITIALIZED;
+
+    stats->transactions = __atomic_load_n (&s->transactions, __ATOMIC_RELAXED);
+    stats->failures = __atomic_load_n (&s->failures, __ATOMIC_RELAXED);
+    stats->retries = __atomic_load_n (&s->retries, __ATOMIC_RELAXED);
+    stats->busy = __atomic_load_n (&s->busy, __ATOMIC_RELAXED);
+    stats->generation = __atomic_load_n (&s->generation, __ATOMIC_RELAXED);
+    stats->timeouts = __atomic_load_n (&s->timeouts, __ATOMIC_RELAXED);
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_camera_reset_transaction_stats (dc1394camera_t * camera)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (camera);
+    dc1394transaction_stats_t * s = &cp->transaction_stats;
+
+    if (camera == NULL)
+        return DC1394_CAMERA_NOT_INITIALIZED;
+
+    __atomic_store_n (&s->transactions, 0, __ATOMIC_RELAXED);
+    __atomic_store_n (&s->failures, 0, __ATOMIC_RELAXED);
+    __atomic_store_n (&s->retries, 0, __ATOMIC_RELAXED);
+    __atomic_store_n (&s->busy, 0, __ATOMIC_RELAXED);
+    __atomic_store_n (&s->generation, 0, __ATOMIC_RELAXED);
+    __atomic_store_n (&s->timeouts, 0, __ATOMIC_RELAXED);
+    return DC1394_SUCCESS;
+}
+
+/********************************************************************************/
+/* Asynchronous transactions                                                    */
+/********************************************************************************/
+
+struct __dc1394_request_t {
+    platform_request_t req;
+    dc1394camera_t * camera;
+};
+
+/* Transactions kept in flight by the vector functions. The bus has 64
+ * transaction labels per node, shared with the other users of the camera. */
+#define REGISTER_VEC_DEPTH 16
+
+dc1394error_t
+dc1394_request_submit (dc1394camera_t * camera, uint64_t offset,
+        uint32_t * value, uint32_t num_regs, dc1394bool_t write,
+        dc1394request_t ** request)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (camera);
+    const platform_dispatch_t * d;
+    dc1394request_t * r;
+    dc1394error_t err;
+
+    if (camera == NULL)
+        return DC1394_CAMERA_NOT_INITIALIZED;
+
+    r = calloc (1, sizeof (dc1394request_t));
+    if (!r)
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    r->camera = camera;
+    r->req.offset = offset;
+    r->req.quads = value;
+    r->req.num_quads = num_regs;
+    r->req.write = write;
+
+    d = cp->platform->dispatch;
+    if (write && cp->register_cache)
+        cache_write (camera, cp->register_cache, offset, num_regs);
+
+    /* Platforms without asynchronous transactions complete them here */
+    if (!d->camera_submit) {
+        if (write)
+            r->req.result = d->camera_write (cp->pcam, offset, value, num_regs);
+        else
+            r->req.result = d->camera_read (cp->pcam, offset, value, num_regs);
+        r->req.done = 1;
+        *request = r;
+        return DC1394_SUCCESS;
+    }
+
+    err = d->camera_submit (cp->pcam, &r->req);
+    if (err != DC1394_SUCCESS) {
+        free (r);
+        return err;
+    }
+    *request = r;
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_request_poll (dc1394request_t * request, dc1394bool_t * done)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (request->camera);
+    const platform_dispatch_t * d = cp->platform->dispatch;
+    dc1394error_t err;
+
+    if (!request->req.done && d->camera_poll) {
+        err = d->camera_poll (cp->pcam, DC1394_FALSE);
+        if (err != DC1394_SUCCESS)
+            return err;
+    }
+    *done = request->req.done ? DC1394_TRUE : DC1394_FALSE;
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_request_wait (dc1394request_t * request)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (request->camera);
+    const platform_dispatch_t * d = cp->platform->dispatch;
+    dc1394error_t err;
+
+    uint32_t failures = 0;
+
+    /* The platform writes to the request when it completes, so it may only
+       be freed once done, or withdrawn before it was sent */
+    while (!request->req.done) {
+        err = d->camera_poll (cp->pcam, DC1394_TRUE);
+        if (err == DC1394_SUCCESS) {
+            failures = 0;
+            continue;
+        }
+        if (d->camera_cancel &&
+                d->camera_cancel (cp->pcam, &request->req) == DC1394_SUCCESS)
+            break;
+        if (++failures >= REQUEST_MAX_POLL_FAILURES) {
+            dc1394_log_error ("Giving up on the transaction at 0x%"PRIx64
+                    ", which is left in flight", request->req.offset);
+            return err;
+        }
+    }
+    err = request->req.result;
+    count_transaction (cp, err);
+    free (request);
+    return err;
+}
+
+static dc1394error_t
+registers_vec (dc1394camera_t * camera, const dc1394register_vec_t * vec,
+        uint32_t num, dc1394bool_t write)
+{
+    dc1394request_t * requests[REGISTER_VEC_DEPTH];
+    uint32_t submitted = 0, completed = 0;
+    dc1394error_t err = DC1394_SUCCESS, e;
+
+    if (camera == NULL)
+        return DC1394_CAMERA_NOT_INITIALIZED;
+
+    while (1) {
+        while (err == DC1394_SUCCESS && submitted < num &&
+                submitted - completed < REGISTER_VEC_DEPTH) {
+            err = dc1394_request_submit (camera, vec[submitted].offset,
+                    vec[submitted].value, vec[submitted].num_regs, write,
+                    &requests[submitted % REGISTER_VEC_DEPTH]);
+            if (err == DC1394_SUCCESS)
+                submitted++;
+        }
+        if (completed == submitted)
+            break;
+        e = dc1394_request_wait (requests[completed % REGISTER_VEC_DEPTH]);
+        if (e != DC1394_SUCCESS && err == DC1394_SUCCESS) {
+            dc1394_log_debug ("Transaction at 0x%"PRIx64" failed",
+                    vec[completed].offset);
+            err = e;
+        }
+        completed++;
+    }
+    return err;
+}
+
+dc1394error_t
+dc1394_get_registers_vec (dc1394camera_t * camera,
+        const dc1394register_vec_t * vec, uint32_t num)
+{
+    return registers_vec (camera, vec, num, DC1394_FALSE);
+}
+
+dc1394error_t
+dc1394_set_registers_vec (dc1394camera_t * camera,
+        const dc1394register_vec_t * vec, uint32_t num)
+{
+    return registers_vec (camera, vec, num, DC1394_TRUE);
+}
+
+/* Reads registers in one transaction. Cameras that reject block reads are
+ * then read from one quadlet at a time; after any other failure, only this
+ * read falls back to quadlets. */
+dc1394error_t
+get_registers_block (dc1394camera_t * camera, uint64_t offset,
+        uint32_t * value, uint32_t num_regs)
+{
+    dc1394camera_priv_t * cp = DC1394_CAMERA_PRIV (camera);
+    dc1394error_t err;
+    uint32_t i;
+
+    if (num_regs > 1 && !cp->no_block_reads) {
+        err = dc1394_get_registers (camera, offset, value, num_regs);
+        if (err == DC1394_SUCCESS)
+            return err;
+        dc1394_log_debug ("Block read of %u registers at 0x%"PRIx64" failed, "
+                "using quadlet reads", num_regs, offset);
+        if (err == DC1394_FUNCTION_NOT_SUPPORTED)
+            cp->no_block_reads = 1;
+    }
+
+    for (i = 0; i < num_regs; i++) {
+        err = dc1394_get_registers (camera, offset + 4 * i, value + i, 1);
+        if (err != DC1394_SUCCESS)
+            return err;
+    }
+    return DC1394_SUCCESS;
 }
 
 
@@ -170,6 +830,22 @@ dc1394_get_format7_register(dc1394camera_t *camera, unsigned int mode, uint64_t
         value, 1);
 }
 
+dc1394error_t
+get_format7_registers (dc1394camera_t * camera, dc1394video_mode_t mode,
+        uint64_t offset, uint32_t * value, uint32_t num_regs)
+{
+    uint64_t * csr;
+
+    if (!dc1394_is_video_mode_scalable(mode))
+        return DC1394_INVALID_VIDEO_FORMAT;
+
+    csr = &camera->format7_csr[mode-DC1394_VIDEO_MODE_FORMAT7_MIN];
+    if (*csr == 0 && QueryFormat7CSROffset (camera, mode, csr) != DC1394_SUCCESS)
+        return DC1394_FAILURE;
+
+    return get_registers_block (camera, *csr + offset, value, num_regs);
+}
+
 
 dc1394error_t
 dc1394_set_format7_register(dc1394camera_t *camera, unsigned int mode, uint64_t offset, uint32_t value)
@@ -237,6 +913,20 @@ dc1394_set_absolute_register(dc1394camera_t *camera, unsigned int feature,
     return dc1394_set_registers (camera, absoffset + offset, &value, 1);
 }
 
+dc1394error_t
+get_absolute_registers (dc1394camera_t * camera, dc1394feature_t feature,
+        uint64_t offset, uint32_t * value, uint32_t num_regs)
+{
+    uint64_t absoffset;
+    dc1394error_t err;
+
+    err = QueryAbsoluteCSROffset (camera, feature, &absoffset);
+    if (err != DC1394_SUCCESS)
+        return err;
+
+    return get_registers_block (camera, absoffset + offset, value, num_regs);
+}
+
 /********************************************************************************/
 /* Get/Set PIO Feature Registers                                                */
 /********************************************************************************/
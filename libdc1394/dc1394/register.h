@@ -66,6 +66,91 @@ static inline dc1394error_t dc1394_set_register (dc1394camera_t *camera,
 }
 
 
+/**
+ * Switches the register cache of a camera on or off. It is off by default.
+ *
+ * When on, the configuration ROM, the inquiry registers and the Format_7
+ * inquiry registers that do not depend on the current settings are read
+ * from the camera once, and then from memory until the next bus reset.
+ * Setting the color coding of a Format_7 mode, initialising the camera
+ * and writing to advanced feature registers drop the cached values they
+ * may change. Other registers are always read from the camera.
+ */
+dc1394error_t dc1394_camera_set_register_cache (dc1394camera_t *camera,
+        dc1394switch_t pwr);
+
+/**
+ * Drops the cached registers of a camera, for instance after changing
+ * its modes through means the library knows nothing of.
+ */
+dc1394error_t dc1394_camera_flush_register_cache (dc1394camera_t *camera);
+
+
+/********************************************************************************/
+/* Asynchronous transactions                                                    */
+/********************************************************************************/
+
+/**
+ * A register transaction in progress, see dc1394_request_submit()
+ */
+typedef struct __dc1394_request_t dc1394request_t;
+
+/**
+ * Registers of one transaction in a vector, see dc1394_get_registers_vec()
+ */
+typedef struct {
+    uint64_t offset;
+    uint32_t * value;
+    uint32_t num_regs;
+} dc1394register_vec_t;
+
+/**
+ * Starts reading or writing registers, at offsets like those of
+ * dc1394_get_registers(), without waiting for the camera to answer. The
+ * values must stay around until the request has completed, and the
+ * request must be waited for with dc1394_request_wait(). Several requests
+ * to one or more cameras can be in flight at once.
+ *
+ * On platforms without asynchronous transactions the request completes
+ * before this returns.
+ */
+dc1394error_t dc1394_request_submit (dc1394camera_t *camera, uint64_t offset,
+        uint32_t *value, uint32_t num_regs, dc1394bool_t write,
+        dc1394request_t **request);
+
+/**
+ * Tells whether a request has completed, without blocking
+ */
+dc1394error_t dc1394_request_poll (dc1394request_t *request, dc1394bool_t *done);
+
+/**
+ * Waits for a request to complete, frees it and returns its result. If the
+ * platform keeps failing to wait, a request that is still in flight is
+ * left allocated rather than freed under the platform, and the error is
+ * returned.
+ */
+dc1394error_t dc1394_request_wait (dc1394request_t *request);
+
+/**
+ * Reads the registers of each element of vec, keeping several
+ * transactions in flight. Nothing more is sent after an error, which is
+ * returned once the transactions in flight have completed. Values are
+ * always read from the camera, even if the register cache is on.
+ */
+dc1394error_t dc1394_get_registers_vec (dc1394camera_t *camera,
+        const dc1394register_vec_t *vec, uint32_t num);
+
+/**
+ * Writes the registers of each element of vec, keeping several
+ * transactions in flight. The writes are sent in order, but one may be
+ * sent before the camera has answered the previous one: registers that
+ * must be written after another has been acknowledged, like the Format_7
+ * value setting, need a vector of their own.
+ */
+dc1394error_t dc1394_set_registers_vec (dc1394camera_t *camera,
+        const dc1394register_vec_t *vec, uint32_t num);
+
+
 /********************************************************************************/
 /* Get/Set Command Registers                                                    */
 /********************************************************************************/
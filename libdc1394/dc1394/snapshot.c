@@ -0,0 +1,604 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Snapshots of the configuration of a camera
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "snapshot.h"
+#include "control.h"
+#include "video.h"
+#include "format7.h"
+#include "register.h"
+#include "utils.h"
+#include "offsets.h"
+#include "internal.h"
+
+/* Bits of a feature control register */
+#define FEATURE_PRESENT         0x80000000U
+#define FEATURE_ABSOLUTE        0x40000000U
+#define FEATURE_ONE_PUSH        0x04000000U
+#define FEATURE_AUTO            0x01000000U
+#define FEATURE_VALUE           0x00FFFFFFU
+
+struct __dc1394snapshot_t {
+    uint64_t guid;
+    uint32_t video_mode;
+    uint32_t framerate;             /* fixed-size modes */
+    uint32_t operation_mode;
+    uint32_t iso_speed;
+    uint32_t color_coding;          /* the rest of the video settings are for Format_7 */
+    uint32_t left, top;
+    uint32_t width, height;
+    uint32_t packet_size;
+    uint32_t features;              /* bit n: feature DC1394_FEATURE_MIN + n is available */
+    uint32_t status[DC1394_FEATURE_NUM];
+    uint32_t abs_value[DC1394_FEATURE_NUM];
+};
+
+/* An entry of a file: the fields above in order, the GUID as two quadlets,
+   then a CRC-32 of all of them */
+#define SNAPSHOT_QUADS          (13 + 2 * DC1394_FEATURE_NUM + 1)
+#define SNAPSHOT_ENTRY_SIZE     (SNAPSHOT_QUADS * 4)
+#define SNAPSHOT_HEADER_SIZE    20
+
+/*****************************************************
+ snapshot_read
+
+ Reads the configuration of a camera. The Format_7
+ settings are those of f7_mode, which need not be the
+ current mode: when comparing with a snapshot they are
+ read for the mode of the snapshot.
+*****************************************************/
+static dc1394error_t
+snapshot_read (dc1394camera_t * camera, dc1394video_mode_t f7_mode,
+        dc1394snapshot_t * s)
+{
+    uint32_t presence[2], inquiry[64], status[64];
+    dc1394video_mode_t mode;
+    dc1394framerate_t framerate;
+    dc1394operation_mode_t operation_mode = DC1394_OPERATION_MODE_LEGACY;
+    dc1394speed_t iso_speed;
+    dc1394format7mode_t f7;
+    dc1394feature_t feature;
+    dc1394error_t err;
+    int n, index;
+
+    memset (s, 0, sizeof *s);
+    s->guid = camera->guid;
+
+    err = dc1394_video_get_mode (camera, &mode);
+    DC1394_ERR_RTN (err, "Could not get video mode");
+    s->video_mode = mode;
+
+    if (camera->bmode_capable == DC1394_TRUE) {
+        err = dc1394_video_get_operation_mode (camera, &operation_mode);
+        DC1394_ERR_RTN (err, "Could not get operation mode");
+    }
+    s->operation_mode = operation_mode;
+
+    err = dc1394_video_get_iso_speed (camera, &iso_speed);
+    DC1394_ERR_RTN (err, "Could not get ISO speed");
+    s->iso_speed = iso_speed;
+
+    if (!dc1394_is_video_mode_scalable (mode)) {
+        err = dc1394_video_get_framerate (camera, &framerate);
+        DC1394_ERR_RTN (err, "Could not get frame rate");
+        s->framerate = framerate;
+    }
+
+    if (dc1394_is_video_mode_scalable (f7_mode)) {
+        f7.present = DC1394_TRUE;
+        err = dc1394_format7_get_mode_info (camera, f7_mode, &f7);
+        DC1394_ERR_RTN (err, "Could not get Format_7 settings");
+        s->color_coding = f7.color_coding;
+        s->left = f7.pos_x;
+        s->top = f7.pos_y;
+        s->width = f7.size_x;
+        s->height = f7.size_y;
+        s->packet_size = f7.packet_size;
+    }
+
+    err = get_feature_registers (camera, presence, inquiry, status);
+    DC1394_ERR_RTN (err, "Could not get feature registers");
+
+    for (feature = DC1394_FEATURE_MIN, n = 0; feature <= DC1394_FEATURE_MAX;
+            feature++, n++) {
+        index = feature_register_index (feature);
+        // same policy as dc1394_feature_is_present
+        if (is_feature_bit_set (presence[feature >= DC1394_FEATURE_ZOOM],
+                    feature) != DC1394_TRUE ||
+                !(inquiry[index] & FEATURE_PRESENT) ||
+                !(status[index] & FEATURE_PRESENT))
+            continue;
+
+        s->features |= 1U << n;
+        s->status[n] = status[index];
+        if ((inquiry[index] & FEATURE_ABSOLUTE) &&
+                (status[index] & FEATURE_ABSOLUTE)) {
+            err = get_absolute_registers (camera, feature, REG_CAMERA_ABS_VALUE,
+                    &s->abs_value[n], 1);
+            DC1394_ERR_RTN (err, "Could not get absolute value");
+        }
+    }
+
+    return DC1394_SUCCESS;
+}
+
+/* Bits of a feature control register that are set by the application and
+   that the camera keeps as they were written */
+static uint32_t
+feature_mask (dc1394feature_t feature, uint32_t status)
+{
+    uint32_t mask;
+
+    // on/off, polarity, source, mode and parameter
+    if (feature == DC1394_FEATURE_TRIGGER)
+        return 0x43EF0FFFU;
+
+    mask = FEATURE_ABSOLUTE | 0x02000000U | FEATURE_AUTO | FEATURE_VALUE;
+    // the camera drives the value in auto mode, and from the absolute one
+    if (status & (FEATURE_AUTO | FEATURE_ABSOLUTE))
+        mask &= ~FEATURE_VALUE;
+    // current temperature
+    if (feature == DC1394_FEATURE_TEMPERATURE)
+        mask &= ~0xFFFU;
+    return mask;
+}
+
+/*****************************************************
+ snapshot_write
+
+ Writes the settings of want that differ in have, or
+ only counts them. The order is the one of the IIDC
+ specification: operation mode before ISO speed, video
+ mode before frame rate or Format_7 settings, and the
+ latter before the features, whose ranges may depend on
+ the mode. Feature registers are written in one go.
+*****************************************************/
+static dc1394error_t
+snapshot_write (dc1394camera_t * camera, const dc1394snapshot_t * want,
+        const dc1394snapshot_t * have, int dry_run, uint32_t * changes)
+{
+    dc1394register_vec_t vec[DC1394_FEATURE_NUM];
+    uint32_t value[DC1394_FEATURE_NUM];
+    dc1394feature_t feature;
+    dc1394error_t err;
+    uint32_t n, num = 0, count = 0;
+    int geometry = 0;
+    float abs_value;
+
+#define CHANGE(cond, call, message)                 \
+    if (cond) {                                     \
+        count++;                                    \
+        if (!dry_run) {                             \
+            err = call;                             \
+            DC1394_ERR_RTN (err, message);          \
+        }                                           \
+    }
+
+    CHANGE (camera->bmode_capable == DC1394_TRUE &&
+            want->operation_mode != have->operation_mode,
+            dc1394_video_set_operation_mode (camera, want->operation_mode),
+            "Could not set operation mode");
+    CHANGE (want->iso_speed != have->iso_speed,
+            dc1394_video_set_iso_speed (camera, want->iso_speed),
+            "Could not set ISO speed");
+    CHANGE (want->video_mode != have->video_mode,
+            dc1394_video_set_mode (camera, want->video_mode),
+            "Could not set video mode");
+
+    if (dc1394_is_video_mode_scalable (want->video_mode)) {
+        if (want->color_coding != have->color_coding)
+            geometry = 1;
+        CHANGE (want->color_coding != have->color_coding,
+                dc1394_format7_set_color_coding (camera, want->video_mode,
+                    want->color_coding),
+                "Could not set color coding");
+
+        /* Position to (0,0), size, then position, so that the camera never
+           goes through an impossible pair; see dc1394_format7_set_roi */
+        if (want->width != have->width || want->height != have->height) {
+            geometry = 1;
+            CHANGE (have->left != 0 || have->top != 0,
+                    dc1394_format7_set_image_position (camera,
+                        want->video_mode, 0, 0),
+                    "Could not set image position");
+            CHANGE (1, dc1394_format7_set_image_size (camera,
+                        want->video_mode, want->width, want->height),
+                    "Could not set image size");
+            CHANGE (want->left != 0 || want->top != 0,
+                    dc1394_format7_set_image_position (camera,
+                        want->video_mode, want->left, want->top),
+                    "Could not set image position");
+        }
+        else if (want->left != have->left || want->top != have->top) {
+            geometry = 1;
+            CHANGE (1, dc1394_format7_set_image_position (camera,
+                        want->video_mode, want->left, want->top),
+                    "Could not set image position");
+        }
+
+        // the packet size has to be set again after the geometry changed
+        CHANGE (geometry || want->packet_size != have->packet_size,
+                dc1394_format7_set_packet_size (camera, want->video_mode,
+                    want->packet_size),
+                "Could not set packet size");
+    }
+    else {
+        CHANGE (want->framerate != have->framerate,
+                dc1394_video_set_framerate (camera, want->framerate),
+                "Could not set frame rate");
+    }
+
+    for (feature = DC1394_FEATURE_MIN, n = 0; feature <= DC1394_FEATURE_MAX;
+            feature++, n++) {
+        if (!(want->features & (1U << n)))
+            continue;
+        if (!(have->features & (1U << n))) {
+            dc1394_log_debug ("Feature %s of the snapshot is not available",
+                    dc1394_feature_get_string (feature));
+            continue;
+        }
+        if (!((want->status[n] ^ have->status[n]) &
+                    feature_mask (feature, want->status[n])))
+            continue;
+
+        value[num] = want->status[n] & ~FEATURE_ONE_PUSH;
+        vec[num].offset = camera->command_registers_base +
+            REG_CAMERA_FEATURE_HI_BASE + 4 * feature_register_index (feature);
+        vec[num].value = &value[num];
+        vec[num].num_regs = 1;
+        num++;
+    }
+    count += num;
+    if (num && !dry_run) {
+        err = dc1394_set_registers_vec (camera, vec, num);
+        DC1394_ERR_RTN (err, "Could not set feature registers");
+    }
+
+    // the absolute values, once absolute control is on
+    for (feature = DC1394_FEATURE_MIN, n = 0; feature <= DC1394_FEATURE_MAX;
+            feature++, n++) {
+        if (!(want->features & have->features & (1U << n)) ||
+                !(want->status[n] & FEATURE_ABSOLUTE))
+            continue;
+        memcpy (&abs_value, &want->abs_value[n], 4);
+        CHANGE (want->abs_value[n] != have->abs_value[n] ||
+                !(have->status[n] & FEATURE_ABSOLUTE),
+                dc1394_feature_set_absolute_value (camera, feature, abs_value),
+                "Could not set absolute value");
+    }
+
+#undef CHANGE
+
+    if (changes)
+        *changes = count;
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_snapshot_capture (dc1394camera_t * camera, dc1394snapshot_t ** snapshot)
+{
+    dc1394video_mode_t mode;
+    dc1394snapshot_t * s;
+    dc1394error_t err;
+
+    if (camera == NULL)
+        return DC1394_CAMERA_NOT_INITIALIZED;
+
+    err = dc1394_video_get_mode (camera, &mode);
+    DC1394_ERR_RTN (err, "Could not get video mode");
+
+    s = malloc (sizeof *s);
+    if (!s)
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    err = snapshot_read (camera, mode, s);
+    if (err != DC1394_SUCCESS) {
+        free (s);
+        return err;
+    }
+    *snapshot = s;
+    return DC1394_SUCCESS;
+}
+
+void
+dc1394_snapshot_free (dc1394snapshot_t * snapshot)
+{
+    free (snapshot);
+}
+
+uint64_t
+dc1394_snapshot_get_guid (const dc1394snapshot_t * snapshot)
+{
+    return snapshot->guid;
+}
+
+dc1394error_t
+dc1394_snapshot_diff (dc1394camera_t * camera, const dc1394snapshot_t * snapshot,
+        uint32_t * changes)
+{
+    dc1394snapshot_t have;
+    dc1394error_t err;
+
+    if (camera == NULL)
+        return DC1394_CAMERA_NOT_INITIALIZED;
+
+    err = snapshot_read (camera, snapshot->video_mode, &have);
+    DC1394_ERR_RTN (err, "Could not read the camera configuration");
+    return snapshot_write (camera, snapshot, &have, 1, changes);
+}
+
+dc1394error_t
+dc1394_snapshot_apply (dc1394camera_t * camera, const dc1394snapshot_t * snapshot,
+        int memory_channel, uint32_t * changes)
+{
+    dc1394snapshot_t have;
+    dc1394error_t err;
+
+    if (camera == NULL)
+        return DC1394_CAMERA_NOT_INITIALIZED;
+
+    if (snapshot->guid != camera->guid) {
+        dc1394_log_error ("Snapshot of camera 0x%"PRIx64" applied to camera 0x%"PRIx64,
+                snapshot->guid, camera->guid);
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    }
+
+    if (memory_channel >= 0) {
+        err = dc1394_memory_load (camera, memory_channel);
+        DC1394_ERR_RTN (err, "Could not load memory channel");
+    }
+
+    err = snapshot_read (camera, snapshot->video_mode, &have);
+    DC1394_ERR_RTN (err, "Could not read the camera configuration");
+    return snapshot_write (camera, snapshot, &have, 0, changes);
+}
+
+/********************************************************************************/
+/* Files                                                                        */
+/********************************************************************************/
+
+void
+put_be32 (unsigned char * p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+uint32_t
+get_be32 (const unsigned char * p)
+{
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 |
+        (uint32_t) p[2] << 8 | p[3];
+}
+
+static void
+snapshot_pack (const dc1394snapshot_t * s, unsigned char * entry)
+{
+    uint32_t q[SNAPSHOT_QUADS];
+    int i, n = 0;
+
+    q[n++] = s->guid >> 32;
+    q[n++] = s->guid;
+    q[n++] = s->video_mode;
+    q[n++] = s->framerate;
+    q[n++] = s->operation_mode;
+    q[n++] = s->iso_speed;
+    q[n++] = s->color_coding;
+    q[n++] = s->left;
+    q[n++] = s->top;
+    q[n++] = s->width;
+    q[n++] = s->height;
+    q[n++] = s->packet_size;
+    q[n++] = s->features;
+    for (i = 0; i < DC1394_FEATURE_NUM; i++)
+        q[n++] = s->status[i];
+    for (i = 0; i < DC1394_FEATURE_NUM; i++)
+        q[n++] = s->abs_value[i];
+
+    for (i = 0; i < n; i++)
+        put_be32 (entry + 4 * i, q[i]);
+    put_be32 (entry + 4 * n, container_crc32 (0, entry, 4 * n));
+}
+
+static int
+snapshot_unpack (dc1394snapshot_t * s, const unsigned char * entry)
+{
+    uint32_t q[SNAPSHOT_QUADS];
+    int i, n = 0;
+
+    for (i = 0; i < SNAPSHOT_QUADS; i++)
+        q[i] = get_be32 (entry + 4 * i);
+    if (container_crc32 (0, entry, SNAPSHOT_ENTRY_SIZE - 4) !=
+            q[SNAPSHOT_QUADS - 1])
+        return -1;
+
+    s->guid = (uint64_t) q[0] << 32 | q[1];
+    n = 2;
+    s->video_mode = q[n++];
+    s->framerate = q[n++];
+    s->operation_mode = q[n++];
+    s->iso_speed = q[n++];
+    s->color_coding = q[n++];
+    s->left = q[n++];
+    s->top = q[n++];
+    s->width = q[n++];
+    s->height = q[n++];
+    s->packet_size = q[n++];
+    s->features = q[n++];
+    for (i = 0; i < DC1394_FEATURE_NUM; i++)
+        s->status[i] = q[n++];
+    for (i = 0; i < DC1394_FEATURE_NUM; i++)
+        s->abs_value[i] = q[n++];
+    return 0;
+}
+
+/* Reads the entries of a file. A missing file has none. */
+static dc1394error_t
+snapshot_read_file (const char * path, unsigned char ** entries,
+        uint32_t * count)
+{
+    unsigned char header[SNAPSHOT_HEADER_SIZE];
+    FILE * f;
+
+    *entries = NULL;
+    *count = 0;
+    f = fopen (path, "rb");
+    if (!f)
+        return DC1394_SUCCESS;
+
+    if (fread (header, 1, sizeof header, f) != sizeof header ||
+            memcmp (header, DC1394_SNAPSHOT_MAGIC, 8) ||
+            get_be32 (header + 8) != DC1394_SNAPSHOT_VERSION ||
+            get_be32 (header + 12) != SNAPSHOT_ENTRY_SIZE) {
+        dc1394_log_error ("%s is not a snapshot file of this version", path);
+        fclose (f);
+        return DC1394_FAILURE;
+    }
+
+    *count = get_be32 (header + 16);
+    *entries = malloc ((size_t) *count * SNAPSHOT_ENTRY_SIZE + 1);
+    if (!*entries) {
+        fclose (f);
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    }
+    if (fread (*entries, SNAPSHOT_ENTRY_SIZE, *count, f) != *count) {
+        dc1394_log_error ("Snapshot file %s is truncated", path);
+        free (*entries);
+        *entries = NULL;
+        fclose (f);
+        return DC1394_FAILURE;
+    }
+    fclose (f);
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_snapshot_save (const dc1394snapshot_t * snapshot, const char * path)
+{
+    unsigned char header[SNAPSHOT_HEADER_SIZE];
+    unsigned char * entries, * p;
+    char * tmp;
+    uint32_t i, count;
+    dc1394error_t err;
+    FILE * f;
+    int ok;
+
+    err = snapshot_read_file (path, &entries, &count);
+    DC1394_ERR_RTN (err, "Could not read snapshot file");
+
+    // replace the entry of the camera, or add one
+    for (i = 0; i < count; i++) {
+        p = entries + (size_t) i * SNAPSHOT_ENTRY_SIZE;
+        if (((uint64_t) get_be32 (p) << 32 | get_be32 (p + 4)) == snapshot->guid)
+            break;
+    }
+    if (i == count) {
+        p = realloc (entries, (size_t) (count + 1) * SNAPSHOT_ENTRY_SIZE);
+        if (!p) {
+            free (entries);
+            return DC1394_MEMORY_ALLOCATION_FAILURE;
+        }
+        entries = p;
+        count++;
+    }
+    snapshot_pack (snapshot, entries + (size_t) i * SNAPSHOT_ENTRY_SIZE);
+
+    memcpy (header, DC1394_SNAPSHOT_MAGIC, 8);
+    put_be32 (header + 8, DC1394_SNAPSHOT_VERSION);
+    put_be32 (header + 12, SNAPSHOT_ENTRY_SIZE);
+    put_be32 (header + 16, count);
+
+    // write a copy, then move it over the file
+    tmp = malloc (strlen (path) + 5);
+    if (!tmp) {
+        free (entries);
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    }
+    sprintf (tmp, "%s.tmp", path);
+    f = fopen (tmp, "wb");
+    if (!f) {
+        dc1394_log_error ("Could not create %s", tmp);
+        free (entries);
+        free (tmp);
+        return DC1394_FAILURE;
+    }
+    ok = fwrite (header, sizeof header, 1, f) == 1 &&
+        fwrite (entries, SNAPSHOT_ENTRY_SIZE, count, f) == count;
+    ok = fclose (f) == 0 && ok;
+    free (entries);
+#ifdef _WIN32
+    if (ok)
+        remove (path);
+#endif
+    if (!ok || rename (tmp, path) != 0) {
+        dc1394_log_error ("Could not write snapshot file %s", path);
+        remove (tmp);
+        free (tmp);
+        return DC1394_FAILURE;
+    }
+    free (tmp);
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_snapshot_load (const char * path, uint64_t guid,
+        dc1394snapshot_t ** snapshot)
+{
+    unsigned char * entries, * p;
+    dc1394snapshot_t * s;
+    uint32_t i, count;
+    dc1394error_t err;
+
+    err = snapshot_read_file (path, &entries, &count);
+    DC1394_ERR_RTN (err, "Could not read snapshot file");
+
+    for (i = 0; i < count; i++) {
+        p = entries + (size_t) i * SNAPSHOT_ENTRY_SIZE;
+        if (((uint64_t) get_be32 (p) << 32 | get_be32 (p + 4)) == guid)
+            break;
+    }
+    if (i == count) {
+        free (entries);
+        dc1394_log_debug ("No snapshot of camera 0x%"PRIx64" in %s", guid, path);
+        return DC1394_FAILURE;
+    }
+
+    s = malloc (sizeof *s);
+    if (!s) {
+        free (entries);
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    }
+    if (snapshot_unpack (s, p) < 0) {
+        dc1394_log_error ("Snapshot of camera 0x%"PRIx64" in %s is corrupt",
+                guid, path);
+        free (entries);
+        free (s);
+        return DC1394_FAILURE;
+    }
+    free (entries);
+    *snapshot = s;
+    return DC1394_SUCCESS;
+}
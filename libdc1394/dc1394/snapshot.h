@@ -0,0 +1,101 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Snapshots of the configuration of a camera
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __DC1394_SNAPSHOT_H__
+#define __DC1394_SNAPSHOT_H__
+
+/*! \file dc1394/snapshot.h
+    \brief Saves the configuration of a camera, and brings it back with as few writes as possible
+
+    A snapshot holds the video mode, frame rate, operation mode and ISO speed of a camera, the image geometry, color
+    coding and packet size of its Format_7 mode if any, and the control registers and absolute values of all its
+    features, trigger included. Applying a snapshot reads the camera first and only writes what differs, in the order
+    the IIDC specification asks for. A camera that already holds the configuration thus costs a handful of block
+    reads and no write.
+
+    Snapshots are kept in files keyed by GUID, so that one file can hold the configurations of all the cameras of a
+    setup. Integers are stored big-endian, and each snapshot is checked with a CRC-32.
+*/
+
+#include <dc1394/log.h>
+#include <dc1394/camera.h>
+
+#define DC1394_SNAPSHOT_MAGIC           "DC1394CS"
+#define DC1394_SNAPSHOT_VERSION         1
+
+typedef struct __dc1394snapshot_t dc1394snapshot_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Takes a snapshot of the current configuration of a camera. Free it with dc1394_snapshot_free().
+ */
+dc1394error_t dc1394_snapshot_capture (dc1394camera_t * camera, dc1394snapshot_t ** snapshot);
+
+/**
+ * Frees a snapshot.
+ */
+void dc1394_snapshot_free (dc1394snapshot_t * snapshot);
+
+/**
+ * GUID of the camera a snapshot was taken of.
+ */
+uint64_t dc1394_snapshot_get_guid (const dc1394snapshot_t * snapshot);
+
+/**
+ * Counts the settings of a camera that differ from a snapshot, without changing any.
+ * @param changes Number of settings dc1394_snapshot_apply() would write.
+ */
+dc1394error_t dc1394_snapshot_diff (dc1394camera_t * camera, const dc1394snapshot_t * snapshot,
+                                    uint32_t * changes);
+
+/**
+ * Brings a camera to the configuration of a snapshot, writing only the settings that differ. Settings the camera
+ * does not have are skipped. Values driven by the camera (features in auto mode, temperature readout) are not
+ * compared.
+ *
+ * @param memory_channel If not negative, the camera first loads this memory channel (see dc1394_memory_load()), and
+ *                       the snapshot is applied over it. Saving a snapshot to a channel once with dc1394_memory_save()
+ *                       makes later bring-ups a single write.
+ * @param changes        Number of settings written, may be NULL.
+ * @return DC1394_INVALID_ARGUMENT_VALUE if the snapshot was taken of another camera.
+ */
+dc1394error_t dc1394_snapshot_apply (dc1394camera_t * camera, const dc1394snapshot_t * snapshot,
+                                     int memory_channel, uint32_t * changes);
+
+/**
+ * Stores a snapshot in a file, replacing the one of the same GUID if any. The file is created if needed, and is
+ * replaced atomically.
+ */
+dc1394error_t dc1394_snapshot_save (const dc1394snapshot_t * snapshot, const char * path);
+
+/**
+ * Reads the snapshot of a camera from a file.
+ * @return DC1394_FAILURE if the file holds none for this GUID.
+ */
+dc1394error_t dc1394_snapshot_load (const char * path, uint64_t guid, dc1394snapshot_t ** snapshot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DC1394_SNAPSHOT_H__ */
@@ -26,84 +26,495 @@
 #include <inttypes.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/time.h>
 
 #include "usb/usb.h"
 
-/* Callback whenever a bulk transfer finishes. */
-static void
-callback (struct libusb_transfer * transfer)
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+/* Completed frames are passed from the event thread to the dequeuing
+ * thread through a single-producer single-consumer ring of frame indices,
+ * with no lock.  The notify fd counts the frames in the ring, so that it
+ * is readable exactly when a frame can be dequeued: an eventfd in
+ * semaphore mode where available, a pipe with one byte per frame
+ * otherwise. */
+static int
+notify_open (platform_camera_t * craw)
 {
-    struct usb_frame * f = transfer->user_data;
-    platform_camera_t * craw = f->pcam;
+#ifdef HAVE_SYS_EVENTFD_H
+    int fd = eventfd (0, EFD_SEMAPHORE | EFD_CLOEXEC);
+    if (fd >= 0) {
+        craw->notify_fd[0] = craw->notify_fd[1] = fd;
+        return 0;
+    }
+#endif
+    return pipe (craw->notify_fd);
+}
 
-    if (transfer->status == LIBUSB_TRANSFER_CANCELLED) {
-        dc1394_log_warning ("usb: Bulk transfer %d cancelled", f->frame.id);
+static void
+notify_close (platform_camera_t * craw)
+{
+    if (craw->notify_fd[0] == 0 && craw->notify_fd[1] == 0)
         return;
+    close (craw->notify_fd[0]);
+    if (craw->notify_fd[1] != craw->notify_fd[0])
+        close (craw->notify_fd[1]);
+    craw->notify_fd[0] = 0;
+    craw->notify_fd[1] = 0;
+}
+
+static int
+notify_post (platform_camera_t * craw)
+{
+    if (craw->notify_fd[1] == craw->notify_fd[0]) {
+        uint64_t one = 1;
+        return write (craw->notify_fd[1], &one, sizeof one) == sizeof one;
+    }
+    return write (craw->notify_fd[1], "+", 1) == 1;
+}
+
+/* Takes one frame off the count, waiting for it if there is none */
+static int
+notify_take (platform_camera_t * craw)
+{
+    if (craw->notify_fd[1] == craw->notify_fd[0]) {
+        uint64_t count;
+        return read (craw->notify_fd[0], &count, sizeof count) == sizeof count;
     }
+    char ch;
+    return read (craw->notify_fd[0], &ch, 1) == 1;
+}
+
+/* Drops a transfer from the in-flight count, see dc1394_usb_capture_stop() */
+static void
+transfer_done (platform_camera_t * craw)
+{
+    if (__atomic_sub_fetch (&craw->transfers_in_flight, 1,
+                __ATOMIC_ACQ_REL) == 0) {
+        pthread_mutex_lock (&craw->drain_mutex);
+        pthread_cond_broadcast (&craw->drained);
+        pthread_mutex_unlock (&craw->drain_mutex);
+    }
+}
+
+/* The device ends a frame with a short packet. If that happens before the
+ * last chunk of a frame, the chunks left would get the start of the next
+ * frame of the device, and every later frame would be shifted. They are
+ * cancelled instead, so that the next frame of the device goes to the
+ * first chunk of the next frame. */
+static void
+resync_frame (struct usb_frame * f, struct libusb_transfer * transfer)
+{
+    int i;
+
+    for (i = 0; i < f->num_chunks && f->chunks[i] != transfer; i++)
+        ;
+    if (i >= f->num_chunks - 1 || f->resyncing)
+        return;
+
+    dc1394_log_debug ("usb: Frame %d ended at chunk %d of %d, resynchronizing",
+            f->frame.id, i + 1, f->num_chunks);
+    f->resyncing = 1;
+    for (i++; i < f->num_chunks; i++)
+        libusb_cancel_transfer (f->chunks[i]);
+}
+
+/* A frame is split in several transfers, and is complete once the last of
+ * them is. */
+static void
+chunk_complete (struct usb_frame * f, struct libusb_transfer * transfer)
+{
+    platform_camera_t * craw = f->pcam;
+    struct timeval tv;
+    uint32_t tail;
 
     dc1394_log_debug ("usb: Bulk transfer %d complete, %d of %d bytes",
             f->frame.id, transfer->actual_length, transfer->length);
     int status = BUFFER_FILLED;
-    if (transfer->actual_length < transfer->length)
+    if (transfer->status == LIBUSB_TRANSFER_CANCELLED) {
+        /* Cancelled by resync_frame: what it got is lost */
         status = BUFFER_CORRUPT;
-
-    if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+        if (transfer->actual_length > 0)
+            craw->resync_lost_data = 1;
+    }
+    else if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
         dc1394_log_error ("usb: Bulk transfer %d failed with code %d",
                 f->frame.id, transfer->status);
         status = BUFFER_ERROR;
     }
+    else if (transfer->actual_length < transfer->length) {
+        status = BUFFER_CORRUPT;
+        resync_frame (f, transfer);
+    }
+
+    /* Only the event thread runs callbacks: no need to lock these */
+    if (status > f->chunk_status)
+        f->chunk_status = status;
+    if (--f->chunks_pending > 0)
+        return;
+
+    if (craw->resync_lost_data && !f->resyncing) {
+        craw->resync_lost_data = 0;
+        if (f->chunk_status < BUFFER_CORRUPT)
+            f->chunk_status = BUFFER_CORRUPT;
+    }
+
+    /* There is no bus time to go by: stamp the frame on arrival */
+    gettimeofday (&tv, NULL);
+    f->frame.timestamp = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
 
-    pthread_mutex_lock (&craw->mutex);
-    f->status = status;
-    craw->frames_ready++;
-    pthread_mutex_unlock (&craw->mutex);
+    /* At most num_frames frames are in flight, so the ring never
+     * overflows.  Publishing the new tail also publishes the status. */
+    f->status = f->chunk_status;
+    tail = craw->ring_tail;
+    craw->ring[tail % craw->num_frames] = f->frame.id;
+    __atomic_store_n (&craw->ring_tail, tail + 1, __ATOMIC_RELEASE);
 
-    if (write (craw->notify_pipe[1], "+", 1)!=1) {
-        dc1394_log_error ("usb: Failed to write to notify pipe");
+    if (!notify_post (craw)) {
+        dc1394_log_error ("usb: Failed to signal a completed frame");
         // we may need to set the status to BUFFER_ERROR here
     }
 }
 
+/* Callback whenever a bulk transfer finishes. */
+static void
+callback (struct libusb_transfer * transfer)
+{
+    struct usb_frame * f = transfer->user_data;
+
+    if (transfer->status == LIBUSB_TRANSFER_CANCELLED && !f->resyncing)
+        dc1394_log_debug ("usb: Bulk transfer %d cancelled", f->frame.id);
+    else
+        chunk_complete (f, transfer);
+    transfer_done (f->pcam);
+}
+
+/* Queues all the transfers of a frame */
+static int
+submit_frame (struct usb_frame * f)
+{
+    int i;
+
+    f->chunks_pending = f->num_chunks;
+    f->chunk_status = BUFFER_FILLED;
+    f->resyncing = 0;
+    for (i = 0; i < f->num_chunks; i++) {
+        __atomic_add_fetch (&f->pcam->transfers_in_flight, 1,
+                __ATOMIC_ACQ_REL);
+        if (libusb_submit_transfer (f->chunks[i]) != LIBUSB_SUCCESS) {
+            transfer_done (f->pcam);
+            /* The chunks already submitted would complete the frame with
+             * what was meant for the next one */
+            dc1394_log_error ("usb: Failed to submit transfer %d of frame %d",
+                    i, f->frame.id);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Transfers per frame: the chunks must be a multiple of the largest bulk
+ * packet size (1024 bytes for SuperSpeed), or the device would overflow
+ * them.  By default aim at chunks of CHUNK_SIZE bytes, which keeps a few
+ * transfers in flight per frame on any host controller. */
+#define CHUNK_SIZE (512 * 1024)
+#define MAX_CHUNKS 64
+
+static uint32_t
+chunk_size (platform_camera_t * craw, uint64_t total_bytes)
+{
+    uint32_t n = DC1394_CAMERA_PRIV (craw->camera)->
+        capture_options.transfers_per_frame;
+    uint64_t size;
+
+    if (n == 0)
+        n = (total_bytes + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    if (n > MAX_CHUNKS)
+        n = MAX_CHUNKS;
+    if (n < 1)
+        n = 1;
+
+    size = (total_bytes + n - 1) / n;
+    size = (size + 1023) & ~(uint64_t) 1023;
+    if (size > total_bytes)
+        size = total_bytes;
+    return size;
+}
+
+/* Wakes the event thread up, see struct usb_event_loop */
+static void
+loop_wake (struct usb_event_loop * loop)
+{
+    uint64_t one = 1;
+    size_t len = loop->wake_fd[1] == loop->wake_fd[0] ? sizeof one : 1;
+
+    if (write (loop->wake_fd[1], &one, len) != len && errno != EAGAIN)
+        dc1394_log_error ("usb: Failed to wake the event thread up");
+}
+
+static void
+loop_drain (struct usb_event_loop * loop)
+{
+    char buf[64];
+
+    while (read (loop->wake_fd[0], buf, sizeof buf) > 0)
+        ;
+}
+
+static void
+pollfd_added (int fd, short events, void * user_data)
+{
+    struct usb_event_loop * loop = user_data;
+
+    __atomic_store_n (&loop->pollfds_changed, 1, __ATOMIC_RELEASE);
+    loop_wake (loop);
+}
+
+static void
+pollfd_removed (int fd, void * user_data)
+{
+    pollfd_added (fd, 0, user_data);
+}
+
+/* Rebuilds the poll set, with the wake fd first.  Leaves it NULL if libusb
+ * cannot expose its fds on this platform. */
+static void
+loop_get_pollfds (struct usb_event_loop * loop, struct pollfd ** fds,
+        nfds_t * nfds)
+{
+    const struct libusb_pollfd ** usbfds;
+    struct pollfd * p;
+    nfds_t i, n;
+
+    free (*fds);
+    *fds = NULL;
+    *nfds = 0;
+
+    usbfds = libusb_get_pollfds (loop->context);
+    if (!usbfds)
+        return;
+    for (n = 0; usbfds[n]; n++)
+        ;
+    p = calloc (n + 1, sizeof *p);
+    if (p) {
+        p[0].fd = loop->wake_fd[0];
+        p[0].events = POLLIN;
+        for (i = 0; i < n; i++) {
+            p[i + 1].fd = usbfds[i]->fd;
+            p[i + 1].events = usbfds[i]->events;
+        }
+        *fds = p;
+        *nfds = n + 1;
+    }
+    libusb_free_pollfds (usbfds);
+}
+
 static void *
-capture_thread (void * arg)
+event_thread (void * arg)
 {
-    platform_camera_t * craw = arg;
-
-    dc1394_log_debug ("usb: Helper thread starting");
-
-    while (1) {
-        struct timeval tv = {
-            .tv_sec = 0,
-            .tv_usec = 100000,
-        };
-        libusb_handle_events_timeout(craw->thread_context, &tv);
-        pthread_mutex_lock (&craw->mutex);
-        if (craw->kill_thread)
+    struct usb_event_loop * loop = arg;
+    struct pollfd * fds = NULL;
+    nfds_t nfds = 0;
+
+    dc1394_log_debug ("usb: Event thread starting");
+
+    /* Completions touch the buffers: run next to them if so requested */
+    dc1394_capture_bind_thread (loop->camera);
+
+    while (!__atomic_load_n (&loop->stop, __ATOMIC_ACQUIRE)) {
+        struct timeval tv = { 0, 0 };
+        int timeout = -1;
+
+        if (__atomic_exchange_n (&loop->pollfds_changed, 0, __ATOMIC_ACQ_REL))
+            loop_get_pollfds (loop, &fds, &nfds);
+
+        if (!fds) {
+            /* Nothing to poll on: fall back to waking up periodically */
+            tv.tv_usec = 100000;
+            libusb_handle_events_timeout (loop->context, &tv);
+            continue;
+        }
+
+        if (libusb_get_next_timeout (loop->context, &tv) == 1)
+            timeout = tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000;
+        if (poll (fds, nfds, timeout) < 0 && errno != EINTR) {
+            dc1394_log_error ("usb: Failed to poll for USB events");
             break;
-        pthread_mutex_unlock (&craw->mutex);
+        }
+        if (fds[0].revents & POLLIN)
+            loop_drain (loop);
+
+        tv.tv_sec = 0;
+        tv.tv_usec = 0;
+        libusb_handle_events_timeout (loop->context, &tv);
     }
-    pthread_mutex_unlock (&craw->mutex);
-    dc1394_log_debug ("usb: Helper thread ending");
+    free (fds);
+    dc1394_log_debug ("usb: Event thread ending");
     return NULL;
 }
 
+static void
+event_loop_free (struct usb_event_loop * loop)
+{
+    if (loop->thread_created) {
+        __atomic_store_n (&loop->stop, 1, __ATOMIC_RELEASE);
+        loop_wake (loop);
+        pthread_join (loop->thread, NULL);
+        dc1394_log_debug ("usb: Joined with event thread");
+    }
+    if (loop->context) {
+        libusb_set_pollfd_notifiers (loop->context, NULL, NULL, NULL);
+        libusb_exit (loop->context);
+    }
+    if (loop->wake_fd[0] >= 0)
+        close (loop->wake_fd[0]);
+    if (loop->wake_fd[1] != loop->wake_fd[0])
+        close (loop->wake_fd[1]);
+    free (loop);
+}
+
+static struct usb_event_loop *
+event_loop_new (dc1394camera_t * camera)
+{
+    struct usb_event_loop * loop = calloc (1, sizeof *loop);
+
+    if (!loop)
+        return NULL;
+    loop->wake_fd[0] = loop->wake_fd[1] = -1;
+    loop->users = 1;
+    loop->camera = camera;
+    loop->pollfds_changed = 1;
+
+#ifdef HAVE_SYS_EVENTFD_H
+    loop->wake_fd[0] = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+    loop->wake_fd[1] = loop->wake_fd[0];
+#endif
+    if (loop->wake_fd[0] < 0) {
+        if (pipe (loop->wake_fd) < 0) {
+            loop->wake_fd[0] = loop->wake_fd[1] = -1;
+            dc1394_log_error ("usb: Failed to create the event thread wake fd");
+            event_loop_free (loop);
+            return NULL;
+        }
+        fcntl (loop->wake_fd[0], F_SETFL, O_NONBLOCK);
+        fcntl (loop->wake_fd[1], F_SETFL, O_NONBLOCK);
+    }
+
+    if (libusb_init (&loop->context) != 0) {
+        loop->context = NULL;
+        dc1394_log_error ("usb: Failed to create thread USB context");
+        event_loop_free (loop);
+        return NULL;
+    }
+    libusb_set_pollfd_notifiers (loop->context, pollfd_added, pollfd_removed,
+            loop);
+
+    if (pthread_create (&loop->thread, NULL, event_thread, loop) != 0) {
+        dc1394_log_error ("usb: Failed to launch event thread");
+        event_loop_free (loop);
+        return NULL;
+    }
+    loop->thread_created = 1;
+    return loop;
+}
+
+/* Gets the event loop of a camera: its own, or the one shared by all the
+ * cameras of the platform that set shared_event_thread */
+static int
+capture_loop_acquire (platform_camera_t * craw)
+{
+    platform_t * p = craw->platform;
+
+    if (!DC1394_CAMERA_PRIV (craw->camera)->
+            capture_options.shared_event_thread) {
+        craw->loop = event_loop_new (craw->camera);
+        return craw->loop ? 0 : -1;
+    }
+
+    pthread_mutex_lock (&p->loop_mutex);
+    if (p->shared_loop)
+        p->shared_loop->users++;
+    else
+        p->shared_loop = event_loop_new (craw->camera);
+    craw->loop = p->shared_loop;
+    pthread_mutex_unlock (&p->loop_mutex);
+
+    return craw->loop ? 0 : -1;
+}
+
+static void
+capture_loop_release (platform_camera_t * craw)
+{
+    platform_t * p = craw->platform;
+    struct usb_event_loop * loop = craw->loop;
+
+    craw->loop = NULL;
+    pthread_mutex_lock (&p->loop_mutex);
+    if (loop == p->shared_loop) {
+        if (--loop->users > 0)
+            loop = NULL;
+        else
+            p->shared_loop = NULL;
+    }
+    pthread_mutex_unlock (&p->loop_mutex);
+
+    if (loop)
+        event_loop_free (loop);
+}
+
 static dc1394error_t
-init_frame(platform_camera_t *craw, int index, dc1394video_frame_t *proto)
+init_frame(platform_camera_t *craw, int index, dc1394video_frame_t *proto,
+        unsigned char ** buffers)
 {
     struct usb_frame *f = craw->frames + index;
 
     memcpy (&f->frame, proto, sizeof f->frame);
-    f->frame.image = craw->buffer + index * proto->total_bytes;
+    if (buffers)
+        f->frame.image = buffers[index];
+    else
+        f->frame.image = craw->buffer + index * proto->total_bytes;
     f->frame.id = index;
-    f->transfer = libusb_alloc_transfer (0);
     f->pcam = craw;
     f->status = BUFFER_EMPTY;
+
+    uint64_t size = chunk_size (craw, proto->total_bytes);
+    uint64_t offset;
+    int i;
+
+    f->num_chunks = (proto->total_bytes + size - 1) / size;
+    f->chunks = calloc (f->num_chunks, sizeof *f->chunks);
+    if (!f->chunks) {
+        f->num_chunks = 0;
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    }
+    for (i = 0, offset = 0; i < f->num_chunks; i++, offset += size) {
+        f->chunks[i] = libusb_alloc_transfer (0);
+        if (!f->chunks[i]) {
+            /* Leave no half-made frame for capture_stop */
+            while (i-- > 0)
+                libusb_free_transfer (f->chunks[i]);
+            free (f->chunks);
+            f->chunks = NULL;
+            f->num_chunks = 0;
+            return DC1394_MEMORY_ALLOCATION_FAILURE;
+        }
+        if (offset + size > proto->total_bytes)
+            size = proto->total_bytes - offset;
+        libusb_fill_bulk_transfer (f->chunks[i], craw->thread_handle,
+                0x81, f->frame.image + offset, size, callback, f, 0);
+    }
     return DC1394_SUCCESS;
 }
 
-dc1394error_t
-dc1394_usb_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
-        uint32_t flags)
+/* Transfers go straight into the user buffers if there are any */
+static dc1394error_t
+capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
+        uint32_t flags, unsigned char ** buffers, size_t buffer_size)
 {
     dc1394video_frame_t proto;
     int i;
@@ -127,7 +538,7 @@ dc1394_usb_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
         return DC1394_FAILURE;
     }
 
-    if (pipe (craw->notify_pipe) < 0) {
+    if (notify_open (craw) < 0) {
         dc1394_usb_capture_stop (craw);
         return DC1394_FAILURE;
     }
@@ -136,26 +547,42 @@ dc1394_usb_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
 
     craw->num_frames = num_dma_buffers;
     craw->current = -1;
-    craw->frames_ready = 0;
+    craw->ring_head = 0;
+    craw->ring_tail = 0;
     craw->queue_broken = 0;
-    craw->buffer_size = proto.total_bytes * num_dma_buffers;
-    craw->buffer = malloc (craw->buffer_size);
-    if (craw->buffer == NULL) {
-        dc1394_usb_capture_stop (craw);
-        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    craw->resync_lost_data = 0;
+    if (buffers) {
+        if (buffer_size < proto.total_bytes) {
+            dc1394_log_error ("usb: Buffers of %zu bytes are too small for "
+                    "frames of %"PRIu64" bytes", buffer_size,
+                    proto.total_bytes);
+            dc1394_usb_capture_stop (craw);
+            return DC1394_INVALID_ARGUMENT_VALUE;
+        }
+        for (i = 0; i < num_dma_buffers; i++)
+            capture_lock_buffer (camera, buffers[i], proto.total_bytes);
+    }
+    else {
+        craw->buffer_size = proto.total_bytes * num_dma_buffers;
+        craw->buffer = capture_alloc_buffer (camera, craw->buffer_size,
+                &craw->buffer_alloc_size);
+        if (craw->buffer == NULL) {
+            dc1394_usb_capture_stop (craw);
+            return DC1394_MEMORY_ALLOCATION_FAILURE;
+        }
+        capture_lock_buffer (camera, craw->buffer, craw->buffer_size);
     }
 
+    craw->ring = calloc (num_dma_buffers, sizeof *craw->ring);
     craw->frames = calloc (num_dma_buffers, sizeof *craw->frames);
-    if (craw->frames == NULL) {
+    if (craw->frames == NULL || craw->ring == NULL) {
         dc1394_usb_capture_stop (craw);
         return DC1394_MEMORY_ALLOCATION_FAILURE;
     }
 
-    for (i = 0; i < num_dma_buffers; i++)
-        init_frame(craw, i, &proto);
 
-    if (libusb_init(&craw->thread_context) != 0) {
-        dc1394_log_error ("usb: Failed to create thread USB context");
+    craw->transfers_in_flight = 0;
+    if (capture_loop_acquire (craw) < 0) {
         dc1394_usb_capture_stop (craw);
         return DC1394_FAILURE;
     }
@@ -164,7 +591,7 @@ dc1394_usb_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
     uint8_t addr = libusb_get_device_address (libusb_get_device (craw->handle));
 
     libusb_device **list, *dev;
-    libusb_get_device_list (craw->thread_context, &list);
+    libusb_get_device_list (craw->loop->context, &list);
     for (i = 0, dev = list[0]; dev; dev = list[++i]) {
         if (libusb_get_bus_number (dev) == bus &&
                 libusb_get_device_address (dev) == addr)
@@ -192,31 +619,21 @@ dc1394_usb_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
     }
 
     for (i = 0; i < craw->num_frames; i++) {
-        struct usb_frame *f = craw->frames + i;
-        libusb_fill_bulk_transfer (f->transfer, craw->thread_handle,
-                0x81, f->frame.image, f->frame.total_bytes,
-                callback, f, 0);
+        if (init_frame (craw, i, &proto, buffers) != DC1394_SUCCESS) {
+            dc1394_usb_capture_stop (craw);
+            return DC1394_MEMORY_ALLOCATION_FAILURE;
+        }
     }
+    dc1394_log_debug ("usb: %d transfers per frame",
+            craw->frames[0].num_chunks);
+
     for (i = 0; i < craw->num_frames; i++) {
-        if (libusb_submit_transfer (craw->frames[i].transfer) < 0) {
-            dc1394_log_error ("usb: Failed to submit initial transfer %d", i);
+        if (submit_frame (craw->frames + i) < 0) {
             dc1394_usb_capture_stop (craw);
             return DC1394_FAILURE;
         }
     }
 
-    if (pthread_mutex_init (&craw->mutex, NULL) < 0) {
-        dc1394_usb_capture_stop (craw);
-        return DC1394_FAILURE;
-    }
-    craw->mutex_created = 1;
-    if (pthread_create (&craw->thread, NULL, capture_thread, craw) < 0) {
-        dc1394_log_error ("usb: Failed to launch helper thread");
-        dc1394_usb_capture_stop (craw);
-        return DC1394_FAILURE;
-    }
-    craw->thread_created = 1;
-
     // if auto iso is requested, start ISO
     if (flags & DC1394_CAPTURE_FLAGS_AUTO_ISO) {
         dc1394_video_set_transmission(camera, DC1394_ON);
@@ -226,6 +643,21 @@ dc1394_usb_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
     return DC1394_SUCCESS;
 }
 
+dc1394error_t
+dc1394_usb_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
+        uint32_t flags)
+{
+    return capture_setup (craw, num_dma_buffers, flags, NULL, 0);
+}
+
+dc1394error_t
+dc1394_usb_capture_setup_with_buffers(platform_camera_t *craw,
+        uint32_t num_buffers, uint32_t flags, unsigned char ** buffers,
+        size_t buffer_size)
+{
+    return capture_setup (craw, num_buffers, flags, buffers, buffer_size);
+}
+
 dc1394error_t
 dc1394_usb_capture_stop(platform_camera_t *craw)
 {
@@ -243,25 +675,22 @@ dc1394_usb_capture_stop(platform_camera_t *craw)
         craw->iso_auto_started = 0;
     }
 
-    if (craw->thread_created) {
-#if 0
+    /* Cancel what is in flight, and wait for the event thread to call it
+     * all back before the transfers go away */
+    if (craw->frames) {
         for (i = 0; i < craw->num_frames; i++) {
-            libusb_cancel_transfer (craw->frames[i].transfer);
-        }
-#endif
-        pthread_mutex_lock (&craw->mutex);
-        craw->kill_thread = 1;
-        pthread_mutex_unlock (&craw->mutex);
-        pthread_join (craw->thread, NULL);
-        dc1394_log_debug ("usb: Joined with helper thread");
-        craw->kill_thread = 0;
-        craw->thread_created = 0;
-    }
+            struct usb_frame * f = craw->frames + i;
+            int j;
 
-    if (craw->mutex_created) {
-        pthread_mutex_destroy (&craw->mutex);
-        craw->mutex_created = 0;
+            for (j = 0; j < f->num_chunks && f->chunks; j++)
+                if (f->chunks[j])
+                    libusb_cancel_transfer (f->chunks[j]);
+        }
     }
+    pthread_mutex_lock (&craw->drain_mutex);
+    while (__atomic_load_n (&craw->transfers_in_flight, __ATOMIC_ACQUIRE))
+        pthread_cond_wait (&craw->drained, &craw->drain_mutex);
+    pthread_mutex_unlock (&craw->drain_mutex);
 
     if (craw->thread_handle) {
         libusb_release_interface (craw->thread_handle, 0);
@@ -269,42 +698,43 @@ dc1394_usb_capture_stop(platform_camera_t *craw)
         craw->thread_handle = NULL;
     }
 
-    if (craw->thread_context) {
-        libusb_exit (craw->thread_context);
-        craw->thread_context = NULL;
-    }
+    if (craw->loop)
+        capture_loop_release (craw);
 
     if (craw->frames) {
         for (i = 0; i < craw->num_frames; i++) {
-            libusb_free_transfer (craw->frames[i].transfer);
+            struct usb_frame * f = craw->frames + i;
+            int j;
+
+            for (j = 0; j < f->num_chunks && f->chunks; j++)
+                if (f->chunks[j])
+                    libusb_free_transfer (f->chunks[j]);
+            free (f->chunks);
         }
         free (craw->frames);
         craw->frames = NULL;
     }
 
-    free (craw->buffer);
+    capture_free_buffer (craw->buffer, craw->buffer_alloc_size);
     craw->buffer = NULL;
 
-    if (craw->notify_pipe[0] != 0 || craw->notify_pipe[1] != 0) {
-        close (craw->notify_pipe[0]);
-        close (craw->notify_pipe[1]);
-    }
-    craw->notify_pipe[0] = 0;
-    craw->notify_pipe[1] = 0;
+    free (craw->ring);
+    craw->ring = NULL;
+
+    notify_close (craw);
 
     craw->capture_is_set = 0;
 
     return DC1394_SUCCESS;
 }
 
-#define NEXT_BUFFER(c,i) (((i) == -1) ? 0 : ((i)+1)%(c)->num_frames)
-
 dc1394error_t
 dc1394_usb_capture_dequeue (platform_camera_t * craw,
         dc1394capture_policy_t policy, dc1394video_frame_t **frame_return)
 {
-    int next = NEXT_BUFFER (craw, craw->current);
-    struct usb_frame * f = craw->frames + next;
+    struct usb_frame * f;
+    uint32_t head = craw->ring_head;
+    uint32_t tail;
 
     if ((policy < DC1394_CAPTURE_POLICY_MIN)
             || (policy > DC1394_CAPTURE_POLICY_MAX))
@@ -313,35 +743,30 @@ dc1394_usb_capture_dequeue (platform_camera_t * craw,
     /* default: return NULL in case of failures or lack of frames */
     *frame_return = NULL;
 
-    if (policy == DC1394_CAPTURE_POLICY_POLL) {
-        int status;
-        pthread_mutex_lock (&craw->mutex);
-        status = f->status;
-        pthread_mutex_unlock (&craw->mutex);
-        if (status == BUFFER_EMPTY)
-            return DC1394_SUCCESS;
-    }
+    if (policy == DC1394_CAPTURE_POLICY_POLL &&
+            __atomic_load_n (&craw->ring_tail, __ATOMIC_ACQUIRE) == head)
+        return DC1394_SUCCESS;
 
     if (craw->queue_broken)
         return DC1394_FAILURE;
 
-    char ch;
-    if (read (craw->notify_pipe[0], &ch, 1)!=1) {
-        dc1394_log_error ("usb: Failed to read from notify pipe");
+    /* The only syscall: consume the frame from the notify count, which
+     * also does the waiting in DC1394_CAPTURE_POLICY_WAIT */
+    if (!notify_take (craw)) {
+        dc1394_log_error ("usb: Failed to wait for a completed frame");
         return DC1394_FAILURE;
     }
 
-    pthread_mutex_lock (&craw->mutex);
-    if (f->status == BUFFER_EMPTY) {
+    tail = __atomic_load_n (&craw->ring_tail, __ATOMIC_ACQUIRE);
+    if (tail == head) {
         dc1394_log_error ("usb: Expected filled buffer");
-        pthread_mutex_unlock (&craw->mutex);
         return DC1394_FAILURE;
     }
-    craw->frames_ready--;
-    f->frame.frames_behind = craw->frames_ready;
-    pthread_mutex_unlock (&craw->mutex);
+    f = craw->frames + craw->ring[head % craw->num_frames];
+    craw->ring_head = head + 1;
 
-    craw->current = next;
+    f->frame.frames_behind = tail - head - 1;
+    craw->current = f->frame.id;
 
     *frame_return = &f->frame;
 
@@ -369,7 +794,7 @@ dc1394_usb_capture_enqueue (platform_camera_t * craw,
     }
 
     f->status = BUFFER_EMPTY;
-    if (libusb_submit_transfer (f->transfer) != LIBUSB_SUCCESS) {
+    if (submit_frame (f) < 0) {
         craw->queue_broken = 1;
         return DC1394_FAILURE;
     }
@@ -380,10 +805,10 @@ dc1394_usb_capture_enqueue (platform_camera_t * craw,
 int
 dc1394_usb_capture_get_fileno (platform_camera_t * craw)
 {
-    if (craw->notify_pipe[0] == 0 && craw->notify_pipe[1] == 0)
+    if (craw->notify_fd[0] == 0 && craw->notify_fd[1] == 0)
         return -1;
 
-    return craw->notify_pipe[0];
+    return craw->notify_fd[0];
 }
 
 dc1394bool_t
@@ -40,6 +40,7 @@ dc1394_usb_new (void)
 
     platform_t * p = calloc (1, sizeof (platform_t));
     p->context = context;
+    pthread_mutex_init (&p->loop_mutex, NULL);
     return p;
 }
 static void
@@ -48,6 +49,7 @@ dc1394_usb_free (platform_t * p)
     if (p->context)
         libusb_exit(p->context);
     p->context = NULL;
+    pthread_mutex_destroy (&p->loop_mutex);
     free (p);
 }
 
@@ -271,6 +273,9 @@ dc1394_usb_camera_new (platform_t * p, platform_device_t * device,
 
     camera = calloc (1, sizeof (platform_camera_t));
     camera->handle = handle;
+    camera->platform = p;
+    pthread_mutex_init (&camera->drain_mutex, NULL);
+    pthread_cond_init (&camera->drained, NULL);
     return camera;
 }
 
@@ -278,6 +283,8 @@ static void dc1394_usb_camera_free (platform_camera_t * cam)
 {
     libusb_close (cam->handle);
     cam->handle = NULL;
+    pthread_cond_destroy (&cam->drained);
+    pthread_mutex_destroy (&cam->drain_mutex);
     free (cam);
 }
 
@@ -372,6 +379,7 @@ usb_dispatch = {
     .camera_write = dc1394_usb_camera_write,
 
     .capture_setup = dc1394_usb_capture_setup,
+    .capture_setup_with_buffers = dc1394_usb_capture_setup_with_buffers,
     .capture_stop = dc1394_usb_capture_stop,
     .capture_dequeue = dc1394_usb_capture_dequeue,
     .capture_enqueue = dc1394_usb_capture_enqueue,
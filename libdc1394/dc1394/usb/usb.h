@@ -24,13 +24,20 @@
 #define __DC1394_USB_H__
 
 #include <libusb.h>
+#include <pthread.h>
 #include "config.h"
 #include "internal.h"
 #include "register.h"
 #include "offsets.h"
 
+struct usb_event_loop;
+
 struct _platform_t {
     libusb_context *context;
+
+    /* Event thread shared by the cameras that ask for it */
+    pthread_mutex_t loop_mutex;
+    struct usb_event_loop * shared_loop;
 };
 
 struct _platform_camera_t {
@@ -40,27 +47,53 @@ struct _platform_camera_t {
     struct usb_frame        * frames;
     unsigned char        * buffer;
     size_t buffer_size;
+    size_t buffer_alloc_size;
     uint32_t flags;
     unsigned int num_frames;
     int current;
-    int frames_ready;
     int queue_broken;
+    /* A cancelled chunk may have taken the start of the next frame of
+     * the device, so the next frame to complete is incomplete */
+    int resync_lost_data;
+
+    /* Completed frame indices, see dc1394_usb_capture_dequeue() */
+    uint32_t * ring;
+    uint32_t ring_head;
+    uint32_t ring_tail;
 
     uint8_t bus;
     uint8_t addr;
-    int notify_pipe[2];
-    pthread_t thread;
-    int thread_created;
-    pthread_mutex_t mutex;
-    int mutex_created;
-    libusb_context *thread_context;
+    int notify_fd[2];
+    platform_t * platform;
+    struct usb_event_loop * loop;
     libusb_device_handle *thread_handle;
-    int kill_thread;
+
+    /* Transfers submitted and not called back yet, so that capture can
+     * stop without waiting for the event thread to exit */
+    int transfers_in_flight;
+    pthread_mutex_t drain_mutex;
+    pthread_cond_t drained;
 
     int capture_is_set;
     int iso_auto_started;
 };
 
+/* A libusb context and the thread handling its events.  The thread sleeps
+ * in poll() on the libusb fds and on wake_fd, with no timeout unless
+ * libusb has one pending, so that it only wakes up for completions and
+ * for shutdown. */
+struct usb_event_loop {
+    libusb_context * context;
+    pthread_t thread;
+    int thread_created;
+    int wake_fd[2];
+    int stop;
+    int pollfds_changed;
+    /* Cameras using the loop, and the one whose placement the thread has */
+    int users;
+    dc1394camera_t * camera;
+};
+
 typedef enum {
     BUFFER_EMPTY,
     BUFFER_FILLED,
@@ -70,7 +103,13 @@ typedef enum {
 
 struct usb_frame {
     dc1394video_frame_t frame;
-    struct libusb_transfer * transfer;
+    /* The frame is transferred in chunks to consecutive regions */
+    struct libusb_transfer ** chunks;
+    int num_chunks;
+    int chunks_pending;
+    usb_frame_status chunk_status;
+    /* The device ended its frame early: the chunks left are cancelled */
+    int resyncing;
     platform_camera_t * pcam;
     usb_frame_status status;
 };
@@ -80,6 +119,11 @@ dc1394error_t
 dc1394_usb_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
         uint32_t flags);
 
+dc1394error_t
+dc1394_usb_capture_setup_with_buffers(platform_camera_t *craw,
+        uint32_t num_buffers, uint32_t flags, unsigned char ** buffers,
+        size_t buffer_size);
+
 dc1394error_t
 dc1394_usb_capture_stop(platform_camera_t *craw);
 
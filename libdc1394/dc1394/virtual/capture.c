@@ -0,0 +1,506 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Capture from virtual cameras
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+
+#include "virtual/virtual.h"
+
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+/* Generated frames are made once, at most this much of them */
+#define SOURCE_MEMORY   (64 * 1024 * 1024)
+#define SOURCE_FRAMES   16
+
+/* The notify fd counts the filled frames, as in the usb backend */
+static int
+notify_open (platform_camera_t * craw)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+    int fd = eventfd (0, EFD_SEMAPHORE | EFD_CLOEXEC);
+    if (fd >= 0) {
+        craw->notify_fd[0] = craw->notify_fd[1] = fd;
+        return 0;
+    }
+#endif
+    return pipe (craw->notify_fd);
+}
+
+static void
+notify_close (platform_camera_t * craw)
+{
+    if (craw->notify_fd[0] == 0 && craw->notify_fd[1] == 0)
+        return;
+    close (craw->notify_fd[0]);
+    if (craw->notify_fd[1] != craw->notify_fd[0])
+        close (craw->notify_fd[1]);
+    craw->notify_fd[0] = 0;
+    craw->notify_fd[1] = 0;
+}
+
+static int
+notify_post (platform_camera_t * craw)
+{
+    if (craw->notify_fd[1] == craw->notify_fd[0]) {
+        uint64_t one = 1;
+        return write (craw->notify_fd[1], &one, sizeof one) == sizeof one;
+    }
+    return write (craw->notify_fd[1], "+", 1) == 1;
+}
+
+static int
+notify_take (platform_camera_t * craw)
+{
+    if (craw->notify_fd[1] == craw->notify_fd[0]) {
+        uint64_t count;
+        return read (craw->notify_fd[0], &count, sizeof count) == sizeof count;
+    }
+    char ch;
+    return read (craw->notify_fd[0], &ch, 1) == 1;
+}
+
+/* Loads the frames of a file, which must be a whole number of images */
+static int
+load_file (platform_camera_t * craw, const char * path, uint64_t image_bytes)
+{
+    struct stat st;
+    uint64_t done = 0;
+    int fd;
+
+    fd = open (path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat (fd, &st) < 0) {
+        dc1394_log_error ("virtual: Cannot open %s: %s", path,
+                strerror (errno));
+        if (fd >= 0)
+            close (fd);
+        return -1;
+    }
+    if (st.st_size == 0 || st.st_size % image_bytes) {
+        dc1394_log_error ("virtual: %s does not hold frames of %"PRIu64
+                " bytes", path, image_bytes);
+        close (fd);
+        return -1;
+    }
+
+    craw->source = malloc (st.st_size);
+    if (!craw->source) {
+        close (fd);
+        return -1;
+    }
+    while (done < st.st_size) {
+        ssize_t n = read (fd, craw->source + done, st.st_size - done);
+        if (n <= 0) {
+            dc1394_log_error ("virtual: Failed to read %s", path);
+            close (fd);
+            return -1;
+        }
+        done += n;
+    }
+    close (fd);
+    craw->num_sources = st.st_size / image_bytes;
+    return 0;
+}
+
+/* Makes the images that frames are filled from, so that filling a frame
+ * costs a copy, like a DMA transfer, rather than generating it */
+static int
+make_sources (platform_camera_t * craw, const dc1394video_frame_t * proto)
+{
+    platform_device_t * dev = craw->device;
+    uint64_t bytes = proto->image_bytes;
+    uint32_t state = 2463534242U;
+    uint32_t n, i;
+    uint64_t j;
+
+    if (dev->source == VIRTUAL_SOURCE_FILE)
+        return load_file (craw, dev->path, bytes);
+
+    n = SOURCE_MEMORY / bytes;
+    if (n > SOURCE_FRAMES)
+        n = SOURCE_FRAMES;
+    if (n == 0)
+        n = 1;
+    craw->source = malloc (n * bytes);
+    if (!craw->source)
+        return -1;
+    craw->num_sources = n;
+
+    for (i = 0; i < n; i++) {
+        unsigned char * image = craw->source + i * bytes;
+        for (j = 0; j < bytes; j++) {
+            if (dev->source == VIRTUAL_SOURCE_NOISE) {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                image[j] = state;
+            }
+            else
+                image[j] = j % proto->stride + j / proto->stride + 8 * i;
+        }
+    }
+    return 0;
+}
+
+/* Fills the next frame in, if the application gave it back in time */
+static void
+deliver_frame (platform_camera_t * craw, uint64_t n)
+{
+    struct virtual_frame * f = craw->frames + craw->fill_next;
+    uint64_t bytes = f->frame.image_bytes;
+    struct timeval tv;
+    uint32_t tail;
+
+    if (__atomic_load_n (&f->status, __ATOMIC_ACQUIRE) != BUFFER_EMPTY) {
+        craw->dropped++;
+        dc1394_log_debug ("virtual: No buffer for frame %"PRIu64, n);
+        return;
+    }
+
+    memcpy (f->frame.image, craw->source + (n % craw->num_sources) * bytes,
+            bytes);
+    gettimeofday (&tv, NULL);
+    f->frame.timestamp = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+    f->status = BUFFER_FILLED;
+
+    tail = craw->ring_tail;
+    craw->ring[tail % craw->num_frames] = f->frame.id;
+    __atomic_store_n (&craw->ring_tail, tail + 1, __ATOMIC_RELEASE);
+    if (++craw->since_interrupt >= craw->frames_per_interrupt) {
+        craw->since_interrupt = 0;
+        __atomic_store_n (&craw->interrupt_tail, tail + 1, __ATOMIC_RELEASE);
+        __atomic_add_fetch (&craw->interrupts, 1, __ATOMIC_RELEASE);
+        notify_post (craw);
+    }
+
+    craw->fill_next = (craw->fill_next + 1) % craw->num_frames;
+}
+
+static void
+timespec_add (struct timespec * ts, uint64_t ns)
+{
+    ns += ts->tv_nsec;
+    ts->tv_sec += ns / 1000000000;
+    ts->tv_nsec = ns % 1000000000;
+}
+
+static int
+timespec_before (const struct timespec * a, const struct timespec * b)
+{
+    return a->tv_sec < b->tv_sec ||
+        (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/* Sends frames at the rate of the camera while it is transmitting.  The
+ * schedule is absolute, so the rate does not drift; if the thread falls
+ * behind, it starts again from now instead of catching up in a burst. */
+static void *
+producer_thread (void * arg)
+{
+    platform_camera_t * craw = arg;
+    platform_device_t * dev = craw->device;
+    uint64_t period = 1e9 / dev->fps;
+    struct timespec next, now;
+    int running = 0;
+    uint64_t n = 0;
+
+    pthread_mutex_lock (&dev->mutex);
+    while (!craw->stop) {
+        if (!virtual_device_transmitting (dev)) {
+            running = 0;
+            pthread_cond_wait (&dev->changed, &dev->mutex);
+            continue;
+        }
+        if (!running) {
+            clock_gettime (CLOCK_MONOTONIC, &next);
+            timespec_add (&next, period);
+            running = 1;
+        }
+
+        /* Woken up early: check again whether to send */
+        if (pthread_cond_timedwait (&dev->changed, &dev->mutex,
+                    &next) != ETIMEDOUT)
+            continue;
+        if (!virtual_device_transmitting (dev))
+            continue;
+
+        if (!(dev->command[REG_CAMERA_ISO_EN / 4] & 0x80000000) &&
+                --dev->shots == 0)
+            dev->command[REG_CAMERA_ONE_SHOT / 4] = 0;
+        pthread_mutex_unlock (&dev->mutex);
+
+        deliver_frame (craw, n++);
+
+        timespec_add (&next, period);
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        if (timespec_before (&next, &now))
+            next = now;
+        pthread_mutex_lock (&dev->mutex);
+    }
+    pthread_mutex_unlock (&dev->mutex);
+
+    return NULL;
+}
+
+static dc1394error_t
+capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
+        uint32_t flags, unsigned char ** buffers, size_t buffer_size)
+{
+    dc1394video_frame_t proto;
+    dc1394camera_t * camera = craw->camera;
+    int i;
+
+    if (craw->capture_is_set > 0)
+        return DC1394_CAPTURE_IS_RUNNING;
+
+    craw->capture_is_set = 1;
+
+    if (flags & DC1394_CAPTURE_FLAGS_DEFAULT)
+        flags = DC1394_CAPTURE_FLAGS_CHANNEL_ALLOC |
+            DC1394_CAPTURE_FLAGS_BANDWIDTH_ALLOC;
+
+    craw->flags = flags;
+
+    if (capture_basic_setup(camera, &proto) != DC1394_SUCCESS) {
+        dc1394_log_error("virtual: Basic capture setup failed");
+        dc1394_virtual_capture_stop (craw);
+        return DC1394_FAILURE;
+    }
+
+    if (make_sources (craw, &proto) < 0 || notify_open (craw) < 0) {
+        dc1394_virtual_capture_stop (craw);
+        return DC1394_FAILURE;
+    }
+
+    craw->num_frames = num_dma_buffers;
+    craw->current = -1;
+    craw->ring_head = 0;
+    craw->ring_tail = 0;
+    craw->fill_next = 0;
+    craw->dropped = 0;
+    craw->frames_per_interrupt =
+        DC1394_CAMERA_PRIV (camera)->capture_options.frames_per_interrupt;
+    if (craw->frames_per_interrupt == 0)
+        craw->frames_per_interrupt = 1;
+    craw->since_interrupt = 0;
+    craw->interrupt_tail = 0;
+    craw->interrupts = 0;
+    craw->interrupts_taken = 0;
+    craw->frames_ready = 0;
+    if (buffers) {
+        if (buffer_size < proto.total_bytes) {
+            dc1394_log_error ("virtual: Buffers of %zu bytes are too small "
+                    "for frames of %"PRIu64" bytes", buffer_size,
+                    proto.total_bytes);
+            dc1394_virtual_capture_stop (craw);
+            return DC1394_INVALID_ARGUMENT_VALUE;
+        }
+        for (i = 0; i < num_dma_buffers; i++)
+            capture_lock_buffer (camera, buffers[i], proto.total_bytes);
+    }
+    else {
+        craw->buffer_size = proto.total_bytes * num_dma_buffers;
+        craw->buffer = capture_alloc_buffer (camera, craw->buffer_size,
+                &craw->buffer_alloc_size);
+        if (craw->buffer == NULL) {
+            dc1394_virtual_capture_stop (craw);
+            return DC1394_MEMORY_ALLOCATION_FAILURE;
+        }
+        capture_lock_buffer (camera, craw->buffer, craw->buffer_size);
+    }
+
+    craw->ring = calloc (num_dma_buffers, sizeof *craw->ring);
+    craw->frames = calloc (num_dma_buffers, sizeof *craw->frames);
+    if (craw->frames == NULL || craw->ring == NULL) {
+        dc1394_virtual_capture_stop (craw);
+        return DC1394_MEMORY_ALLOCATION_FAILURE;
+    }
+
+    for (i = 0; i < num_dma_buffers; i++) {
+        struct virtual_frame * f = craw->frames + i;
+
+        memcpy (&f->frame, &proto, sizeof f->frame);
+        if (buffers)
+            f->frame.image = buffers[i];
+        else
+            f->frame.image = craw->buffer + i * proto.total_bytes;
+        f->frame.id = i;
+        f->status = BUFFER_EMPTY;
+    }
+
+    craw->stop = 0;
+    if (pthread_create (&craw->thread, NULL, producer_thread, craw) != 0) {
+        dc1394_log_error ("virtual: Failed to launch the capture thread");
+        dc1394_virtual_capture_stop (craw);
+        return DC1394_FAILURE;
+    }
+    craw->thread_created = 1;
+
+    if (flags & DC1394_CAPTURE_FLAGS_AUTO_ISO) {
+        dc1394_video_set_transmission(camera, DC1394_ON);
+        craw->iso_auto_started = 1;
+    }
+
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_virtual_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
+        uint32_t flags)
+{
+    return capture_setup (craw, num_dma_buffers, flags, NULL, 0);
+}
+
+dc1394error_t
+dc1394_virtual_capture_setup_with_buffers(platform_camera_t *craw,
+        uint32_t num_buffers, uint32_t flags, unsigned char ** buffers,
+        size_t buffer_size)
+{
+    return capture_setup (craw, num_buffers, flags, buffers, buffer_size);
+}
+
+dc1394error_t
+dc1394_virtual_capture_stop(platform_camera_t *craw)
+{
+    dc1394camera_t * camera = craw->camera;
+    platform_device_t * dev = craw->device;
+
+    if (craw->capture_is_set == 0)
+        return DC1394_CAPTURE_IS_NOT_SET;
+
+    if (craw->iso_auto_started > 0) {
+        dc1394_video_set_transmission(camera, DC1394_OFF);
+        craw->iso_auto_started = 0;
+    }
+
+    if (craw->thread_created) {
+        pthread_mutex_lock (&dev->mutex);
+        craw->stop = 1;
+        pthread_cond_broadcast (&dev->changed);
+        pthread_mutex_unlock (&dev->mutex);
+        pthread_join (craw->thread, NULL);
+        craw->thread_created = 0;
+    }
+    if (craw->dropped)
+        dc1394_log_debug ("virtual: %"PRIu64" frames dropped", craw->dropped);
+
+    free (craw->frames);
+    craw->frames = NULL;
+    capture_free_buffer (craw->buffer, craw->buffer_alloc_size);
+    craw->buffer = NULL;
+    free (craw->ring);
+    craw->ring = NULL;
+    free (craw->source);
+    craw->source = NULL;
+    craw->num_sources = 0;
+
+    notify_close (craw);
+
+    craw->capture_is_set = 0;
+
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_virtual_capture_dequeue (platform_camera_t * craw,
+        dc1394capture_policy_t policy, dc1394video_frame_t **frame_return)
+{
+    struct virtual_frame * f;
+    uint32_t head = craw->ring_head;
+    uint32_t tail;
+
+    if ((policy < DC1394_CAPTURE_POLICY_MIN)
+            || (policy > DC1394_CAPTURE_POLICY_MAX))
+        return DC1394_INVALID_CAPTURE_POLICY;
+
+    *frame_return = NULL;
+
+    /* Like a read() on juju, consuming the interrupts that came makes all
+       the frames they completed ready; the fd is not readable again until
+       the next interrupt */
+    while (craw->frames_ready == 0) {
+        uint32_t pending = __atomic_load_n (&craw->interrupts,
+                __ATOMIC_ACQUIRE) - craw->interrupts_taken;
+
+        if (pending == 0) {
+            if (policy == DC1394_CAPTURE_POLICY_POLL)
+                return DC1394_SUCCESS;
+            pending = 1;
+        }
+        for (; pending > 0; pending--) {
+            if (!notify_take (craw)) {
+                dc1394_log_error ("virtual: Failed to wait for a frame");
+                return DC1394_FAILURE;
+            }
+            craw->interrupts_taken++;
+        }
+        craw->frames_ready = __atomic_load_n (&craw->interrupt_tail,
+                __ATOMIC_ACQUIRE) - head;
+    }
+
+    tail = __atomic_load_n (&craw->ring_tail, __ATOMIC_ACQUIRE);
+    f = craw->frames + craw->ring[head % craw->num_frames];
+    craw->ring_head = head + 1;
+    craw->frames_ready--;
+
+    f->frame.frames_behind = tail - head - 1;
+    craw->current = f->frame.id;
+
+    *frame_return = &f->frame;
+    return DC1394_SUCCESS;
+}
+
+dc1394error_t
+dc1394_virtual_capture_enqueue (platform_camera_t * craw,
+        dc1394video_frame_t * frame)
+{
+    struct virtual_frame * f = (struct virtual_frame *) frame;
+
+    if (frame->camera != craw->camera) {
+        dc1394_log_error("virtual: Camera does not match frame's camera");
+        return DC1394_INVALID_ARGUMENT_VALUE;
+    }
+
+    if (f->status != BUFFER_FILLED) {
+        dc1394_log_error ("virtual: Frame is not enqueuable");
+        return DC1394_FAILURE;
+    }
+
+    __atomic_store_n (&f->status, BUFFER_EMPTY, __ATOMIC_RELEASE);
+    return DC1394_SUCCESS;
+}
+
+int
+dc1394_virtual_capture_get_fileno (platform_camera_t * craw)
+{
+    if (craw->notify_fd[0] == 0 && craw->notify_fd[1] == 0)
+        return -1;
+
+    return craw->notify_fd[0];
+}
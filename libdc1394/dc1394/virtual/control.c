@@ -0,0 +1,746 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Virtual cameras, for testing and benchmarking without hardware
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * The virtual platform is only enabled when the DC1394_VIRTUAL environment
+ * variable describes cameras, separated by semicolons.  Each camera is a
+ * comma-separated list of settings, all optional:
+ *
+ *   width=640,height=480   maximum image size, and that of Format_7 mode 0
+ *   coding=mono8           mono8, mono16, raw8, raw16, yuv411, yuv422,
+ *                          yuv444, rgb8 or rgb16
+ *   filter=rggb            color filter of raw codings
+ *   depth=12               data depth of 16-bit codings
+ *   fps=30                 frame rate while transmitting
+ *   source=gradient        gradient or noise, generated frames
+ *   file=/path/to/frames   raw frames of the captured size, played in a loop
+ *   guid=0x...             GUID, by default 0x0000564952540000 + index
+ *
+ * e.g. DC1394_VIRTUAL="fps=60;width=1280,height=960,coding=raw8".  Each
+ * camera is an IIDC 1.31 camera with a config ROM, command registers and
+ * a single Format_7 mode, and delivers its frames through the usual
+ * capture functions at the given rate.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "config.h"
+#include "platform.h"
+#include "internal.h"
+#include "virtual/virtual.h"
+
+#define VIRTUAL_GUID            0x0000564952540000ULL
+#define VIRTUAL_VENDOR_ID       0x000000
+#define VIRTUAL_PACKET_UNIT     4
+#define VIRTUAL_PACKET_MAX      4096
+
+/* Features a virtual camera has, with their ranges */
+static const struct {
+    uint32_t offset;
+    uint32_t inquiry_bit;
+    uint32_t min;
+    uint32_t max;
+    uint32_t value;
+} virtual_features[] = {
+    { REG_CAMERA_BRIGHTNESS, 31,   0,  255, 128 },
+    { REG_CAMERA_SHUTTER,    24,   1, 4095, 500 },
+    { REG_CAMERA_GAIN,       23,   0, 1023,   0 },
+};
+
+static const struct {
+    const char * name;
+    dc1394color_coding_t coding;
+} virtual_codings[] = {
+    { "mono8",  DC1394_COLOR_CODING_MONO8 },
+    { "mono16", DC1394_COLOR_CODING_MONO16 },
+    { "raw8",   DC1394_COLOR_CODING_RAW8 },
+    { "raw16",  DC1394_COLOR_CODING_RAW16 },
+    { "yuv411", DC1394_COLOR_CODING_YUV411 },
+    { "yuv422", DC1394_COLOR_CODING_YUV422 },
+    { "yuv444", DC1394_COLOR_CODING_YUV444 },
+    { "rgb8",   DC1394_COLOR_CODING_RGB8 },
+    { "rgb16",  DC1394_COLOR_CODING_RGB16 },
+};
+
+static const struct {
+    const char * name;
+    dc1394color_filter_t filter;
+} virtual_filters[] = {
+    { "rggb", DC1394_COLOR_FILTER_RGGB },
+    { "gbrg", DC1394_COLOR_FILTER_GBRG },
+    { "grbg", DC1394_COLOR_FILTER_GRBG },
+    { "bggr", DC1394_COLOR_FILTER_BGGR },
+};
+
+#define CMD(reg)    dev->command[(reg) / 4]
+#define F7(reg)     dev->format7[(reg) / 4]
+
+/* Writes a text leaf at quadlet q of the ROM, and returns its length */
+static int
+rom_leaf (uint32_t * rom, int q, const char * text)
+{
+    int len = (strlen (text) + 3) / 4;
+    int i;
+
+    rom[q] = (2 + len) << 16;
+    rom[q + 1] = 0;
+    rom[q + 2] = 0;
+    for (i = 0; i < 4 * len; i++) {
+        uint32_t c = i < strlen (text) ? (unsigned char) text[i] : 0;
+        rom[q + 3 + i / 4] |= c << (8 * (3 - i % 4));
+    }
+    return 3 + len;
+}
+
+/* Lays out a config ROM with a root directory pointing to one IIDC unit.
+ * CRCs are left at zero, as nothing checks them. */
+static void
+build_rom (platform_device_t * dev)
+{
+    uint32_t * rom = dev->rom;
+    int leaf;
+
+    memset (rom, 0, sizeof dev->rom);
+    rom[0] = 0x04 << 24;
+    rom[1] = 0x31333934;                            /* "1394" */
+    rom[2] = 0x20ff5000;
+    rom[3] = dev->guid >> 32;
+    rom[4] = dev->guid & 0xffffffff;
+
+    /* Root directory */
+    rom[5] = 3 << 16;
+    rom[6] = 0x03 << 24 | VIRTUAL_VENDOR_ID;
+    rom[7] = 0x0c0083c0;
+    rom[8] = 0xd1 << 24 | (10 - 8);
+
+    /* Unit directory */
+    rom[10] = 3 << 16;
+    rom[11] = 0x12 << 24 | 0x00a02d;
+    rom[12] = 0x13 << 24 | 0x000102;
+    rom[13] = 0xd4 << 24 | (15 - 13);
+
+    /* Unit dependent directory: IIDC 1.31 */
+    rom[15] = 4 << 16;
+    rom[16] = 0x40 << 24 | VIRTUAL_COMMAND_BASE / 4;
+    rom[17] = 0x81 << 24 | (20 - 17);
+    leaf = 20 + rom_leaf (rom, 20, "libdc1394");
+    rom[18] = 0x82 << 24 | (leaf - 18);
+    rom_leaf (rom, leaf, "Virtual Camera");
+    rom[19] = 0x38 << 24 | 0x10;
+}
+
+/* Recomputes the Format_7 registers that follow from the settings, and
+ * flags bad settings in VALUE_SETTING */
+static void
+update_format7 (platform_device_t * dev)
+{
+    uint32_t left = F7 (REG_CAMERA_FORMAT7_IMAGE_POSITION) >> 16;
+    uint32_t top = F7 (REG_CAMERA_FORMAT7_IMAGE_POSITION) & 0xffff;
+    uint32_t width = F7 (REG_CAMERA_FORMAT7_IMAGE_SIZE) >> 16;
+    uint32_t height = F7 (REG_CAMERA_FORMAT7_IMAGE_SIZE) & 0xffff;
+    dc1394color_coding_t coding =
+        (F7 (REG_CAMERA_FORMAT7_COLOR_CODING_ID) >> 24) +
+        DC1394_COLOR_CODING_MIN;
+    uint32_t packet = F7 (REG_CAMERA_FORMAT7_BYTE_PER_PACKET) >> 16;
+    uint32_t bits, depth;
+    uint64_t total;
+
+    F7 (REG_CAMERA_FORMAT7_VALUE_SETTING) = 0x80000000;
+    if (width == 0 || height == 0 || left + width > dev->width ||
+            top + height > dev->height ||
+            !(F7 (REG_CAMERA_FORMAT7_COLOR_CODING_INQ) &
+                (0x80000000 >> (coding - DC1394_COLOR_CODING_MIN))) ||
+            dc1394_get_color_coding_bit_size (coding, &bits) !=
+            DC1394_SUCCESS) {
+        F7 (REG_CAMERA_FORMAT7_VALUE_SETTING) |= 0x00800000;
+        return;
+    }
+
+    total = (uint64_t) width * height * bits / 8;
+    if (packet == 0 || packet > VIRTUAL_PACKET_MAX ||
+            packet % VIRTUAL_PACKET_UNIT)
+        packet = VIRTUAL_PACKET_MAX;
+    if (coding == dev->coding)
+        depth = dev->depth;
+    else
+        dc1394_get_color_coding_data_depth (coding, &depth);
+
+    F7 (REG_CAMERA_FORMAT7_PIXEL_NUMBER_INQ) = width * height;
+    F7 (REG_CAMERA_FORMAT7_TOTAL_BYTES_HI_INQ) = total >> 32;
+    F7 (REG_CAMERA_FORMAT7_TOTAL_BYTES_LO_INQ) = total & 0xffffffff;
+    F7 (REG_CAMERA_FORMAT7_BYTE_PER_PACKET) = packet << 16 |
+        VIRTUAL_PACKET_MAX;
+    F7 (REG_CAMERA_FORMAT7_PACKET_PER_FRAME_INQ) =
+        (total + packet - 1) / packet;
+    F7 (REG_CAMERA_FORMAT7_DATA_DEPTH_INQ) = depth << 24;
+    CMD (REG_CAMERA_DATA_DEPTH) = depth << 24;
+}
+
+/* Puts the registers in their power-up state */
+static void
+reset_registers (platform_device_t * dev)
+{
+    int i;
+
+    memset (dev->command, 0, sizeof dev->command);
+    memset (dev->format7, 0, sizeof dev->format7);
+    dev->shots = 0;
+
+    /* Format_7 mode 0 only */
+    CMD (REG_CAMERA_V_FORMAT_INQ) = 0x80000000 >> 7;
+    CMD (REG_CAMERA_V_MODE_INQ_BASE + 7 * 4) = 0x80000000;
+    CMD (REG_CAMERA_V_CSR_INQ_BASE) = VIRTUAL_FORMAT7_BASE / 4;
+    /* One-shot and multi-shot, power control */
+    CMD (REG_CAMERA_BASIC_FUNC_INQ) = 1 << 15 | 1 << 12 | 1 << 11;
+    CMD (REG_CAMERA_VIDEO_FORMAT) = 7 << 29;
+    CMD (REG_CAMERA_VIDEO_MODE) = 0;
+    CMD (REG_CAMERA_ISO_DATA) = DC1394_ISO_SPEED_400 << 24;
+    CMD (REG_CAMERA_POWER) = 0x80000000;
+
+    for (i = 0; i < sizeof virtual_features / sizeof virtual_features[0];
+            i++) {
+        uint32_t offset = virtual_features[i].offset;
+        int hi = offset < REG_CAMERA_FEATURE_LO_BASE;
+
+        CMD (hi ? REG_CAMERA_FEATURE_HI_INQ : REG_CAMERA_FEATURE_LO_INQ) |=
+            1U << virtual_features[i].inquiry_bit;
+        /* Presence, read out, on/off and manual */
+        CMD (offset - REG_CAMERA_FEATURE_HI_BASE +
+                REG_CAMERA_FEATURE_HI_BASE_INQ) = 0x80000000 | 1 << 27 |
+            1 << 26 | 1 << 24 | virtual_features[i].min << 12 | virtual_features[i].max;
+        CMD (offset) = 0x80000000 | 1 << 25 | virtual_features[i].value;
+    }
+
+    F7 (REG_CAMERA_FORMAT7_MAX_IMAGE_SIZE_INQ) = dev->width << 16 |
+        dev->height;
+    F7 (REG_CAMERA_FORMAT7_UNIT_SIZE_INQ) = 1 << 16 | 1;
+    F7 (REG_CAMERA_FORMAT7_UNIT_POSITION_INQ) = 1 << 16 | 1;
+    F7 (REG_CAMERA_FORMAT7_IMAGE_SIZE) = dev->width << 16 | dev->height;
+    F7 (REG_CAMERA_FORMAT7_COLOR_CODING_ID) =
+        (dev->coding - DC1394_COLOR_CODING_MIN) << 24;
+    for (i = 0; i < sizeof virtual_codings / sizeof virtual_codings[0]; i++)
+        F7 (REG_CAMERA_FORMAT7_COLOR_CODING_INQ) |= 0x80000000 >>
+            (virtual_codings[i].coding - DC1394_COLOR_CODING_MIN);
+    F7 (REG_CAMERA_FORMAT7_PACKET_PARA_INQ) = VIRTUAL_PACKET_UNIT << 16 |
+        VIRTUAL_PACKET_MAX;
+    F7 (REG_CAMERA_FORMAT7_BYTE_PER_PACKET) = VIRTUAL_PACKET_MAX << 16;
+    F7 (REG_CAMERA_FORMAT7_COLOR_FILTER_ID) =
+        (dev->filter - DC1394_COLOR_FILTER_MIN) << 24;
+    update_format7 (dev);
+}
+
+static uint32_t *
+device_register (platform_device_t * dev, uint64_t offset, int * page)
+{
+    if (offset >= ROM_BUS_INFO_BLOCK &&
+            offset < ROM_BUS_INFO_BLOCK + VIRTUAL_ROM_SIZE) {
+        *page = 0;
+        return dev->rom + (offset - ROM_BUS_INFO_BLOCK) / 4;
+    }
+    if (offset >= VIRTUAL_COMMAND_BASE &&
+            offset < VIRTUAL_COMMAND_BASE + VIRTUAL_COMMAND_SIZE) {
+        *page = 1;
+        return dev->command + (offset - VIRTUAL_COMMAND_BASE) / 4;
+    }
+    if (offset >= VIRTUAL_FORMAT7_BASE &&
+            offset < VIRTUAL_FORMAT7_BASE + VIRTUAL_FORMAT7_SIZE) {
+        *page = 2;
+        return dev->format7 + (offset - VIRTUAL_FORMAT7_BASE) / 4;
+    }
+    return NULL;
+}
+
+int
+virtual_device_read (platform_device_t * dev, uint64_t offset,
+        uint32_t * quads, int num_quads)
+{
+    int i, page;
+
+    if (offset % 4)
+        return -1;
+
+    pthread_mutex_lock (&dev->mutex);
+    for (i = 0; i < num_quads; i++) {
+        uint32_t * reg = device_register (dev, offset + 4 * i, &page);
+        if (!reg) {
+            pthread_mutex_unlock (&dev->mutex);
+            return -1;
+        }
+        quads[i] = *reg;
+    }
+    pthread_mutex_unlock (&dev->mutex);
+    return 0;
+}
+
+static void
+write_command (platform_device_t * dev, uint32_t reg, uint32_t value)
+{
+    switch (reg) {
+    case REG_CAMERA_INITIALIZE:
+        if (value & 0x80000000) {
+            reset_registers (dev);
+            pthread_cond_broadcast (&dev->changed);
+        }
+        return;
+    case REG_CAMERA_ISO_EN:
+        CMD (reg) = value & 0x80000000;
+        pthread_cond_broadcast (&dev->changed);
+        return;
+    case REG_CAMERA_ONE_SHOT:
+        /* Cleared again once the shots are sent */
+        CMD (reg) = value & 0xc000ffff;
+        if (value & 0x80000000)
+            dev->shots = 1;
+        else if (value & 0x40000000)
+            dev->shots = value & 0xffff;
+        else
+            dev->shots = 0;
+        pthread_cond_broadcast (&dev->changed);
+        return;
+    }
+
+    /* Inquiry registers are read-only */
+    if (reg < REG_CAMERA_FRAME_RATE ||
+            (reg >= REG_CAMERA_FEATURE_ABS_HI_BASE &&
+             reg < REG_CAMERA_FEATURE_HI_BASE))
+        return;
+    /* So are features that are not there */
+    if (reg >= REG_CAMERA_FEATURE_HI_BASE) {
+        if (!(CMD (reg) & 0x80000000))
+            return;
+        value |= 0x80000000;
+    }
+    CMD (reg) = value;
+}
+
+static void
+write_format7 (platform_device_t * dev, uint32_t reg, uint32_t value)
+{
+    switch (reg) {
+    case REG_CAMERA_FORMAT7_IMAGE_POSITION:
+    case REG_CAMERA_FORMAT7_IMAGE_SIZE:
+    case REG_CAMERA_FORMAT7_COLOR_CODING_ID:
+        F7 (reg) = value;
+        break;
+    case REG_CAMERA_FORMAT7_BYTE_PER_PACKET:
+        F7 (reg) = (value & 0xffff0000) | (F7 (reg) & 0xffff);
+        break;
+    case REG_CAMERA_FORMAT7_VALUE_SETTING:
+        break;
+    default:
+        return;
+    }
+    /* Settings take effect at once, so the IIDC 1.30 handshake always
+     * finds them done */
+    update_format7 (dev);
+}
+
+int
+virtual_device_write (platform_device_t * dev, uint64_t offset,
+        const uint32_t * quads, int num_quads)
+{
+    int i, page;
+
+    if (offset % 4)
+        return -1;
+
+    pthread_mutex_lock (&dev->mutex);
+    for (i = 0; i < num_quads; i++) {
+        uint32_t * reg = device_register (dev, offset + 4 * i, &page);
+        if (!reg || page == 0) {
+            pthread_mutex_unlock (&dev->mutex);
+            return -1;
+        }
+        if (page == 1)
+            write_command (dev, offset + 4 * i - VIRTUAL_COMMAND_BASE,
+                    quads[i]);
+        else
+            write_format7 (dev, offset + 4 * i - VIRTUAL_FORMAT7_BASE,
+                    quads[i]);
+    }
+    pthread_mutex_unlock (&dev->mutex);
+    return 0;
+}
+
+/* Tells whether a device sends frames, with its mutex held */
+int
+virtual_device_transmitting (platform_device_t * dev)
+{
+    return (CMD (REG_CAMERA_ISO_EN) & 0x80000000) || dev->shots;
+}
+
+/* Parses the description of a camera, see the top of this file */
+static int
+parse_device (platform_device_t * dev, char * desc, int index)
+{
+    char * save = NULL;
+    char * item;
+    int i;
+
+    dev->guid = VIRTUAL_GUID + index;
+    dev->width = 640;
+    dev->height = 480;
+    dev->coding = DC1394_COLOR_CODING_MONO8;
+    dev->filter = DC1394_COLOR_FILTER_RGGB;
+    dev->fps = 30;
+    dev->source = VIRTUAL_SOURCE_GRADIENT;
+
+    for (item = strtok_r (desc, ",", &save); item;
+            item = strtok_r (NULL, ",", &save)) {
+        char * value = strchr (item, '=');
+        int found = 0;
+
+        if (!value) {
+            dc1394_log_error ("virtual: Expected key=value, got %s", item);
+            return -1;
+        }
+        *value++ = '\0';
+
+        if (!strcmp (item, "width"))
+            dev->width = strtoul (value, NULL, 0);
+        else if (!strcmp (item, "height"))
+            dev->height = strtoul (value, NULL, 0);
+        else if (!strcmp (item, "depth"))
+            dev->depth = strtoul (value, NULL, 0);
+        else if (!strcmp (item, "fps"))
+            dev->fps = strtod (value, NULL);
+        else if (!strcmp (item, "guid"))
+            dev->guid = strtoull (value, NULL, 0);
+        else if (!strcmp (item, "file")) {
+            free (dev->path);
+            dev->path = strdup (value);
+            dev->source = VIRTUAL_SOURCE_FILE;
+        }
+        else if (!strcmp (item, "source")) {
+            if (!strcmp (value, "gradient"))
+                dev->source = VIRTUAL_SOURCE_GRADIENT;
+            else if (!strcmp (value, "noise"))
+                dev->source = VIRTUAL_SOURCE_NOISE;
+            else {
+                dc1394_log_error ("virtual: Unknown source %s", value);
+                return -1;
+            }
+        }
+        else if (!strcmp (item, "coding")) {
+            for (i = 0; i < sizeof virtual_codings / sizeof virtual_codings[0];
+                    i++) {
+                if (!strcmp (value, virtual_codings[i].name)) {
+                    dev->coding = virtual_codings[i].coding;
+                    found = 1;
+                }
+            }
+            if (!found) {
+                dc1394_log_error ("virtual: Unknown coding %s", value);
+                return -1;
+            }
+        }
+        else if (!strcmp (item, "filter")) {
+            for (i = 0; i < sizeof virtual_filters / sizeof virtual_filters[0];
+                    i++) {
+                if (!strcmp (value, virtual_filters[i].name)) {
+                    dev->filter = virtual_filters[i].filter;
+                    found = 1;
+                }
+            }
+            if (!found) {
+                dc1394_log_error ("virtual: Unknown filter %s", value);
+                return -1;
+            }
+        }
+        else {
+            dc1394_log_error ("virtual: Unknown setting %s", item);
+            return -1;
+        }
+    }
+
+    if (dev->width == 0 || dev->width > 0xffff ||
+            dev->height == 0 || dev->height > 0xffff || dev->fps <= 0) {
+        dc1394_log_error ("virtual: Bad size or frame rate for camera %d",
+                index);
+        return -1;
+    }
+    if (dev->depth == 0)
+        dc1394_get_color_coding_data_depth (dev->coding, &dev->depth);
+    return 0;
+}
+
+static void
+device_free (platform_device_t * dev)
+{
+    pthread_cond_destroy (&dev->changed);
+    pthread_mutex_destroy (&dev->mutex);
+    free (dev->path);
+}
+
+static void
+dc1394_virtual_free (platform_t * p)
+{
+    int i;
+
+    for (i = 0; i < p->num_devices; i++)
+        device_free (p->devices + i);
+    free (p->devices);
+    free (p);
+}
+
+static platform_t *
+dc1394_virtual_new (void)
+{
+    const char * env = getenv ("DC1394_VIRTUAL");
+    char * descs, * desc, * save = NULL;
+    platform_t * p;
+    int i;
+
+    if (!env || !*env)
+        return NULL;
+
+    p = calloc (1, sizeof (platform_t));
+    descs = strdup (env);
+    if (!p || !descs) {
+        free (p);
+        free (descs);
+        return NULL;
+    }
+
+    for (desc = strtok_r (descs, ";", &save); desc;
+            desc = strtok_r (NULL, ";", &save)) {
+        platform_device_t * devices;
+        platform_device_t * dev;
+
+        devices = realloc (p->devices,
+                (p->num_devices + 1) * sizeof (platform_device_t));
+        if (!devices)
+            break;
+        p->devices = devices;
+        dev = p->devices + p->num_devices;
+        memset (dev, 0, sizeof (platform_device_t));
+
+        if (parse_device (dev, desc, p->num_devices) < 0) {
+            free (dev->path);
+            continue;
+        }
+        p->num_devices++;
+    }
+    free (descs);
+
+    if (p->num_devices == 0) {
+        free (p->devices);
+        free (p);
+        return NULL;
+    }
+
+    /* Once the devices no longer move */
+    for (i = 0; i < p->num_devices; i++) {
+        platform_device_t * dev = p->devices + i;
+        pthread_condattr_t attr;
+
+        /* Capture threads wait on it with deadlines */
+        pthread_mutex_init (&dev->mutex, NULL);
+        pthread_condattr_init (&attr);
+        pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+        pthread_cond_init (&dev->changed, &attr);
+        pthread_condattr_destroy (&attr);
+
+        build_rom (dev);
+        reset_registers (dev);
+    }
+    dc1394_log_debug ("virtual: %d cameras", p->num_devices);
+    return p;
+}
+
+static platform_device_list_t *
+dc1394_virtual_get_device_list (platform_t * p)
+{
+    platform_device_list_t * list;
+    int i;
+
+    list = calloc (1, sizeof (platform_device_list_t));
+    if (!list)
+        return NULL;
+    list->p = p;
+    list->devices = calloc (p->num_devices, sizeof (platform_device_t *));
+    if (!list->devices) {
+        free (list);
+        return NULL;
+    }
+    for (i = 0; i < p->num_devices; i++)
+        list->devices[i] = p->devices + i;
+    list->num_devices = p->num_devices;
+    return list;
+}
+
+static void
+dc1394_virtual_free_device_list (platform_device_list_t * d)
+{
+    free (d->devices);
+    free (d);
+}
+
+static int
+dc1394_virtual_device_get_config_rom (platform_device_t * device,
+        uint32_t * quads, int * num_quads)
+{
+    if (*num_quads > VIRTUAL_ROM_SIZE / 4)
+        *num_quads = VIRTUAL_ROM_SIZE / 4;
+    return virtual_device_read (device, ROM_BUS_INFO_BLOCK, quads,
+            *num_quads);
+}
+
+static platform_camera_t *
+dc1394_virtual_camera_new (platform_t * p, platform_device_t * device,
+        uint32_t unit_directory_offset)
+{
+    platform_camera_t * cam = calloc (1, sizeof (platform_camera_t));
+    if (!cam)
+        return NULL;
+    cam->device = device;
+    return cam;
+}
+
+static void
+dc1394_virtual_camera_free (platform_camera_t * cam)
+{
+    if (cam->capture_is_set)
+        dc1394_virtual_capture_stop (cam);
+    free (cam);
+}
+
+static void
+dc1394_virtual_camera_set_parent (platform_camera_t * cam,
+        dc1394camera_t * parent)
+{
+    cam->camera = parent;
+}
+
+static dc1394error_t
+dc1394_virtual_camera_print_info (platform_camera_t * camera, FILE *fd)
+{
+    platform_device_t * dev = camera->device;
+
+    fprintf(fd,"------ Camera platform-specific information ------\n");
+    fprintf(fd,"Virtual camera size               :     %dx%d\n",
+            dev->width, dev->height);
+    fprintf(fd,"Frame rate                        :     %g\n", dev->fps);
+    fprintf(fd,"Source                            :     %s\n",
+            dev->source == VIRTUAL_SOURCE_FILE ? dev->path :
+            dev->source == VIRTUAL_SOURCE_NOISE ? "noise" : "gradient");
+    return DC1394_SUCCESS;
+}
+
+static dc1394error_t
+dc1394_virtual_camera_read (platform_camera_t * cam, uint64_t offset,
+        uint32_t * quads, int num_quads)
+{
+    /* Reject the addresses the device has no register at, as a camera
+     * answers with an address error */
+    if (virtual_device_read (cam->device, offset, quads, num_quads) < 0)
+        return DC1394_FUNCTION_NOT_SUPPORTED;
+    return DC1394_SUCCESS;
+}
+
+static dc1394error_t
+dc1394_virtual_camera_write (platform_camera_t * cam, uint64_t offset,
+        const uint32_t * quads, int num_quads)
+{
+    if (virtual_device_write (cam->device, offset, quads, num_quads) < 0)
+        return DC1394_FUNCTION_NOT_SUPPORTED;
+    return DC1394_SUCCESS;
+}
+
+static dc1394error_t
+dc1394_virtual_camera_get_node (platform_camera_t * cam, uint32_t * node,
+        uint32_t * generation)
+{
+    /* Each virtual camera is alone on its bus */
+    if (node)
+        *node = 0;
+    if (generation)
+        *generation = 0;
+    return DC1394_SUCCESS;
+}
+
+static dc1394error_t
+dc1394_virtual_reset_bus (platform_camera_t * cam)
+{
+    return DC1394_SUCCESS;
+}
+
+/* A bus cycle timer running off the monotonic clock: 8000 cycles per
+ * second, of 3072 ticks each */
+static dc1394error_t
+dc1394_virtual_read_cycle_timer (platform_camera_t * cam,
+        uint32_t * cycle_timer, uint64_t * local_time)
+{
+    struct timespec ts;
+    struct timeval tv;
+    uint64_t ticks;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    gettimeofday (&tv, NULL);
+    ticks = (uint64_t) ts.tv_sec * 24576000 +
+        (uint64_t) ts.tv_nsec * 24576 / 1000000;
+
+    if (cycle_timer)
+        *cycle_timer = (ticks / 24576000 % 128) << 25 |
+            (ticks / 3072 % 8000) << 12 | ticks % 3072;
+    if (local_time)
+        *local_time = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+    return DC1394_SUCCESS;
+}
+
+static platform_dispatch_t
+virtual_dispatch = {
+    .platform_new = dc1394_virtual_new,
+    .platform_free = dc1394_virtual_free,
+
+    .get_device_list = dc1394_virtual_get_device_list,
+    .free_device_list = dc1394_virtual_free_device_list,
+    .device_get_config_rom = dc1394_virtual_device_get_config_rom,
+
+    .camera_new = dc1394_virtual_camera_new,
+    .camera_free = dc1394_virtual_camera_free,
+    .camera_set_parent = dc1394_virtual_camera_set_parent,
+
+    .camera_print_info = dc1394_virtual_camera_print_info,
+    .camera_get_node = dc1394_virtual_camera_get_node,
+    .reset_bus = dc1394_virtual_reset_bus,
+    .read_cycle_timer = dc1394_virtual_read_cycle_timer,
+
+    .camera_read = dc1394_virtual_camera_read,
+    .camera_write = dc1394_virtual_camera_write,
+
+    .capture_setup = dc1394_virtual_capture_setup,
+    .capture_setup_with_buffers = dc1394_virtual_capture_setup_with_buffers,
+    .capture_stop = dc1394_virtual_capture_stop,
+    .capture_dequeue = dc1394_virtual_capture_dequeue,
+    .capture_enqueue = dc1394_virtual_capture_enqueue,
+    .capture_get_fileno = dc1394_virtual_capture_get_fileno,
+};
+
+void
+dc1394_virtual_init(dc1394_t * d)
+{
+    register_platform (d, &virtual_dispatch, "virtual");
+}
@@ -0,0 +1,156 @@
+/*
+ * 1394-Based Digital Camera Control Library
+ *
+ * Virtual camera backend for dc1394
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __DC1394_VIRTUAL_H__
+#define __DC1394_VIRTUAL_H__
+
+#include <pthread.h>
+#include "config.h"
+#include "internal.h"
+#include "register.h"
+#include "offsets.h"
+
+/* Where the emulated registers are, relative to CONFIG_ROM_BASE like all
+ * the offsets passed to the backend */
+#define VIRTUAL_ROM_SIZE        0x400
+#define VIRTUAL_COMMAND_BASE    0xF00000
+#define VIRTUAL_COMMAND_SIZE    0x1000
+#define VIRTUAL_FORMAT7_BASE    0xF01000
+#define VIRTUAL_FORMAT7_SIZE    0x100
+
+typedef enum {
+    VIRTUAL_SOURCE_GRADIENT,
+    VIRTUAL_SOURCE_NOISE,
+    VIRTUAL_SOURCE_FILE,
+} virtual_source_t;
+
+/* A virtual camera, as described in DC1394_VIRTUAL.  Its registers live
+ * here rather than in the camera handles, so that they keep their values
+ * from one handle to the next as on a real camera. */
+struct _platform_device_t {
+    uint64_t guid;
+    uint32_t width;
+    uint32_t height;
+    dc1394color_coding_t coding;
+    dc1394color_filter_t filter;
+    uint32_t depth;
+    double fps;
+    virtual_source_t source;
+    char * path;
+
+    pthread_mutex_t mutex;
+    /* Signalled when transmission is switched on or off, or shots are
+     * requested */
+    pthread_cond_t changed;
+    uint32_t rom[VIRTUAL_ROM_SIZE / 4];
+    uint32_t command[VIRTUAL_COMMAND_SIZE / 4];
+    uint32_t format7[VIRTUAL_FORMAT7_SIZE / 4];
+    uint32_t shots;
+};
+
+struct _platform_t {
+    platform_device_t * devices;
+    int num_devices;
+};
+
+typedef enum {
+    BUFFER_EMPTY,
+    BUFFER_FILLED,
+} virtual_frame_status;
+
+struct virtual_frame {
+    dc1394video_frame_t frame;
+    virtual_frame_status status;
+};
+
+struct _platform_camera_t {
+    platform_device_t * device;
+    dc1394camera_t * camera;
+
+    struct virtual_frame * frames;
+    unsigned char * buffer;
+    size_t buffer_size;
+    size_t buffer_alloc_size;
+    uint32_t flags;
+    unsigned int num_frames;
+    int current;
+
+    /* Images the frames are filled from, one after the other */
+    unsigned char * source;
+    uint32_t num_sources;
+
+    /* Filled frame indices, passed from the producer thread as in the
+     * usb backend */
+    uint32_t * ring;
+    uint32_t ring_head;
+    uint32_t ring_tail;
+    int notify_fd[2];
+
+    /* The notify fd is posted once per frames_per_interrupt frames, and
+     * dequeue takes all the frames of the interrupts it consumes at once,
+     * as juju does */
+    uint32_t frames_per_interrupt;
+    uint32_t since_interrupt;
+    uint32_t interrupt_tail;
+    uint32_t interrupts;
+    uint32_t interrupts_taken;
+    uint32_t frames_ready;
+
+    pthread_t thread;
+    int thread_created;
+    int stop;
+    uint32_t fill_next;
+    uint64_t dropped;
+
+    int capture_is_set;
+    int iso_auto_started;
+};
+
+/* Register space of a device, see control.c */
+int virtual_device_read (platform_device_t * dev, uint64_t offset,
+        uint32_t * quads, int num_quads);
+int virtual_device_write (platform_device_t * dev, uint64_t offset,
+        const uint32_t * quads, int num_quads);
+int virtual_device_transmitting (platform_device_t * dev);
+
+dc1394error_t
+dc1394_virtual_capture_setup(platform_camera_t *craw, uint32_t num_dma_buffers,
+        uint32_t flags);
+
+dc1394error_t
+dc1394_virtual_capture_setup_with_buffers(platform_camera_t *craw,
+        uint32_t num_buffers, uint32_t flags, unsigned char ** buffers,
+        size_t buffer_size);
+
+dc1394error_t
+dc1394_virtual_capture_stop(platform_camera_t *craw);
+
+dc1394error_t
+dc1394_virtual_capture_dequeue (platform_camera_t * craw,
+        dc1394capture_policy_t policy, dc1394video_frame_t **frame_return);
+
+dc1394error_t
+dc1394_virtual_capture_enqueue (platform_camera_t * craw,
+        dc1394video_frame_t * frame);
+
+int
+dc1394_virtual_capture_get_fileno (platform_camera_t * craw);
+
+#endif
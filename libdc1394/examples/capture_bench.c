@@ -0,0 +1,321 @@
+/*
+ * Measures the overhead of the capture path, on a virtual camera
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * For each frame rate, a virtual camera (see dc1394/virtual/control.c) is
+ * set up with the given size and captured from for a while, the way an
+ * event-driven application does it: poll() on the capture fd, then
+ * dequeue and enqueue. Reported per rate:
+ *
+ *   frames, missed    frames received, and how many fewer than the rate
+ *                     asks for over the time they were received in
+ *   latency           from the camera filling a frame to the dequeue
+ *                     returning it, in microseconds
+ *   call              time spent in dequeue and enqueue once poll() said a
+ *                     frame was ready, in nanoseconds
+ *   cpu, csw          CPU time and context switches of the capturing
+ *                     thread, per frame
+ *   syscalls          system calls of the capturing thread per frame:
+ *                     polls, and reads and writes from /proc/thread-self/io
+ *
+ * Frames are small by default, so that the copy the camera does for each
+ * of them does not hide the rest. Linux only.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <dc1394/dc1394.h>
+
+#define BENCH_GUID ((uint64_t) 0x0000564952540000ULL)
+
+typedef struct {
+    struct rusage usage;
+    uint64_t syscalls;
+    uint64_t polls;
+} counters_t;
+
+static uint64_t
+now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t
+now_us (void)
+{
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Read and write system calls of this thread, or 0 if unknown */
+static uint64_t
+thread_syscalls (void)
+{
+    FILE * f = fopen ("/proc/thread-self/io", "r");
+    char line[128];
+    uint64_t n, total = 0;
+
+    if (!f)
+        return 0;
+    while (fgets (line, sizeof line, f)) {
+        if (sscanf (line, "syscr: %"SCNu64, &n) == 1 ||
+                sscanf (line, "syscw: %"SCNu64, &n) == 1)
+            total += n;
+    }
+    fclose (f);
+    return total;
+}
+
+static void
+read_counters (counters_t * c, uint64_t polls)
+{
+    getrusage (RUSAGE_THREAD, &c->usage);
+    c->syscalls = thread_syscalls ();
+    c->polls = polls;
+}
+
+static int
+compare (const void * a, const void * b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t
+percentile (const uint64_t * sorted, uint64_t n, double p)
+{
+    if (n == 0)
+        return 0;
+    return sorted[(uint64_t) (p * (n - 1))];
+}
+
+static double
+timeval_us (const struct timeval * tv)
+{
+    return tv->tv_sec * 1e6 + tv->tv_usec;
+}
+
+/* Captures for a while at one rate, and prints a line of results */
+static int
+run (double fps, double seconds, unsigned int width, unsigned int height,
+        uint32_t num_buffers, int wait)
+{
+    char env[128];
+    dc1394_t * d = NULL;
+    dc1394camera_t * camera = NULL;
+    dc1394video_frame_t * frame;
+    dc1394error_t err;
+    counters_t start, end;
+    uint64_t max_frames = fps * seconds * 1.5 + 1000;
+    uint64_t * latency = malloc (max_frames * sizeof (uint64_t));
+    uint64_t * call = malloc (max_frames * sizeof (uint64_t));
+    uint64_t frames = 0, polls = 0, t_start, t_end;
+    uint64_t expected;
+    struct pollfd pfd;
+    double cpu;
+    int capturing = 0;
+    int ret = -1;
+
+    if (!latency || !call)
+        goto cleanup;
+
+    snprintf (env, sizeof env, "guid=0x%"PRIx64",width=%u,height=%u,fps=%g",
+            BENCH_GUID, width, height, fps);
+    setenv ("DC1394_VIRTUAL", env, 1);
+
+    d = dc1394_new ();
+    if (!d)
+        goto cleanup;
+    camera = dc1394_camera_new (d, BENCH_GUID);
+    if (!camera) {
+        dc1394_log_error ("No virtual camera: the library must be built for Linux");
+        goto cleanup;
+    }
+
+    err = dc1394_capture_setup (camera, num_buffers, DC1394_CAPTURE_FLAGS_DEFAULT);
+    if (err != DC1394_SUCCESS) {
+        dc1394_log_error ("Could not set capture up");
+        goto cleanup;
+    }
+    capturing = 1;
+    err = dc1394_video_set_transmission (camera, DC1394_ON);
+    if (err != DC1394_SUCCESS) {
+        dc1394_log_error ("Could not start transmission");
+        goto cleanup;
+    }
+
+    pfd.fd = dc1394_capture_get_fileno (camera);
+    pfd.events = POLLIN;
+
+    /* Let the camera get going */
+    t_end = now_ns () + 100000000;
+    while (now_ns () < t_end) {
+        if (poll (&pfd, 1, 100) <= 0)
+            continue;
+        dc1394_capture_dequeue (camera, DC1394_CAPTURE_POLICY_POLL, &frame);
+        if (frame)
+            dc1394_capture_enqueue (camera, frame);
+    }
+
+    read_counters (&start, polls);
+    t_start = now_ns ();
+    t_end = t_start + seconds * 1e9;
+    while (now_ns () < t_end && frames < max_frames) {
+        uint64_t t0, t1;
+
+        if (!wait) {
+            polls++;
+            if (poll (&pfd, 1, 1000) <= 0)
+                continue;
+        }
+        t0 = now_ns ();
+        err = dc1394_capture_dequeue (camera, wait ? DC1394_CAPTURE_POLICY_WAIT :
+                DC1394_CAPTURE_POLICY_POLL, &frame);
+        if (err != DC1394_SUCCESS || !frame)
+            continue;
+        latency[frames] = now_us () - frame->timestamp;
+        dc1394_capture_enqueue (camera, frame);
+        t1 = now_ns ();
+        call[frames] = t1 - t0;
+        frames++;
+    }
+    read_counters (&end, polls);
+    t_end = now_ns ();
+
+    dc1394_video_set_transmission (camera, DC1394_OFF);
+
+    expected = (t_end - t_start) * fps / 1e9;
+
+    qsort (latency, frames, sizeof (uint64_t), compare);
+    qsort (call, frames, sizeof (uint64_t), compare);
+    cpu = timeval_us (&end.usage.ru_utime) - timeval_us (&start.usage.ru_utime) +
+        timeval_us (&end.usage.ru_stime) - timeval_us (&start.usage.ru_stime);
+
+    printf ("%8g %8"PRIu64" %7"PRId64" | %6"PRIu64" %6"PRIu64" %6"PRIu64" %6"PRIu64" %7"PRIu64" |",
+            fps, frames, expected > frames ? (int64_t) (expected - frames) : 0,
+            percentile (latency, frames, 0.5), percentile (latency, frames, 0.9),
+            percentile (latency, frames, 0.99), percentile (latency, frames, 0.999),
+            frames ? latency[frames - 1] : 0);
+    if (wait)
+        printf ("      -      - |");
+    else
+        printf (" %6"PRIu64" %6"PRIu64" |", percentile (call, frames, 0.5),
+                percentile (call, frames, 0.99));
+    if (frames) {
+        printf (" %7.2f %5.2f", cpu / frames,
+                (double) (end.usage.ru_nvcsw + end.usage.ru_nivcsw -
+                    start.usage.ru_nvcsw - start.usage.ru_nivcsw) / frames);
+        if (end.syscalls)
+            printf (" %8.2f\n", (double) (end.syscalls - start.syscalls +
+                        end.polls - start.polls) / frames);
+        else
+            printf ("        -\n");
+    }
+    else
+        printf ("       -     -        -\n");
+    ret = 0;
+
+cleanup:
+    if (capturing)
+        dc1394_capture_stop (camera);
+    if (camera)
+        dc1394_camera_free (camera);
+    if (d)
+        dc1394_free (d);
+    free (latency);
+    free (call);
+    return ret;
+}
+
+static void
+usage (const char * name)
+{
+    fprintf (stderr,
+            "Usage: %s [-r rate,...] [-t seconds] [-s WxH] [-b buffers] [-w]\n"
+            "  -r  frame rates to run at (default 30,1000,5000,20000)\n"
+            "  -t  seconds per rate (default 2)\n"
+            "  -s  image size (default 64x48)\n"
+            "  -b  number of capture buffers (default 16)\n"
+            "  -w  block in dequeue instead of polling the capture fd\n",
+            name);
+}
+
+int main(int argc, char *argv[])
+{
+    char * rates = strdup ("30,1000,5000,20000");
+    char * rate, * save = NULL;
+    double seconds = 2;
+    unsigned int width = 64, height = 48;
+    uint32_t num_buffers = 16;
+    int wait = 0;
+    int opt;
+
+    while ((opt = getopt (argc, argv, "r:t:s:b:wh")) != -1) {
+        switch (opt) {
+        case 'r':
+            free (rates);
+            rates = strdup (optarg);
+            break;
+        case 't':
+            seconds = atof (optarg);
+            break;
+        case 's':
+            if (sscanf (optarg, "%ux%u", &width, &height) != 2) {
+                usage (argv[0]);
+                return 1;
+            }
+            break;
+        case 'b':
+            num_buffers = atoi (optarg);
+            break;
+        case 'w':
+            wait = 1;
+            break;
+        default:
+            usage (argv[0]);
+            return 1;
+        }
+    }
+
+    printf ("%ux%u mono8, %u buffers, %g s per rate, %s\n\n", width, height,
+            num_buffers, seconds, wait ? "blocking dequeue" : "poll() and dequeue");
+    printf ("     fps   frames  missed |        latency (us)                 |  call (ns)    | per frame\n");
+    printf ("                          |    p50    p90    p99  p99.9     max |    p50    p99 | cpu(us)   csw syscalls\n");
+
+    for (rate = strtok_r (rates, ",", &save); rate;
+            rate = strtok_r (NULL, ",", &save)) {
+        if (run (atof (rate), seconds, width, height, num_buffers, wait) < 0) {
+            free (rates);
+            return 1;
+        }
+    }
+    free (rates);
+    return 0;
+}
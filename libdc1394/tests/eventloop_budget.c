@@ -0,0 +1,118 @@
+/*
+ * Checks that the event loop delivers every frame when one wakeup of the
+ * capture fd brings more frames than its budget
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * A virtual camera completes 16 frames per interrupt, as juju does with
+ * frames_per_interrupt, and sends a fixed number of shots. The loop may
+ * only deliver 4 frames per turn: the rest of each interrupt must still
+ * reach the handler, although the capture fd is not readable for them.
+ *
+ * Exit status follows the automake conventions: 0 on success, 1 on
+ * failure, 77 when no virtual camera can be used.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dc1394/dc1394.h>
+
+#define TEST_GUID 0x0000564952540000ULL
+#define SHOTS 48
+#define FRAMES_PER_INTERRUPT 16
+#define BUDGET 4
+
+static void
+count_frame (dc1394camera_t * camera, dc1394video_frame_t * frame,
+        void * user_data)
+{
+    __atomic_add_fetch ((uint32_t *) user_data, 1, __ATOMIC_RELAXED);
+}
+
+int main(int argc, char *argv[])
+{
+    dc1394capture_options_t options = { 0 };
+    dc1394eventloop_t * loop = NULL;
+    dc1394camera_t * camera = NULL;
+    dc1394_t * d;
+    uint32_t frames = 0;
+    int status = 1, i;
+
+    setenv ("DC1394_VIRTUAL", "guid=0x0000564952540000,width=64,height=48,fps=2000", 1);
+
+    d = dc1394_new ();
+    if (!d)
+        return 77;
+    camera = dc1394_camera_new (d, TEST_GUID);
+    if (!camera) {
+        fprintf (stderr, "No virtual camera\n");
+        dc1394_free (d);
+        return 77;
+    }
+
+    options.frames_per_interrupt = FRAMES_PER_INTERRUPT;
+    if (dc1394_capture_setup_with_options (camera, 2 * SHOTS,
+                DC1394_CAPTURE_FLAGS_DEFAULT, &options) != DC1394_SUCCESS) {
+        fprintf (stderr, "Could not set capture up\n");
+        goto out;
+    }
+
+    loop = dc1394_eventloop_new (1, BUDGET);
+    if (!loop) {
+        fprintf (stderr, "Could not create the event loop\n");
+        status = 77;
+        goto stop;
+    }
+    if (dc1394_eventloop_add_camera (loop, camera, count_frame,
+                &frames) != DC1394_SUCCESS) {
+        fprintf (stderr, "Could not add the camera to the event loop\n");
+        goto stop;
+    }
+
+    if (dc1394_video_set_multi_shot (camera, SHOTS, DC1394_ON) !=
+            DC1394_SUCCESS) {
+        fprintf (stderr, "Could not start the shots\n");
+        goto stop;
+    }
+
+    /* The shots take 24 ms; give the loop plenty of time */
+    for (i = 0; i < 200; i++) {
+        if (__atomic_load_n (&frames, __ATOMIC_RELAXED) >= SHOTS)
+            break;
+        usleep (10000);
+    }
+    /* And a bit more to catch frames delivered twice */
+    usleep (50000);
+
+    frames = __atomic_load_n (&frames, __ATOMIC_RELAXED);
+    printf ("%u of %u frames delivered\n", frames, SHOTS);
+    if (frames == SHOTS)
+        status = 0;
+
+ stop:
+    if (loop) {
+        dc1394_eventloop_remove_camera (loop, camera);
+        dc1394_eventloop_free (loop);
+    }
+    dc1394_capture_stop (camera);
+ out:
+    dc1394_camera_free (camera);
+    dc1394_free (d);
+    return status;
+}